@@ -0,0 +1,183 @@
+#include "autotune.h"
+#include <algorithm>
+#include <qdebug.h>
+#include "jobs.h"
+
+static const char* PARAM_NAMES[TUNE_PARAMS] = {
+	"cell scale", "workers", "integrate grain", "narrowphase grain", "reorder interval"
+};
+
+static long long median(std::vector<long long> v){
+	if (v.empty()) return 0;
+	std::nth_element(v.begin(), v.begin() + v.size() / 2, v.end());
+	return v[v.size() / 2];
+}
+
+Autotuner::Autotuner(){
+	reset();
+}
+
+void Autotuner::reset(){
+	state = TUNE_WARMUP;
+	param = -1, candidate = 0, skip = 0;
+	values.clear(), costs.clear(), samples.clear();
+	reorderNs = 0, baselineNs = 0;
+	startSpheres = 0, tunedSpheres = 0;
+	lastDensity = tunedDensity = 0;
+}
+
+const char* Autotuner::describe() const {
+	if (state == TUNE_WARMUP) return "warming up";
+	if (state == TUNE_SETTLED) return "settled";
+	return PARAM_NAMES[param];
+}
+
+float Autotuner::get(const TuneSettings& s, int param){
+	switch (param) {
+	case TUNE_CELL_SCALE: return s.cellScale;
+	case TUNE_WORKERS: return s.workers;
+	case TUNE_INTEGRATE_GRAIN: return s.integrateGrain;
+	case TUNE_NARROWPHASE_GRAIN: return s.narrowphaseGrain;
+	default: return s.reorderInterval;
+	}
+}
+
+void Autotuner::set(TuneSettings& s, int param, float value){
+	switch (param) {
+	case TUNE_CELL_SCALE: s.cellScale = value; break;
+	case TUNE_WORKERS: s.workers = (int)value; break;
+	case TUNE_INTEGRATE_GRAIN: s.integrateGrain = (int)value; break;
+	case TUNE_NARROWPHASE_GRAIN: s.narrowphaseGrain = (int)value; break;
+	default: s.reorderInterval = (int)value; break;
+	}
+}
+
+long long Autotuner::cost(int param, const StepTimings& t){
+	// Only the phases a parameter acts on, the others just add noise
+	switch (param) {
+	case TUNE_CELL_SCALE: return t.broadphase + t.narrowphase;
+	case TUNE_INTEGRATE_GRAIN: return t.integrate;
+	case TUNE_NARROWPHASE_GRAIN: return t.narrowphase + t.solve;
+	// Reordering is paid once per interval, it is added back amortized
+	default: return t.total - t.reorder;
+	}
+}
+
+void Autotuner::candidates(int param, float current, std::vector<float>& out) const {
+	out.clear();
+	// The current value is measured first, everything else has to beat it
+	out.push_back(current);
+	switch (param) {
+	case TUNE_CELL_SCALE:
+		for (float v : { 1.0f, 1.5f, 2.0f, 3.0f }) out.push_back(v);
+		break;
+	case TUNE_WORKERS: {
+		int pool = JobSystem::instance().workers();
+		if (pool == 0) break;
+		for (int v = 0; v < pool; v = std::max(2 * v, 1)) out.push_back(v);
+		out.push_back(pool);
+		break;
+	}
+	case TUNE_INTEGRATE_GRAIN:
+		for (int v = 512; v <= 8192; v *= 2) out.push_back(v);
+		break;
+	case TUNE_NARROWPHASE_GRAIN:
+		for (int v = 128; v <= 2048; v *= 2) out.push_back(v);
+		break;
+	default:
+		for (int v : { 0, 8, 32, 128 }) out.push_back(v);
+		break;
+	}
+	std::sort(out.begin() + 1, out.end());
+	out.erase(std::unique(out.begin() + 1, out.end()), out.end());
+	out.erase(std::remove(out.begin() + 1, out.end(), current), out.end());
+}
+
+bool Autotuner::observe(const StepTimings& t, TuneSettings& s){
+	lastDensity = t.density;
+	if (state == TUNE_SETTLED) {
+		float count = std::max(t.spheres, 1) / (float)std::max(tunedSpheres, 1);
+		float density = tunedDensity > 0 && t.density > 0 ? t.density / tunedDensity : 1;
+		if (std::max(count, 1 / count) < TUNE_RETUNE_RATIO && std::max(density, 1 / density) < TUNE_RETUNE_RATIO)
+			return false;
+		reset();
+	}
+
+	// Spawning or clearing mid-way makes the measurements so far meaningless
+	if (state != TUNE_WARMUP || !samples.empty()) {
+		float count = std::max(t.spheres, 1) / (float)std::max(startSpheres, 1);
+		if (std::max(count, 1 / count) >= TUNE_RETUNE_RATIO) {
+			abort(s);
+			reset();
+			return true;
+		}
+	}
+
+	if (state == TUNE_WARMUP) {
+		if (t.spheres < TUNE_MIN_SPHERES) {
+			samples.clear();
+			return false;
+		}
+		if (samples.empty()) startSpheres = t.spheres;
+		samples.push_back(t.total);
+		if ((int)samples.size() < TUNE_WARMUP_STEPS) return false;
+		baselineNs = median(samples);
+		state = TUNE_PROBING;
+		return nextParam(s);
+	}
+
+	if (skip > 0) {
+		skip--;
+		return false;
+	}
+	samples.push_back(cost(param, t));
+	reorderNs += t.reorder;
+	// Long enough for the slowest candidate interval to reorder at least once
+	int window = param == TUNE_REORDER ? std::max(TUNE_SAMPLE_STEPS, (int)values[candidate]) : TUNE_SAMPLE_STEPS;
+	if ((int)samples.size() < window) return false;
+	costs[candidate] = median(samples) + (param == TUNE_REORDER ? reorderNs / (long long)samples.size() : 0);
+	return nextCandidate(s);
+}
+
+bool Autotuner::nextCandidate(TuneSettings& s){
+	samples.clear();
+	reorderNs = 0;
+	skip = TUNE_SETTLE_STEPS;
+	if (++candidate < (int)values.size()) {
+		set(s, param, values[candidate]);
+		return true;
+	}
+
+	int best = std::min_element(costs.begin(), costs.end()) - costs.begin();
+	if (costs[best] >= costs[0] * (1 - TUNE_MIN_GAIN)) best = 0;
+	set(s, param, values[best]);
+	nextParam(s);
+	return true;
+}
+
+bool Autotuner::nextParam(TuneSettings& s){
+	samples.clear();
+	reorderNs = 0;
+	skip = TUNE_SETTLE_STEPS;
+	while (++param < TUNE_PARAMS) {
+		if (param == TUNE_WORKERS && s.workers < 0) continue;
+		candidates(param, get(s, param), values);
+		if (values.size() < 2) continue;
+		costs.assign(values.size(), 0);
+		candidate = 0;
+		return true;
+	}
+
+	state = TUNE_SETTLED;
+	tunedSpheres = startSpheres, tunedDensity = lastDensity;
+#ifdef DEBUG
+	qDebug() << "Autotune: steps took" << baselineNs / 1e6 << "ms before, now cell scale" << s.cellScale << "workers" << s.workers
+		<< "grains" << s.integrateGrain << s.narrowphaseGrain << "reorder every" << s.reorderInterval;
+#endif
+	return false;
+}
+
+void Autotuner::abort(TuneSettings& s){
+	if (state == TUNE_PROBING && param < TUNE_PARAMS && !values.empty())
+		set(s, param, values[0]);
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include <vector>
+
+// Engine settings that only trade speed, changed between steps
+struct TuneSettings {
+	// Broadphase cell size in mean sphere diameters, never below the largest diameter
+	float cellScale;
+	// Workers of the job pool allowed to take jobs, -1 to leave the pool alone
+	int workers;
+	// Spheres per parallel-for chunk
+	int integrateGrain, narrowphaseGrain;
+	// Steps between re-sorting sphere storage along the grid, 0 for never
+	int reorderInterval;
+};
+
+// Wall times of one step and of the phases the settings act on
+struct StepTimings {
+	long long total, integrate, broadphase, narrowphase, solve, reorder;
+	int spheres;
+	// Spheres per unit of volume of their bounding box
+	float density;
+};
+
+enum TunePhase { TUNE_WARMUP, TUNE_PROBING, TUNE_SETTLED };
+enum TuneParam { TUNE_CELL_SCALE, TUNE_WORKERS, TUNE_INTEGRATE_GRAIN, TUNE_NARROWPHASE_GRAIN, TUNE_REORDER, TUNE_PARAMS };
+
+// Steps measured with the initial settings before probing starts
+const int TUNE_WARMUP_STEPS = 60;
+// Steps skipped after every change, while caches and allocations settle
+const int TUNE_SETTLE_STEPS = 4;
+// Steps measured per candidate value
+const int TUNE_SAMPLE_STEPS = 24;
+// A candidate has to beat the current value by this fraction to replace it
+const float TUNE_MIN_GAIN = 0.03f;
+// Scenes smaller than this are not worth tuning, the timings are mostly noise
+const int TUNE_MIN_SPHERES = 256;
+// Sphere count or density ratio since the last tuning that starts a new one
+const float TUNE_RETUNE_RATIO = 1.5f;
+
+/*
+   Picks engine settings from measured step times instead of fixed guesses. After a warm-up,
+   the parameters are probed one at a time: every candidate value runs for a few steps and
+   the one with the lowest median time of the phases it affects is kept. Once every
+   parameter was probed the settings stay until the sphere count or density has changed a
+   lot, then tuning starts over.
+
+   What it picks depends on wall time, so deterministic runs do not tune at all and keep
+   the settings they started with.
+*/
+class Autotuner {
+public:
+	Autotuner();
+
+	// Starts over from the warm-up
+	void reset();
+	// Feeds the timings of the step that just ran. Returns true when it changed settings.
+	bool observe(const StepTimings& t, TuneSettings& settings);
+	// Puts back the value of a parameter still being probed
+	void abort(TuneSettings& settings);
+
+	TunePhase phase() const { return state; }
+	const char* describe() const;
+
+private:
+	static float get(const TuneSettings& s, int param);
+	static void set(TuneSettings& s, int param, float value);
+	static long long cost(int param, const StepTimings& t);
+
+	void candidates(int param, float current, std::vector<float>& out) const;
+	bool nextParam(TuneSettings& s);
+	bool nextCandidate(TuneSettings& s);
+
+	TunePhase state;
+	int param, candidate, skip;
+	std::vector<float> values;
+	std::vector<long long> costs, samples;
+	long long reorderNs, baselineNs;
+	// Scene size when the current tuning started and when it finished
+	int startSpheres, tunedSpheres;
+	float lastDensity, tunedDensity;
+};
@@ -0,0 +1,207 @@
+#include "bbapi.h"
+#include <new>
+#include <map>
+#include "physics.h"
+#include "jobs.h"
+
+struct bb_world {
+	bb_world(const bb_world_desc& desc) : engine(scene), dt(desc.dt), nextCollider(0), exported(false) {
+		engine.deterministic = desc.deterministic != 0;
+		engine.nbody = desc.nbody != 0;
+	}
+
+	// Fills the exported arrays from the spheres, once per change
+	void exportState();
+
+	Scene scene;
+	// Never started: steps run on the caller's thread, like offscreen capture
+	PhysicsEngine engine;
+	double dt;
+
+	std::map<int, Plane*> colliders;
+	int nextCollider;
+
+	bool exported;
+	std::vector<float> positions, velocities, radii;
+	std::vector<bb_handle> handles;
+};
+
+void bb_world::exportState(){
+	if (exported) return;
+	int n = scene.spheres.size();
+	positions.resize(3 * n), velocities.resize(3 * n), radii.resize(n), handles.resize(n);
+	JobSystem::instance().parallelFor(n, INTEGRATE_GRAIN, [this](int begin, int end) {
+		for (int i = begin; i < end; ++i) {
+			const Sphere* s = scene.spheres[i].get();
+			positions[3 * i] = s->pos.x, positions[3 * i + 1] = s->pos.y, positions[3 * i + 2] = s->pos.z;
+			velocities[3 * i] = s->velocity.x, velocities[3 * i + 1] = s->velocity.y, velocities[3 * i + 2] = s->velocity.z;
+			radii[i] = s->rad;
+			Handle h = scene.spheres.handleAt(i);
+			handles[i].index = h.index, handles[i].generation = h.generation;
+		}
+	});
+	exported = true;
+}
+
+static Handle toHandle(bb_handle h){
+	return Handle(h.index, h.generation);
+}
+
+static bb_array makeArray(const void* data, size_t count, size_t stride){
+	bb_array a;
+	a.data = count > 0 ? data : nullptr;
+	a.count = count, a.stride = stride;
+	return a;
+}
+
+int bb_abi_version(void){
+	return BB_ABI_VERSION;
+}
+
+int bb_set_threads(int threads, int pin){
+	if (threads < 0) return BB_ERROR_ARGUMENT;
+	JobSystem::instance().configure(threads, pin != 0);
+	return BB_OK;
+}
+
+bb_world* bb_world_create(const bb_world_desc* desc){
+	bb_world_desc defaults;
+	defaults.dt = 1.0 / 300, defaults.deterministic = 0, defaults.nbody = 0;
+	if (desc == nullptr) desc = &defaults;
+	if (!(desc->dt > 0)) return nullptr;
+	try {
+		return new bb_world(*desc);
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+void bb_world_destroy(bb_world* world){
+	delete world;
+}
+
+bb_handle bb_sphere_add(bb_world* world, const float* pos, const float* vel, float radius, float mass, float restitution){
+	bb_handle out;
+	out.index = UINT32_MAX, out.generation = 0;
+	if (world == nullptr || pos == nullptr || !(radius > 0) || !(mass > 0)) return out;
+	try {
+		Vec3f p(pos[0], pos[1], pos[2]);
+		Vec3f v = vel != nullptr ? Vec3f(vel[0], vel[1], vel[2]) : Vec3f();
+		Handle h = world->scene.spheres.insert(std::make_unique<Sphere>(p, radius, mass, restitution, v));
+		world->exported = false;
+		out.index = h.index, out.generation = h.generation;
+	} catch (...) {
+	}
+	return out;
+}
+
+int bb_sphere_remove(bb_world* world, bb_handle sphere){
+	if (world == nullptr) return BB_ERROR_ARGUMENT;
+	if (!world->scene.spheres.erase(toHandle(sphere))) return BB_ERROR_NOT_FOUND;
+	world->exported = false;
+	return BB_OK;
+}
+
+int bb_sphere_alive(const bb_world* world, bb_handle sphere){
+	return world != nullptr && world->scene.spheres.contains(toHandle(sphere));
+}
+
+int bb_sphere_set(bb_world* world, bb_handle sphere, const float* pos, const float* vel){
+	if (world == nullptr) return BB_ERROR_ARGUMENT;
+	std::unique_ptr<Sphere>* s = world->scene.spheres.get(toHandle(sphere));
+	if (s == nullptr) return BB_ERROR_NOT_FOUND;
+	(*s)->catchUp(world->scene);
+	if (pos != nullptr) (*s)->pos = Vec3f(pos[0], pos[1], pos[2]);
+	if (vel != nullptr) (*s)->velocity = Vec3f(vel[0], vel[1], vel[2]);
+	world->exported = false;
+	return BB_OK;
+}
+
+int bb_collider_add(bb_world* world, int type, const float* corners){
+	if (world == nullptr || corners == nullptr || (type != BB_COLLIDER_PLANE && type != BB_COLLIDER_RECT)) return BB_ERROR_ARGUMENT;
+	Vec3f a(corners[0], corners[1], corners[2]), b(corners[3], corners[4], corners[5]);
+	Vec3f c(corners[6], corners[7], corners[8]), d(corners[9], corners[10], corners[11]);
+	Vec3f color(0.5f, 0.5f, 0.5f);
+	try {
+		Plane* p;
+		if (type == BB_COLLIDER_PLANE) {
+			world->scene.planes.push_back(std::make_unique<Plane>(a, b, c, d, color));
+			p = world->scene.planes.back().get();
+		} else {
+			world->scene.aabbs.push_back(std::make_unique<AABB>(a, b, c, d, color));
+			p = world->scene.aabbs.back().get();
+		}
+		int id = world->nextCollider++;
+		world->colliders[id] = p;
+		return id;
+	} catch (...) {
+		return BB_ERROR_MEMORY;
+	}
+}
+
+// Erases the shape behind p from v, if it holds it
+template<class T> static bool eraseShape(std::vector<std::unique_ptr<T>>& v, const Plane* p){
+	for (auto it = v.begin(); it != v.end(); ++it) {
+		if (it->get() != p) continue;
+		v.erase(it);
+		return true;
+	}
+	return false;
+}
+
+int bb_collider_remove(bb_world* world, int collider){
+	if (world == nullptr) return BB_ERROR_ARGUMENT;
+	auto it = world->colliders.find(collider);
+	if (it == world->colliders.end()) return BB_ERROR_NOT_FOUND;
+	if (!eraseShape(world->scene.planes, it->second)) eraseShape(world->scene.aabbs, it->second);
+	world->colliders.erase(it);
+	return BB_OK;
+}
+
+int bb_world_step(bb_world* world, int steps){
+	if (world == nullptr || steps < 0) return BB_ERROR_ARGUMENT;
+	try {
+		for (int i = 0; i < steps; ++i)
+			world->engine.advance(world->dt);
+	} catch (...) {
+		return BB_ERROR_MEMORY;
+	}
+	if (steps > 0) world->exported = false;
+	return BB_OK;
+}
+
+double bb_world_time(const bb_world* world){
+	return world != nullptr ? world->engine.simTime : 0;
+}
+
+uint64_t bb_world_hash(const bb_world* world){
+	return world != nullptr ? world->engine.lastStateHash.load(std::memory_order_relaxed) : 0;
+}
+
+size_t bb_sphere_count(const bb_world* world){
+	return world != nullptr ? world->scene.spheres.size() : 0;
+}
+
+bb_array bb_positions(bb_world* world){
+	if (world == nullptr) return makeArray(nullptr, 0, 0);
+	world->exportState();
+	return makeArray(world->positions.data(), world->handles.size(), 3 * sizeof(float));
+}
+
+bb_array bb_velocities(bb_world* world){
+	if (world == nullptr) return makeArray(nullptr, 0, 0);
+	world->exportState();
+	return makeArray(world->velocities.data(), world->handles.size(), 3 * sizeof(float));
+}
+
+bb_array bb_radii(bb_world* world){
+	if (world == nullptr) return makeArray(nullptr, 0, 0);
+	world->exportState();
+	return makeArray(world->radii.data(), world->handles.size(), sizeof(float));
+}
+
+bb_array bb_handles(bb_world* world){
+	if (world == nullptr) return makeArray(nullptr, 0, 0);
+	world->exportState();
+	return makeArray(world->handles.data(), world->handles.size(), sizeof(bb_handle));
+}
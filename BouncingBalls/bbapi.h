@@ -0,0 +1,95 @@
+#pragma once
+/*
+   C interface to the physics engine, for embedding it in other runtimes. Only plain C types
+   cross it, and no C++ exception ever leaves it.
+
+   Sphere state is exported as arrays owned by the world: a pointer to the first element
+   and the stride in bytes between elements, so callers can wrap them without copying.
+   Arrays are refreshed by the first query after the world changed, and stay valid until
+   the next call that changes the world (step, add or remove).
+*/
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#ifdef BB_BUILD_API
+#define BB_API __declspec(dllexport)
+#else
+#define BB_API __declspec(dllimport)
+#endif
+#else
+#define BB_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Bumped whenever a signature or struct below changes incompatibly
+#define BB_ABI_VERSION 1
+
+enum bb_result { BB_OK = 0, BB_ERROR_ARGUMENT = -1, BB_ERROR_NOT_FOUND = -2, BB_ERROR_MEMORY = -3 };
+enum bb_collider_type { BB_COLLIDER_PLANE = 0, BB_COLLIDER_RECT = 1 };
+
+typedef struct bb_world bb_world;
+
+// Stays unique for a sphere's lifetime; removed spheres never resolve again
+typedef struct bb_handle {
+	uint32_t index, generation;
+} bb_handle;
+
+typedef struct bb_array {
+	const void* data;
+	size_t count;
+	// Bytes between consecutive elements
+	size_t stride;
+} bb_array;
+
+typedef struct bb_world_desc {
+	// Seconds per step
+	double dt;
+	// Fixed step order and a state hash per step, see bb_world_hash
+	int deterministic;
+	// Mutual gravitation between spheres on top of the downward gravity
+	int nbody;
+} bb_world_desc;
+
+BB_API int bb_abi_version(void);
+// Worker threads shared by all worlds, 0 for one per core besides the caller
+BB_API int bb_set_threads(int threads, int pin);
+
+// desc may be NULL for the defaults: 1/300 s, not deterministic, no n-body
+BB_API bb_world* bb_world_create(const bb_world_desc* desc);
+BB_API void bb_world_destroy(bb_world* world);
+
+// pos and vel are 3 floats each, vel may be NULL. Returns an invalid handle (index
+// UINT32_MAX) on failure.
+BB_API bb_handle bb_sphere_add(bb_world* world, const float* pos, const float* vel, float radius, float mass, float restitution);
+BB_API int bb_sphere_remove(bb_world* world, bb_handle sphere);
+BB_API int bb_sphere_alive(const bb_world* world, bb_handle sphere);
+// Overwrite the state of one sphere, pos or vel may be NULL to leave it
+BB_API int bb_sphere_set(bb_world* world, bb_handle sphere, const float* pos, const float* vel);
+
+// A quad given as 4 corners (12 floats) in counter-clockwise order seen from the side it
+// faces. Returns a collider id >= 0, or a negative bb_result.
+BB_API int bb_collider_add(bb_world* world, int type, const float* corners);
+BB_API int bb_collider_remove(bb_world* world, int collider);
+
+// Steps the world `steps` times
+BB_API int bb_world_step(bb_world* world, int steps);
+BB_API double bb_world_time(const bb_world* world);
+BB_API uint64_t bb_world_hash(const bb_world* world);
+
+// All arrays list the spheres in the same order
+BB_API size_t bb_sphere_count(const bb_world* world);
+// 3 floats per element
+BB_API bb_array bb_positions(bb_world* world);
+BB_API bb_array bb_velocities(bb_world* world);
+// 1 float per element
+BB_API bb_array bb_radii(bb_world* world);
+// 1 bb_handle per element
+BB_API bb_array bb_handles(bb_world* world);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,54 @@
+/*
+   Smallest consumer of the C interface: drops a few spheres on a floor and prints where
+   they rest. Built as plain C against bbapi.h only, so it breaks when the header stops
+   being valid C or an export goes missing from the library.
+*/
+#include <stdio.h>
+#include "bbapi.h"
+
+int main(void)
+{
+	static const float floor[12] = { -10, 0, 10, 10, 0, 10, 10, 0, -10, -10, 0, -10 };
+	bb_world_desc desc;
+	bb_world* world;
+	bb_array pos;
+	size_t i;
+	int k;
+
+	if (bb_abi_version() != BB_ABI_VERSION) {
+		fprintf(stderr, "bbapi: built against ABI %d, library has %d\n", BB_ABI_VERSION, bb_abi_version());
+		return 1;
+	}
+
+	desc.dt = 1.0 / 300;
+	desc.deterministic = 1;
+	desc.nbody = 0;
+	world = bb_world_create(&desc);
+	if (world == NULL) return 1;
+	if (bb_collider_add(world, BB_COLLIDER_PLANE, floor) < 0) {
+		bb_world_destroy(world);
+		return 1;
+	}
+	for (k = 0; k < 4; ++k) {
+		float p[3];
+		bb_handle h;
+		p[0] = (float)(2 * k - 3), p[1] = (float)(2 + k), p[2] = 0;
+		h = bb_sphere_add(world, p, NULL, 0.5f, 1, 0.5f);
+		if (h.index == UINT32_MAX) {
+			bb_world_destroy(world);
+			return 1;
+		}
+	}
+
+	// Three simulated seconds
+	bb_world_step(world, 900);
+	pos = bb_positions(world);
+	for (i = 0; i < pos.count; ++i) {
+		const float* p = (const float*)((const char*)pos.data + i * pos.stride);
+		printf("%u: %.3f %.3f %.3f\n", (unsigned)i, p[0], p[1], p[2]);
+	}
+	printf("t = %.3f s, hash %016llx\n", bb_world_time(world), (unsigned long long)bb_world_hash(world));
+
+	bb_world_destroy(world);
+	return 0;
+}
@@ -1,5 +1,62 @@
 #pragma once
+#include <math.h>
 #include "vector.h"
+#include "constants.h"
+
+/*
+   View frustum as six inward facing planes (ax + by + cz + d >= 0 is inside),
+   extracted from the combined projection * modelview matrix.
+*/
+class Frustum {
+public:
+	Frustum() {
+		for (int i = 0; i < 6; ++i)
+			planes[i][0] = planes[i][1] = planes[i][2] = 0, planes[i][3] = 1;
+	}
+
+	// Both matrices are column-major, as returned by glGetFloatv
+	void extract(const float* modelview, const float* projection) {
+		float m[16];
+		for (int c = 0; c < 4; ++c)
+			for (int r = 0; r < 4; ++r)
+				m[c * 4 + r] = projection[r] * modelview[c * 4]
+					+ projection[4 + r] * modelview[c * 4 + 1]
+					+ projection[8 + r] * modelview[c * 4 + 2]
+					+ projection[12 + r] * modelview[c * 4 + 3];
+
+		// left, right, bottom, top, near, far
+		for (int i = 0; i < 6; ++i) {
+			int row = i / 2;
+			float sign = (i % 2 == 0) ? 1.0f : -1.0f;
+			for (int k = 0; k < 4; ++k)
+				planes[i][k] = m[k * 4 + 3] + sign * m[k * 4 + row];
+			float l = sqrtf(planes[i][0] * planes[i][0] + planes[i][1] * planes[i][1] + planes[i][2] * planes[i][2]);
+			if (l > 0)
+				for (int k = 0; k < 4; ++k) planes[i][k] /= l;
+		}
+	}
+
+	bool containsSphere(const Vec3f& c, float r) const {
+		for (int i = 0; i < 6; ++i)
+			if (planes[i][0] * c.x + planes[i][1] * c.y + planes[i][2] * c.z + planes[i][3] < -r)
+				return false;
+		return true;
+	}
+
+	bool containsBox(const Vec3f& min, const Vec3f& max) const {
+		for (int i = 0; i < 6; ++i) {
+			// Test the box corner furthest along the plane normal
+			float x = planes[i][0] >= 0 ? max.x : min.x;
+			float y = planes[i][1] >= 0 ? max.y : min.y;
+			float z = planes[i][2] >= 0 ? max.z : min.z;
+			if (planes[i][0] * x + planes[i][1] * y + planes[i][2] * z + planes[i][3] < 0)
+				return false;
+		}
+		return true;
+	}
+
+	float planes[6][4];
+};
 
 class Camera3D {
 public:
@@ -7,7 +64,35 @@ public:
 	Camera3D(float x, float y, float z, float velocity = 0.3) : x(x), y(y), z(z), rotX(0), rotY(0), v(velocity) {}
 	Camera3D(Vec3f& xyz, float velocity = 0.3) : Camera3D(xyz.x, xyz.y, xyz.z, velocity) {}
 
+	Vec3f eye() const { return Vec3f(x, y, z); }
+
+	// Moves v units along each held direction, forward following the view
+	void fly(bool forward, bool back, bool left, bool right, bool down, bool up) {
+		float sx = float(sin(rotX * RAD_PER_DEG)), sy = float(sin(rotY * RAD_PER_DEG)), cy = float(cos(rotY * RAD_PER_DEG));
+		if (forward) x += sy * v, y -= sx * v, z -= cy * v;
+		if (back) x -= sy * v, y += sx * v, z += cy * v;
+		if (left) x -= cy * v, z -= sy * v;
+		if (right) x += cy * v, z += sy * v;
+		if (down) y -= v;
+		if (up) y += v;
+	}
+
+	// Turns by whole degrees, wrapping at a full turn
+	void turn(int dx, int dy) {
+		rotY += dx;
+		rotX += dy;
+		if (rotX >= 360) rotX -= 360;
+		if (rotX <= -360) rotX += 360;
+		if (rotY >= 360) rotY -= 360;
+		if (rotY <= -360) rotY += 360;
+	}
+
+	void updateFrustum(const float* modelview, const float* projection) {
+		frustum.extract(modelview, projection);
+	}
+
 	float x, y, z;
 	float rotX, rotY;
 	float v;
+	Frustum frustum;
 };
@@ -0,0 +1,147 @@
+#include "capture.h"
+#include "glsimulation.h"
+#include "spawner.h"
+
+FrameCapture::FrameCapture(const CaptureSettings& settings)
+	: settings(settings), camera(0, 18, 48), frameBytes(settings.width * settings.height * 4), written(0)
+{
+	// Overview of the whole floor, looking slightly down
+	camera.rotX = 20;
+}
+
+FrameCapture::~FrameCapture(){
+	close();
+}
+
+bool FrameCapture::open(){
+	QSurfaceFormat format;
+	format.setDepthBufferSize(24);
+	// The renderer uses the fixed-function pipeline
+	format.setVersion(2, 1);
+	format.setProfile(QSurfaceFormat::CompatibilityProfile);
+	surface.setFormat(format);
+	surface.create();
+	context.setFormat(format);
+	if (!surface.isValid() || !context.create() || !context.makeCurrent(&surface)) {
+		error = "could not create an offscreen GL context";
+		return false;
+	}
+
+	fbo = std::make_unique<QOpenGLFramebufferObject>(settings.width, settings.height, QOpenGLFramebufferObject::CombinedDepthStencil);
+	if (!fbo->isValid() || !fbo->bind()) {
+		error = "could not create a framebuffer object";
+		return false;
+	}
+	for (int i = 0; i < CAPTURE_PBOS; ++i) {
+		pbos[i] = QOpenGLBuffer(QOpenGLBuffer::PixelPackBuffer);
+		pbos[i].setUsagePattern(QOpenGLBuffer::StreamRead);
+		if (!pbos[i].create()) {
+			error = "pixel buffer objects are not supported";
+			return false;
+		}
+		pbos[i].bind();
+		pbos[i].allocate(frameBytes);
+		pbos[i].release();
+	}
+
+	renderer.initialize();
+	renderer.resize(settings.width, settings.height);
+	// Frames are taken exactly at step boundaries
+	renderer.interpolator.mode = BLEND_LATEST;
+
+	// GL rows start at the bottom, so the encoder flips them
+	QStringList args;
+	args << "-y" << "-loglevel" << "error"
+		<< "-f" << "rawvideo" << "-pix_fmt" << "rgba"
+		<< "-s" << QString("%1x%2").arg(settings.width).arg(settings.height)
+		<< "-r" << QString::number(settings.fps)
+		<< "-i" << "-"
+		<< "-vf" << "vflip" << "-pix_fmt" << "yuv420p"
+		<< settings.output;
+	encoder.start(settings.encoder, args);
+	if (!encoder.waitForStarted()) {
+		error = QString("could not start encoder: %1").arg(encoder.errorString());
+		return false;
+	}
+	return true;
+}
+
+void FrameCapture::buildScene(){
+	world.planes.push_back(std::make_unique<Plane>(Plane(Vec3f(-30, 0, 30), Vec3f(30, 0, 30), Vec3f(30, 0, -30), Vec3f(-30, 0, -30), Vec3f(0.5, 0.7, 0.5))));
+	GLSimulation::setWalls(world, true);
+
+	engine = std::make_unique<PhysicsEngine>(world, settings.fps * settings.stepsPerFrame);
+	engine->deterministic = true;
+	BulkSpawner spawner(settings.seed);
+	engine->addSpheres(spawner.spawn(Vec3f(-25, 1, -25), Vec3f(25, 12, 25), settings.balls, SpawnParams(), nullptr));
+}
+
+bool FrameCapture::run(){
+	if (!open()) return false;
+	buildScene();
+
+	int frames = (int)(settings.duration * settings.fps + 0.5);
+	double dt = 1.0 / (settings.fps * settings.stepsPerFrame);
+	bool ok = true;
+	for (int frame = 0; frame < frames && ok; ++frame) {
+		TRACE_SCOPE("captureFrame");
+		// The first frame shows the initial state
+		int steps = frame == 0 ? 1 : settings.stepsPerFrame;
+		for (int i = 0; i < steps; ++i)
+			engine->advance(frame == 0 ? 0.0 : dt);
+
+		renderer.render(world, camera, SphereHandle(), renderClockNs());
+		readback(frame);
+		// The oldest readback has had CAPTURE_PBOS - 1 frames to complete
+		if (frame >= CAPTURE_PBOS - 1)
+			ok = emitFrame(frame - (CAPTURE_PBOS - 1));
+	}
+	for (int frame = std::max(frames - (CAPTURE_PBOS - 1), 0); frame < frames && ok; ++frame)
+		ok = emitFrame(frame);
+
+	encoder.closeWriteChannel();
+	// Encoding the tail of a long capture can take a while
+	encoder.waitForFinished(-1);
+	if (ok && encoder.exitCode() != 0) {
+		error = QString("encoder exited with code %1").arg(encoder.exitCode());
+		ok = false;
+	}
+	if (ok) written = frames;
+	close();
+	return ok;
+}
+
+void FrameCapture::readback(int frame){
+	TRACE_SCOPE("readback");
+	QOpenGLBuffer& pbo = pbos[frame % CAPTURE_PBOS];
+	pbo.bind();
+	// With a pack buffer bound this only queues the copy and returns
+	glReadPixels(0, 0, settings.width, settings.height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	pbo.release();
+}
+
+bool FrameCapture::emitFrame(int frame){
+	TRACE_SCOPE("encode");
+	QOpenGLBuffer& pbo = pbos[frame % CAPTURE_PBOS];
+	pbo.bind();
+	const char* pixels = static_cast<const char*>(pbo.map(QOpenGLBuffer::ReadOnly));
+	bool ok = pixels != nullptr && encoder.state() == QProcess::Running;
+	if (ok) ok = encoder.write(pixels, frameBytes) == frameBytes;
+	pbo.unmap();
+	pbo.release();
+
+	// Keep the pipe bounded when the encoder is slower than rendering
+	while (ok && encoder.bytesToWrite() > CAPTURE_MAX_PENDING)
+		ok = encoder.waitForBytesWritten(-1);
+	if (!ok) error = QString("lost the encoder at frame %1").arg(frame);
+	return ok;
+}
+
+void FrameCapture::close(){
+	if (fbo == nullptr) return;
+	for (int i = 0; i < CAPTURE_PBOS; ++i)
+		pbos[i].destroy();
+	fbo->release();
+	fbo.reset();
+	context.doneCurrent();
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <memory>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLFramebufferObject>
+#include <QOpenGLBuffer>
+#include <qprocess.h>
+#include "physics.h"
+#include "renderer.h"
+
+// Readbacks in flight; a frame is mapped this many frames after its read was queued
+const int CAPTURE_PBOS = 3;
+// Encoder input buffered in the pipe before capture waits for the encoder to catch up
+const long long CAPTURE_MAX_PENDING = 64ll << 20;
+
+struct CaptureSettings {
+	CaptureSettings()
+		: output("capture.mp4"), encoder("ffmpeg"), width(1280), height(720), fps(30), stepsPerFrame(10),
+		duration(10.0), balls(2000), seed(1) {}
+
+	QString output;
+	// Program fed raw RGBA frames on stdin, invoked ffmpeg-style
+	QString encoder;
+	int width, height;
+	// Frames per simulated second and physics steps between frames
+	int fps, stepsPerFrame;
+	// Simulated seconds to record
+	double duration;
+	int balls;
+	unsigned seed;
+};
+
+/*
+   Renders a simulation offscreen at a fixed simulated-time cadence and pipes the frames to
+   an encoder process. Physics is stepped deterministically on the calling thread, so the
+   video does not depend on how long frames take to produce. Pixels are read back through
+   a ring of pixel buffer objects and only mapped frames later, so readback never stalls
+   rendering.
+*/
+class FrameCapture {
+public:
+	FrameCapture(const CaptureSettings& settings);
+	~FrameCapture();
+
+	// Records the whole duration, false if GL or the encoder fails
+	bool run();
+	// What failed, after run returned false
+	const QString& errorString() const { return error; }
+	// Frames encoded by a successful run
+	int framesWritten() const { return written; }
+	const EngineMetrics& metrics() const { return engine->metrics; }
+
+private:
+	bool open();
+	void buildScene();
+	// Queues an asynchronous read of the framebuffer into the frame's buffer
+	void readback(int frame);
+	// Maps a finished readback and hands it to the encoder
+	bool emitFrame(int frame);
+	void close();
+
+	CaptureSettings settings;
+	Scene world;
+	std::unique_ptr<PhysicsEngine> engine;
+	Camera3D camera;
+	SceneRenderer renderer;
+
+	QOffscreenSurface surface;
+	QOpenGLContext context;
+	std::unique_ptr<QOpenGLFramebufferObject> fbo;
+	QOpenGLBuffer pbos[CAPTURE_PBOS];
+	QProcess encoder;
+	int frameBytes;
+	int written;
+	QString error;
+};
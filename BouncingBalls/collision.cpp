@@ -0,0 +1,194 @@
+#include "collision.h"
+#include <algorithm>
+
+// Closest point to p on the segment from a to b
+static Vec3f closestOnSegment(const Vec3f& p, const Vec3f& a, const Vec3f& b){
+	Vec3f ab = b - a;
+	float len2 = ab.normsq();
+	if (len2 == 0) return a;
+	float t = std::min(std::max((p - a).dot(ab) / len2, 0.0f), 1.0f);
+	return a + t * ab;
+}
+
+// Closest pair of points between the segments p1-q1 and p2-q2
+static void closestBetweenSegments(const Vec3f& p1, const Vec3f& q1, const Vec3f& p2, const Vec3f& q2, Vec3f& c1, Vec3f& c2){
+	Vec3f d1 = q1 - p1, d2 = q2 - p2, r = p1 - p2;
+	float a = d1.normsq(), e = d2.normsq(), f = d2.dot(r);
+	float s = 0, t = 0;
+	if (a == 0 && e == 0) {
+		// Both degenerate to points
+	} else if (a == 0) {
+		t = std::min(std::max(f / e, 0.0f), 1.0f);
+	} else {
+		float c = d1.dot(r);
+		if (e == 0) {
+			s = std::min(std::max(-c / a, 0.0f), 1.0f);
+		} else {
+			float b = d1.dot(d2);
+			float denom = a * e - b * b;
+			// Parallel segments have no unique pair, any s works
+			if (denom != 0) s = std::min(std::max((b * f - c * e) / denom, 0.0f), 1.0f);
+			t = (b * s + f) / e;
+			if (t < 0) t = 0, s = std::min(std::max(-c / a, 0.0f), 1.0f);
+			else if (t > 1) t = 1, s = std::min(std::max((b - c) / a, 0.0f), 1.0f);
+		}
+	}
+	c1 = p1 + s * d1;
+	c2 = p2 + t * d2;
+}
+
+// Contact between spheres around two points, false when they do not touch
+static bool pointContact(const Vec3f& pa, float ra, const Vec3f& pb, float rb, Contact& c){
+	Vec3f d = pa - pb;
+	float dist2 = d.normsq();
+	float reach = ra + rb;
+	if (dist2 > reach * reach) return false;
+	float dist = sqrtf(dist2);
+	// Concentric shapes have no preferred direction, push straight up
+	c.normal = dist > 0 ? d / dist : Vec3f(0, 1, 0);
+	c.depth = reach - dist;
+	return true;
+}
+
+// Contact of a sphere at p with a box, including a center inside the box
+static bool boxContact(const Vec3f& p, float rad, const OBB& b, Contact& c){
+	Vec3f rel = p - b.pos;
+	float local[3];
+	Vec3f closest = b.pos;
+	for (int i = 0; i < 3; ++i) {
+		local[i] = b.axes[i].dot(rel);
+		closest += std::min(std::max(local[i], -b.half[i]), b.half[i]) * b.axes[i];
+	}
+	Vec3f d = p - closest;
+	float dist2 = d.normsq();
+	if (dist2 > rad * rad) return false;
+	if (dist2 > 0) {
+		float dist = sqrtf(dist2);
+		c.normal = d / dist;
+		c.depth = rad - dist;
+		return true;
+	}
+
+	// Center inside: leave through the nearest face
+	int axis = 0;
+	float pen = b.half[0] - fabsf(local[0]);
+	for (int i = 1; i < 3; ++i) {
+		float pi = b.half[i] - fabsf(local[i]);
+		if (pi < pen) pen = pi, axis = i;
+	}
+	c.normal = local[axis] >= 0 ? b.axes[axis] : -b.axes[axis];
+	c.depth = rad + pen;
+	return true;
+}
+
+bool PairKernel<Sphere, Sphere>::detect(const Sphere& a, const Sphere& b, Contact& c){
+	return pointContact(a.pos, a.rad, b.pos, b.rad, c);
+}
+
+float PairKernel<Sphere, Sphere>::respond(Sphere& a, Sphere& b, const Contact& c){
+	// Calculate projections of velocities onto force vector
+	Vec3f force = c.normal;
+	float x1_proj = force.dot(a.velocity);
+	Vec3f v1x = x1_proj * force;
+	Vec3f v1y = a.velocity - v1x;
+
+	float x2_proj = (-force).dot(b.velocity);
+	Vec3f v2x = x2_proj * (-force);
+	Vec3f v2y = b.velocity - v2x;
+
+	// Update velocities of both spheres according to Newtonian physics
+	float cor = a.r * b.r;
+	float m12 = a.m + b.m;
+	Vec3f mu12 = a.m * v1x + b.m * v2x;
+	a.velocity = v1y + (mu12 + b.m * cor * (v2x - v1x)) / m12;
+	b.velocity = v2y + (mu12 + a.m * cor * (v1x - v2x)) / m12;
+	// Momentum each sphere gained, the same for both
+	float impulse = a.m * b.m * (1 + cor) / m12 * (v2x - v1x).norm();
+
+	// Prevent merging
+	Vec3f distVec = a.pos - b.pos;
+	float diff = (a.rad + b.rad) * (a.rad + b.rad) - distVec.normsq();
+	if (diff > 0) {
+		distVec.normalize();
+
+		// Move spheres in opposite directions
+		a.pos += (diff / 2.0) * distVec;
+		b.pos -= (diff / 2.0) * distVec;
+	}
+	return impulse;
+}
+
+bool PairKernel<Sphere, Capsule>::detect(const Sphere& a, const Capsule& b, Contact& c){
+	return pointContact(a.pos, a.rad, closestOnSegment(a.pos, b.end0(), b.end1()), b.rad, c);
+}
+
+bool PairKernel<Sphere, OBB>::detect(const Sphere& a, const OBB& b, Contact& c){
+	return boxContact(a.pos, a.rad, b, c);
+}
+
+bool PairKernel<Capsule, Capsule>::detect(const Capsule& a, const Capsule& b, Contact& c){
+	Vec3f ca, cb;
+	closestBetweenSegments(a.end0(), a.end1(), b.end0(), b.end1(), ca, cb);
+	return pointContact(ca, a.rad, cb, b.rad, c);
+}
+
+bool PairKernel<Capsule, OBB>::detect(const Capsule& a, const OBB& b, Contact& c){
+	// Distance from the box is convex along the segment, so a ternary search finds the
+	// closest point; the capsule then collides as a sphere around it
+	auto dist2 = [&](float t) {
+		Vec3f p = a.pos + t * a.axis - b.pos;
+		float d2 = 0;
+		for (int i = 0; i < 3; ++i) {
+			float l = b.axes[i].dot(p);
+			float out = std::max(fabsf(l) - b.half[i], 0.0f);
+			d2 += out * out;
+		}
+		return d2;
+	};
+	float lo = -a.halfLength, hi = a.halfLength;
+	for (int i = 0; i < 24; ++i) {
+		float m1 = lo + (hi - lo) / 3, m2 = hi - (hi - lo) / 3;
+		if (dist2(m1) <= dist2(m2)) hi = m2;
+		else lo = m1;
+	}
+	// Inside the box any point qualifies, prefer the one nearest the box center
+	float t = 0.5f * (lo + hi);
+	if (dist2(t) == 0) t = std::min(std::max(a.axis.dot(b.pos - a.pos), -a.halfLength), a.halfLength);
+	return boxContact(a.pos + t * a.axis, a.rad, b, c);
+}
+
+bool PairKernel<OBB, OBB>::detect(const OBB& a, const OBB& b, Contact& c){
+	Vec3f d = a.pos - b.pos;
+	auto radius = [](const OBB& box, const Vec3f& axis) {
+		return box.half[0] * fabsf(box.axes[0].dot(axis)) + box.half[1] * fabsf(box.axes[1].dot(axis)) + box.half[2] * fabsf(box.axes[2].dot(axis));
+	};
+
+	Vec3f axes[15];
+	int naxes = 0;
+	for (int i = 0; i < 3; ++i) {
+		axes[naxes++] = a.axes[i];
+		axes[naxes++] = b.axes[i];
+	}
+	for (int i = 0; i < 3; ++i) {
+		for (int j = 0; j < 3; ++j) {
+			Vec3f axis = a.axes[i].cross(b.axes[j]);
+			// Parallel edges add nothing the face axes do not cover
+			float len2 = axis.normsq();
+			if (len2 < 1e-6f) continue;
+			axes[naxes++] = axis / sqrtf(len2);
+		}
+	}
+
+	float best = 1e30f;
+	for (int k = 0; k < naxes; ++k) {
+		float dist = d.dot(axes[k]);
+		float overlap = radius(a, axes[k]) + radius(b, axes[k]) - fabsf(dist);
+		if (overlap < 0) return false;
+		if (overlap < best) {
+			best = overlap;
+			c.normal = dist >= 0 ? axes[k] : -axes[k];
+		}
+	}
+	c.depth = best;
+	return true;
+}
@@ -0,0 +1,325 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <type_traits>
+#include <cmath>
+#include "geometry.h"
+
+/*
+   Compile-time shape registry. Every pair of registered shapes gets a PairKernel with a
+   detect and a respond function, and a collision pass over the scene is generated for each
+   pair from the lists below. Adding a shape means adding it to a list, giving it a
+   ShapeStorage, a ShapeKind, a boundRad and a support function, and writing its kernels against the
+   dynamic shapes registered before it; a missing kernel fails to compile. Responses return
+   the magnitude of the impulse they applied. Spheres meet the static shapes in the batched
+   stage of staticbatch.h, which is built from the same list; a static shape also needs a
+   BatchShape there.
+*/
+template<class... Ts> struct TypeList {};
+template<class T> struct TypeTag { typedef T type; };
+
+typedef TypeList<Sphere, Capsule, OBB> DynamicShapes;
+typedef TypeList<Plane, AABB> StaticShapes;
+
+// Calls f(TypeTag<T>()) for every type in the list, in order
+template<class... Ts, class F> void forEachType(TypeList<Ts...>, F&& f) {
+	int expand[] = { 0, (f(TypeTag<Ts>()), 0)... };
+	(void)expand;
+}
+
+// Calls f(TypeTag<A>(), TypeTag<B>()) for every unordered pair, A registered no later than B
+template<class F> void forEachPair(TypeList<>, F&&) {}
+template<class T, class... Ts, class F> void forEachPair(TypeList<T, Ts...>, F&& f) {
+	forEachType(TypeList<T, Ts...>(), [&](auto b) { f(TypeTag<T>(), b); });
+	forEachPair(TypeList<Ts...>(), f);
+}
+
+// The scene container of each shape type
+template<class T> struct ShapeStorage;
+template<> struct ShapeStorage<Sphere> { static SlotMap<std::unique_ptr<Sphere>>& get(Scene& s) { return s.spheres; } };
+template<> struct ShapeStorage<Plane> { static std::vector<std::unique_ptr<Plane>>& get(Scene& s) { return s.planes; } };
+template<> struct ShapeStorage<AABB> { static std::vector<std::unique_ptr<AABB>>& get(Scene& s) { return s.aabbs; } };
+template<> struct ShapeStorage<Capsule> { static std::vector<std::unique_ptr<Capsule>>& get(Scene& s) { return s.capsules; } };
+template<> struct ShapeStorage<OBB> { static std::vector<std::unique_ptr<OBB>>& get(Scene& s) { return s.obbs; } };
+
+// What contact events report a sphere hit when it hits the shape
+template<class T> struct ShapeKind;
+template<> struct ShapeKind<Sphere> { static const ContactKind kind = CONTACT_SPHERE; };
+template<> struct ShapeKind<Plane> { static const ContactKind kind = CONTACT_PLANE; };
+template<> struct ShapeKind<AABB> { static const ContactKind kind = CONTACT_AABB; };
+template<> struct ShapeKind<Capsule> { static const ContactKind kind = CONTACT_CAPSULE; };
+template<> struct ShapeKind<OBB> { static const ContactKind kind = CONTACT_OBB; };
+
+// Radius of a sphere around pos holding the whole shape
+inline float boundRad(const Sphere& s) { return s.rad; }
+inline float boundRad(const Capsule& c) { return c.halfLength + c.rad; }
+inline float boundRad(const OBB& b) { return sqrtf(b.half[0] * b.half[0] + b.half[1] * b.half[1] + b.half[2] * b.half[2]); }
+
+// Farthest point of the shape along the unit direction d
+inline Vec3f support(const Sphere& s, const Vec3f& d) { return s.pos + s.rad * d; }
+inline Vec3f support(const Capsule& c, const Vec3f& d) { return (c.axis.dot(d) >= 0 ? c.end1() : c.end0()) + c.rad * d; }
+inline Vec3f support(const OBB& b, const Vec3f& d) {
+	Vec3f p = b.pos;
+	for (int i = 0; i < 3; ++i)
+		p += (b.axes[i].dot(d) >= 0 ? b.half[i] : -b.half[i]) * b.axes[i];
+	return p;
+}
+
+// normal points from the second shape towards the first, depth is how far they overlap along it
+struct Contact {
+	Vec3f normal;
+	float depth;
+};
+
+// Equal and opposite impulse along the normal scaled by inverse mass, then push apart
+struct ImpulseResponse {
+	template<class A, class B> static float respond(A& a, B& b, const Contact& c) {
+		float ia = 1 / a.m, ib = 1 / b.m;
+		float vn = (a.velocity - b.velocity).dot(c.normal);
+		// Only approaching shapes bounce, separating ones are just pushed apart
+		float j = 0;
+		if (vn < 0) {
+			j = -(1 + a.r * b.r) * vn / (ia + ib);
+			a.velocity += (j * ia) * c.normal;
+			b.velocity -= (j * ib) * c.normal;
+		}
+		float share = c.depth / (ia + ib);
+		a.pos += (share * ia) * c.normal;
+		b.pos -= (share * ib) * c.normal;
+		return j;
+	}
+};
+
+// Reflect around the surface normal with restitution, then push out of the surface
+struct StaticResponse {
+	template<class A, class B> static float respond(A& a, const B&, const Contact& c) {
+		float vn = a.velocity.dot(c.normal);
+		a.velocity -= (1 + a.r) * vn * c.normal;
+		if (c.depth > 0) a.pos += c.depth * c.normal;
+		return a.m * (1 + a.r) * std::fabs(vn);
+	}
+};
+
+template<class A, class B> struct PairKernel {
+	static const bool defined = false;
+};
+
+template<> struct PairKernel<Sphere, Sphere> {
+	static const bool defined = true;
+	static bool detect(const Sphere& a, const Sphere& b, Contact& c);
+	// Elastic collision along the line of centers
+	static float respond(Sphere& a, Sphere& b, const Contact& c);
+};
+
+template<> struct PairKernel<Sphere, Capsule> : ImpulseResponse {
+	static const bool defined = true;
+	static bool detect(const Sphere& a, const Capsule& b, Contact& c);
+};
+
+template<> struct PairKernel<Sphere, OBB> : ImpulseResponse {
+	static const bool defined = true;
+	static bool detect(const Sphere& a, const OBB& b, Contact& c);
+};
+
+template<> struct PairKernel<Capsule, Capsule> : ImpulseResponse {
+	static const bool defined = true;
+	static bool detect(const Capsule& a, const Capsule& b, Contact& c);
+};
+
+template<> struct PairKernel<Capsule, OBB> : ImpulseResponse {
+	static const bool defined = true;
+	static bool detect(const Capsule& a, const OBB& b, Contact& c);
+};
+
+template<> struct PairKernel<OBB, OBB> : ImpulseResponse {
+	static const bool defined = true;
+	// Separating axis test over the 15 candidate axes
+	static bool detect(const OBB& a, const OBB& b, Contact& c);
+};
+
+// Any shape with a support function against the static shapes
+template<class A> struct PairKernel<A, Plane> : StaticResponse {
+	static const bool defined = true;
+	static bool detect(const A& a, const Plane& p, Contact& c) {
+		// Behind the plane, as defined by its normal
+		float dist = (support(a, -p.normal) - p.a).dot(p.normal);
+		if (dist > 0) return false;
+		c.normal = p.normal, c.depth = -dist;
+		return true;
+	}
+};
+
+template<class A> struct PairKernel<A, AABB> : StaticResponse {
+	static const bool defined = true;
+	static bool detect(const A& a, const AABB& rect, Contact& c) {
+		// Same as plane but also checks for rectangle boundaries
+		float dist = (support(a, -rect.normal) - rect.a).dot(rect.normal);
+		float reach = (a.pos - rect.a).dot(rect.normal) - dist;
+
+		// Consider collisions even if the shape has penetrated the rectangle for some time.
+		// This will eventually break down if speed is too large compared to loop processing speed.
+		if (dist > 0 || dist + reach < -10 * reach) return false;
+		Vec3f q = a.pos - (dist + reach) * rect.normal;
+		if (q.x < rect.minX || q.x > rect.maxX || q.y < rect.minY || q.y > rect.maxY || q.z < rect.minZ || q.z > rect.maxZ) return false;
+		c.normal = rect.normal, c.depth = -dist;
+		return true;
+	}
+};
+
+// Collision pass of a dynamic pair: all pairs with a bounding sphere pretest
+template<class A, class B> struct PairPass {
+	static void run(Scene& scene) {
+		static_assert(PairKernel<A, B>::defined, "Missing PairKernel for a pair of registered shapes");
+		auto& as = ShapeStorage<A>::get(scene);
+		auto& bs = ShapeStorage<B>::get(scene);
+		int na = as.size(), nb = bs.size();
+		for (int i = 0; i < na; ++i) {
+			A* a = as[i].get();
+			if (a == nullptr) continue;
+			for (int j = std::is_same<A, B>::value ? i + 1 : 0; j < nb; ++j) {
+				B* b = bs[j].get();
+				if (b == nullptr) continue;
+				float reach = boundRad(*a) + boundRad(*b);
+				if ((a->pos - b->pos).normsq() > reach * reach) continue;
+				Contact c;
+				if (!PairKernel<A, B>::detect(*a, *b, c)) continue;
+				scene.contacts.add(c.depth);
+				PairKernel<A, B>::respond(*a, *b, c);
+			}
+		}
+	}
+};
+
+// Spheres are too many for all pairs, their candidates come from the broadphase grid.
+// Runs on the solver's thread, so it publishes contact events like the sphere stages.
+template<class B> struct PairPass<Sphere, B> {
+	static void run(Scene& scene) {
+		static_assert(PairKernel<Sphere, B>::defined, "Missing PairKernel for a pair of registered shapes");
+		auto& bs = ShapeStorage<B>::get(scene);
+		ContactEventStream* events = scene.contactEvents;
+		thread_local std::vector<SphereProxy> hits;
+		int nb = bs.size();
+		for (int k = 0; k < nb; ++k) {
+			B* b = bs[k].get();
+			if (b == nullptr) continue;
+			hits.clear();
+			if (scene.broadphase != nullptr) {
+				scene.broadphase->overlapSphere(b->pos, boundRad(*b) * (1 + CONTACT_MARGIN), hits);
+			} else {
+				int nspheres = scene.spheres.size();
+				for (int i = 0; i < nspheres; ++i) {
+					Sphere* s = scene.spheres[i].get();
+					if (s == nullptr) continue;
+					SphereProxy p;
+					p.sphere = s;
+					p.handle = scene.spheres.handleAt(i);
+					hits.push_back(p);
+				}
+			}
+			for (const SphereProxy& p : hits) {
+				Sphere* s = p.sphere;
+				s->catchUp(scene);
+				Contact c;
+				if (!PairKernel<Sphere, B>::detect(*s, *b, c)) continue;
+				if (!s->active) s->wake = MULTIRATE_WAKE_STEPS;
+				scene.contacts.add(c.depth);
+				float j = PairKernel<Sphere, B>::respond(*s, *b, c);
+				if (events == nullptr || !events->wants(j)) continue;
+				ContactEvent e;
+				e.sphere = p.handle, e.kind = ShapeKind<B>::kind, e.collider = k;
+				e.impulse = j, e.pos = support(*s, -c.normal), e.normal = c.normal;
+				events->publish(e);
+			}
+		}
+	}
+};
+
+// Sphere pairs run in the engine's parallel narrowphase and ordered solve instead
+template<> struct PairPass<Sphere, Sphere> {
+	static void run(Scene&) {}
+};
+
+// Runs the kernel of a static shape type against one dynamic shape
+template<class B, class A> void collideWith(A& a, Scene& scene) {
+	static_assert(PairKernel<A, B>::defined, "Missing PairKernel for a static shape");
+	for (auto& ptr : ShapeStorage<B>::get(scene)) {
+		B* b = ptr.get();
+		Contact c;
+		if (b == nullptr || !PairKernel<A, B>::detect(a, *b, c)) continue;
+		scene.contacts.add(c.depth);
+		PairKernel<A, B>::respond(a, *b, c);
+	}
+}
+
+// Whether a point on the plane of a static shape lies on the shape
+inline bool onSurface(const Plane&, const Vec3f&) { return true; }
+inline bool onSurface(const AABB& r, const Vec3f& q) {
+	return q.x >= r.minX && q.x <= r.maxX && q.y >= r.minY && q.y <= r.maxY && q.z >= r.minZ && q.z <= r.maxZ;
+}
+
+// Earliest fraction of a's move from `from` to where it is now, below t, at which it reaches
+// a shape of type B it started in front of
+template<class B, class A> float sweepWith(const A& a, const Vec3f& from, Scene& scene, float t) {
+	static_assert(std::is_base_of<Plane, B>::value, "Missing sweep for a static shape");
+	Vec3f move = a.pos - from;
+	for (auto& ptr : ShapeStorage<B>::get(scene)) {
+		const B* b = ptr.get();
+		if (b == nullptr) continue;
+		float d1 = (support(a, -b->normal) - b->a).dot(b->normal);
+		float d0 = d1 - move.dot(b->normal);
+		if (d0 < 0 || d1 >= 0) continue;
+		float hit = d0 / (d0 - d1);
+		if (hit >= t) continue;
+		Vec3f at = from + hit * move;
+		if (onSurface(*b, at - (at - b->a).dot(b->normal) * b->normal)) t = hit;
+	}
+	return t;
+}
+
+// Fraction of a move over which a stays clear of every static shape, 1 for all of it
+template<class A> float sweepStatics(const A& a, const Vec3f& from, Scene& scene) {
+	float t = 1;
+	forEachType(StaticShapes(), [&](auto b) { t = sweepWith<typename decltype(b)::type>(a, from, scene, t); });
+	return t;
+}
+
+// Collision pass of a dynamic shape type against a static one
+template<class A, class B> struct StaticPass {
+	static void run(Scene& scene) {
+		for (auto& ptr : ShapeStorage<A>::get(scene))
+			if (ptr != nullptr) collideWith<B>(*ptr, scene);
+	}
+};
+
+// Spheres meet every registered static shape in the engine's batched stage, see StaticBatch
+template<class B> struct StaticPass<Sphere, B> {
+	static void run(Scene&) {}
+};
+
+// Runs every generated pass besides the sphere-sphere and sphere-static ones
+inline void collideShapes(Scene& scene) {
+	forEachPair(DynamicShapes(), [&](auto a, auto b) {
+		PairPass<typename decltype(a)::type, typename decltype(b)::type>::run(scene);
+	});
+	forEachType(DynamicShapes(), [&](auto a) {
+		forEachType(StaticShapes(), [&](auto b) {
+			StaticPass<typename decltype(a)::type, typename decltype(b)::type>::run(scene);
+		});
+	});
+}
+
+// Integrates every dynamic shape but the spheres, which have their own multi-rate pass
+template<class T> struct IntegratePass {
+	static void run(Scene& scene, double dt) {
+		for (auto& ptr : ShapeStorage<T>::get(scene))
+			if (ptr != nullptr) ptr->update(dt);
+	}
+};
+
+template<> struct IntegratePass<Sphere> {
+	static void run(Scene&, double) {}
+};
+
+inline void integrateShapes(Scene& scene, double dt) {
+	forEachType(DynamicShapes(), [&](auto t) { IntegratePass<typename decltype(t)::type>::run(scene, dt); });
+}
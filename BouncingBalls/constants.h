@@ -7,3 +7,10 @@ const double DEG_PER_RAD = 180 / PI;
 
 const float GRAVITY_ACCEL = 0.981f;
 const float DAMPENING_FACTOR = 0.8f;
+
+// Steps a coarse-rate sphere stays at full rate after touching a full-rate one
+const int MULTIRATE_WAKE_STEPS = 16;
+
+// Narrowphase keeps sphere pairs within this fraction of their radii beyond touching,
+// so pairs pushed together by earlier responses in the same step are still resolved
+const float CONTACT_MARGIN = 0.25f;
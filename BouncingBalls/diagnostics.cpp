@@ -0,0 +1,101 @@
+#include "diagnostics.h"
+#include "jobs.h"
+#include <algorithm>
+
+// Spheres per reduction chunk, scenes smaller than this are reduced inline
+const int DIAGNOSTICS_CHUNK = 16384;
+
+static StepDiagnostics reduceRange(const SlotMap<std::unique_ptr<Sphere>>& spheres, int begin, int end, double dt){
+	StepDiagnostics d;
+	float maxSpeedSq = 0;
+	for (int i = begin; i < end; ++i) {
+		const Sphere* s = spheres[i].get();
+		if (s == nullptr) continue;
+		float vsq = s->velocity.normsq();
+		d.spheres++;
+		d.kinetic += 0.5 * s->m * vsq;
+		// Gravity adds m*GRAVITY_ACCEL*DAMPENING_FACTOR to the velocity every update
+		double g = dt > 0 ? (double)s->m * GRAVITY_ACCEL * DAMPENING_FACTOR / dt : 0;
+		d.potential += s->m * g * s->pos.y;
+		d.px += s->m * s->velocity.x;
+		d.py += s->m * s->velocity.y;
+		d.pz += s->m * s->velocity.z;
+		maxSpeedSq = std::max(maxSpeedSq, vsq);
+	}
+	d.maxSpeed = sqrtf(maxSpeedSq);
+	return d;
+}
+
+StepDiagnostics reduceDiagnostics(const SlotMap<std::unique_ptr<Sphere>>& spheres, const ContactStats& contacts, double dt){
+	int n = spheres.size();
+	std::vector<StepDiagnostics> parts(std::max(JobSystem::chunks(n, DIAGNOSTICS_CHUNK), 1));
+	JobSystem::instance().parallelFor(n, DIAGNOSTICS_CHUNK, [&](int begin, int end) {
+		parts[begin / DIAGNOSTICS_CHUNK] = reduceRange(spheres, begin, end, dt);
+	});
+
+	StepDiagnostics d = parts[0];
+	for (int c = 1; c < (int)parts.size(); ++c) {
+		const StepDiagnostics& p = parts[c];
+		d.spheres += p.spheres;
+		d.kinetic += p.kinetic, d.potential += p.potential;
+		d.px += p.px, d.py += p.py, d.pz += p.pz;
+		d.maxSpeed = std::max(d.maxSpeed, p.maxSpeed);
+	}
+
+	d.contacts = contacts.count;
+	d.maxPenetration = contacts.maxPenetration;
+	d.meanPenetration = contacts.count > 0 ? contacts.sumPenetration / contacts.count : 0;
+	return d;
+}
+
+static void hashBytes(unsigned long long& h, const void* data, int n){
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	for (int i = 0; i < n; ++i) {
+		h ^= bytes[i];
+		h *= 1099511628211ull;
+	}
+}
+
+unsigned long long hashState(const SlotMap<std::unique_ptr<Sphere>>& spheres){
+	unsigned long long h = 14695981039346656037ull;
+	int n = spheres.size();
+	for (int i = 0; i < n; ++i) {
+		const Sphere* s = spheres[i].get();
+		if (s == nullptr) continue;
+		Handle handle = spheres.handleAt(i);
+		float state[6] = { s->pos.x, s->pos.y, s->pos.z, s->velocity.x, s->velocity.y, s->velocity.z };
+		hashBytes(h, &handle.index, sizeof(handle.index));
+		hashBytes(h, &handle.generation, sizeof(handle.generation));
+		hashBytes(h, state, sizeof(state));
+	}
+	return h;
+}
+
+void DiagnosticsSeries::push(const StepDiagnostics& d){
+	QMutexLocker locker(&lock);
+	samples[head] = d;
+	head = (head + 1) % samples.size();
+	if (count < (int)samples.size()) count++;
+}
+
+bool DiagnosticsSeries::latest(StepDiagnostics& out) const {
+	QMutexLocker locker(&lock);
+	if (count == 0) return false;
+	out = samples[(head + samples.size() - 1) % samples.size()];
+	return true;
+}
+
+std::vector<StepDiagnostics> DiagnosticsSeries::recent(int n) const {
+	QMutexLocker locker(&lock);
+	n = std::min(n, count);
+	std::vector<StepDiagnostics> out;
+	out.reserve(n);
+	for (int i = n; i > 0; --i)
+		out.push_back(samples[(head + samples.size() - i) % samples.size()]);
+	return out;
+}
+
+void DiagnosticsSeries::clear(){
+	QMutexLocker locker(&lock);
+	head = count = 0;
+}
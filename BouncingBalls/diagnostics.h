@@ -0,0 +1,54 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <qmutex.h>
+#include "geometry.h"
+
+// Conserved quantities and contact statistics of one physics step
+struct StepDiagnostics {
+	StepDiagnostics()
+		: step(0), time(0), spheres(0), kinetic(0), potential(0),
+		px(0), py(0), pz(0), maxSpeed(0), contacts(0), maxPenetration(0), meanPenetration(0), stateHash(0) {}
+
+	double energy() const { return kinetic + potential; }
+
+	unsigned long long step;
+	double time;
+	int spheres;
+	// Potential energy is taken relative to y = 0 with the integrator's effective gravity,
+	// m*GRAVITY_ACCEL*DAMPENING_FACTOR/dt, so it depends on each sphere's mass and the step size
+	double kinetic, potential;
+	double px, py, pz;
+	float maxSpeed;
+	int contacts;
+	float maxPenetration, meanPenetration;
+	// Only filled in deterministic mode
+	unsigned long long stateHash;
+};
+
+/*
+   Reduces sphere state into StepDiagnostics. Large scenes are split into fixed-size chunks
+   reduced in parallel; partial results are combined in chunk order, so the result does not
+   depend on how many threads ran. dt is the step the spheres were integrated with.
+*/
+StepDiagnostics reduceDiagnostics(const SlotMap<std::unique_ptr<Sphere>>& spheres, const ContactStats& contacts, double dt);
+
+// FNV-1a hash over the exact bits of every sphere's handle, position and velocity, in storage order
+unsigned long long hashState(const SlotMap<std::unique_ptr<Sphere>>& spheres);
+
+// Bounded time series of diagnostics, written by the physics thread and read by anyone
+class DiagnosticsSeries {
+public:
+	DiagnosticsSeries(int capacity = 4096) : samples(capacity), head(0), count(0) {}
+
+	void push(const StepDiagnostics& d);
+	bool latest(StepDiagnostics& out) const;
+	// Up to n most recent samples, oldest first
+	std::vector<StepDiagnostics> recent(int n) const;
+	void clear();
+
+private:
+	std::vector<StepDiagnostics> samples;
+	int head, count;
+	mutable QMutex lock;
+};
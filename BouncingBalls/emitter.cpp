@@ -0,0 +1,115 @@
+#include "emitter.h"
+#include <cmath>
+#include <algorithm>
+#include "geometry.h"
+
+// Two unit vectors perpendicular to n and to each other
+static void basis(const Vec3f& n, Vec3f& u, Vec3f& v){
+	u = std::fabs(n.x) < 0.9f ? n.cross(Vec3f(1, 0, 0)) : n.cross(Vec3f(0, 1, 0));
+	u.normalize();
+	v = n.cross(u);
+}
+
+EmitterRng::result_type EmitterRng::operator()(){
+	unsigned offset = (unsigned)(draws % EMITTER_RNG_EPOCH);
+	if (engine == nullptr || offset == 0) {
+		unsigned long long epoch = draws / EMITTER_RNG_EPOCH;
+		std::seed_seq seq{ seed, (unsigned)epoch, (unsigned)(epoch >> 32) };
+		if (engine == nullptr) engine = std::make_unique<std::mt19937>(seq);
+		else engine->seed(seq);
+		engine->discard(offset);
+	}
+	draws++;
+	return (*engine)();
+}
+
+Emitter::Emitter(EmitterShape shape, const Vec3f& velocity, float rate, unsigned seed)
+	: shape(shape), normal(0, 1, 0), radius(0), velocity(velocity), spread(10), speedJitter(0.1f),
+	rate(rate), limit(0), sphereRadius(0.2f), minMass(0.4f), maxMass(1.0f),
+	minRestitution(0.55f), maxRestitution(0.95f), color(1, 0.9f, 0.9f), rng(seed), carry(0) {}
+
+Emitter Emitter::point(const Vec3f& at, const Vec3f& velocity, float rate, unsigned seed){
+	Emitter e(EMIT_POINT, velocity, rate, seed);
+	e.center = at;
+	return e;
+}
+
+Emitter Emitter::disc(const Vec3f& center, const Vec3f& normal, float radius, const Vec3f& velocity, float rate, unsigned seed){
+	Emitter e(EMIT_DISC, velocity, rate, seed);
+	e.center = center, e.radius = radius;
+	e.normal = normal;
+	e.normal.normalize();
+	return e;
+}
+
+Emitter Emitter::box(const Vec3f& min, const Vec3f& max, const Vec3f& velocity, float rate, unsigned seed){
+	Emitter e(EMIT_BOX, velocity, rate, seed);
+	e.min = min, e.max = max;
+	e.center = 0.5f * (min + max);
+	return e;
+}
+
+int Emitter::due(double dt){
+	carry += rate * dt;
+	int n = (int)carry;
+	carry -= n;
+	return n;
+}
+
+void Emitter::launch(Sphere& s){
+	Vec3f p = center;
+	if (shape == EMIT_DISC) {
+		Vec3f u, v;
+		basis(normal, u, v);
+		// sqrt keeps the density uniform over the area
+		float r = radius * std::sqrt(uniform(0, 1)), phi = uniform(0, 2 * PI);
+		p = center + (r * std::cos(phi)) * u + (r * std::sin(phi)) * v;
+	} else if (shape == EMIT_BOX) {
+		p = Vec3f(uniform(min.x, max.x), uniform(min.y, max.y), uniform(min.z, max.z));
+	}
+
+	// Uniform over the spherical cap: cos of the angle to the axis is uniform
+	Vec3f vel = velocity;
+	float speed = velocity.norm();
+	if (speed > 0) {
+		Vec3f axis = velocity / speed, u, v;
+		basis(axis, u, v);
+		float cosTheta = uniform(std::cos(spread * RAD_PER_DEG), 1), sinTheta = std::sqrt(std::max(1 - cosTheta * cosTheta, 0.0f));
+		float phi = uniform(0, 2 * PI);
+		Vec3f dir = cosTheta * axis + (sinTheta * std::cos(phi)) * u + (sinTheta * std::sin(phi)) * v;
+		vel = (speed * (1 + uniform(-speedJitter, speedJitter))) * dir;
+	}
+
+	s.respawn(p, sphereRadius, uniform(minMass, maxMass), uniform(minRestitution, maxRestitution), vel, color);
+}
+
+void cycleSpheres(Scene& scene, double dt){
+	SlotMap<std::unique_ptr<Sphere>>& spheres = scene.spheres;
+	if (!scene.killVolumes.empty()) {
+		// Backwards, so the sphere that erase moves into the hole has already been checked
+		for (int i = spheres.size() - 1; i >= 0; --i) {
+			for (const KillVolume& k : scene.killVolumes) {
+				if (!k.kills(spheres[i]->pos)) continue;
+				scene.spherePool.push_back(std::move(spheres[i]));
+				spheres.erase(spheres.handleAt(i));
+				break;
+			}
+		}
+	}
+
+	for (Emitter& e : scene.emitters) {
+		int n = e.due(dt);
+		for (int k = 0; k < n; ++k) {
+			if (e.limit > 0 && spheres.size() >= e.limit) break;
+			std::unique_ptr<Sphere> s;
+			if (!scene.spherePool.empty()) {
+				s = std::move(scene.spherePool.back());
+				scene.spherePool.pop_back();
+			} else {
+				s = std::make_unique<Sphere>(Sphere(Vec3f(), e.sphereRadius, 1));
+			}
+			e.launch(*s);
+			spheres.insert(std::move(s));
+		}
+	}
+}
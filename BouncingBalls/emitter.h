@@ -0,0 +1,107 @@
+#pragma once
+#include <random>
+#include <memory>
+#include "vector.h"
+
+class Sphere;
+class Scene;
+
+enum EmitterShape { EMIT_POINT, EMIT_DISC, EMIT_BOX };
+
+// Draws after which an emitter's generator is reseeded
+const unsigned EMITTER_RNG_EPOCH = 1u << 16;
+
+/*
+   Generator of an emitter that copies as a few words: its seed and the draws taken so far.
+   The Mersenne twister behind it is reseeded from the seed and the epoch every
+   EMITTER_RNG_EPOCH draws, so a copy rebuilds it with less than that many discards the
+   first time it is drawn from, and goes on exactly as the original would.
+*/
+class EmitterRng {
+public:
+	typedef std::mt19937::result_type result_type;
+
+	explicit EmitterRng(unsigned seed) : seed(seed), draws(0) {}
+	EmitterRng(const EmitterRng& o) : seed(o.seed), draws(o.draws) {}
+	EmitterRng(EmitterRng&&) = default;
+	EmitterRng& operator=(const EmitterRng& o) {
+		seed = o.seed, draws = o.draws;
+		engine.reset();
+		return *this;
+	}
+	EmitterRng& operator=(EmitterRng&&) = default;
+
+	static constexpr result_type min() { return std::mt19937::min(); }
+	static constexpr result_type max() { return std::mt19937::max(); }
+	result_type operator()();
+
+private:
+	unsigned seed;
+	unsigned long long draws;
+	std::unique_ptr<std::mt19937> engine;
+};
+
+/*
+   Spawns spheres continuously, rate per simulated second. Fractional counts carry over
+   to the next step, so low rates still come out even. Velocities are spread uniformly
+   within a cone of `spread` degrees around `velocity`, with the speed varied by up to
+   speedJitter of its length. Each emitter has its own seeded generator, so deterministic
+   runs emit the same spheres.
+*/
+class Emitter {
+public:
+	// All spheres start at one point
+	static Emitter point(const Vec3f& at, const Vec3f& velocity, float rate, unsigned seed = 1);
+	// Uniformly over a disc facing normal
+	static Emitter disc(const Vec3f& center, const Vec3f& normal, float radius, const Vec3f& velocity, float rate, unsigned seed = 1);
+	// Uniformly inside a box
+	static Emitter box(const Vec3f& min, const Vec3f& max, const Vec3f& velocity, float rate, unsigned seed = 1);
+
+	// Spheres due after dt more seconds
+	int due(double dt);
+	// Gives a new or recycled sphere the state of a freshly emitted one
+	void launch(Sphere& s);
+
+	EmitterShape shape;
+	Vec3f center, normal, min, max;
+	float radius;
+	Vec3f velocity;
+	float spread, speedJitter;
+	float rate;
+	// Emitting pauses while the scene holds this many spheres, 0 for no limit
+	int limit;
+
+	float sphereRadius;
+	float minMass, maxMass;
+	float minRestitution, maxRestitution;
+	Vec3f color;
+
+private:
+	Emitter(EmitterShape shape, const Vec3f& velocity, float rate, unsigned seed);
+
+	float uniform(float a, float b) { return std::uniform_real_distribution<float>(a, b)(rng); }
+
+	EmitterRng rng;
+	double carry;
+};
+
+// Spheres whose centers enter the box are despawned, or those that leave it when inverted
+struct KillVolume {
+	KillVolume(const Vec3f& min, const Vec3f& max, bool inverted = false) : min(min), max(max), inverted(inverted) {}
+
+	bool kills(const Vec3f& p) const {
+		bool inside = p.x >= min.x && p.y >= min.y && p.z >= min.z && p.x <= max.x && p.y <= max.y && p.z <= max.z;
+		return inside != inverted;
+	}
+
+	Vec3f min, max;
+	bool inverted;
+};
+
+/*
+   Despawns the spheres caught by the scene's kill volumes into its sphere pool, then runs
+   the emitters, which take spheres from the pool before allocating new ones. Once the
+   pool and the sphere storage have grown to the steady-state flow, nothing is allocated.
+   Changes storage, so it runs on the physics thread between steps with structureLock held.
+*/
+void cycleSpheres(Scene& scene, double dt);
@@ -0,0 +1,51 @@
+#include "events.h"
+#include <algorithm>
+
+int ContactSubscription::drain(ContactEvent* out, int max){
+	int n = 0;
+	while (n < max && ring.pop(out[n])) ++n;
+	return n;
+}
+
+std::shared_ptr<ContactSubscription> ContactEventStream::subscribe(float minImpulse, int capacity){
+	std::shared_ptr<ContactSubscription> s = std::make_shared<ContactSubscription>(std::max(minImpulse, 0.0f), std::max(capacity, 1));
+	QMutexLocker locker(&lock);
+	subscribers.push_back(s);
+	version.fetch_add(1, std::memory_order_release);
+	return s;
+}
+
+void ContactEventStream::unsubscribe(const std::shared_ptr<ContactSubscription>& s){
+	QMutexLocker locker(&lock);
+	subscribers.erase(std::remove(subscribers.begin(), subscribers.end(), s), subscribers.end());
+	version.fetch_add(1, std::memory_order_release);
+}
+
+void ContactEventStream::beginStep(double simTime, unsigned long long stepIndex){
+	time = simTime, step = stepIndex;
+	int v = version.load(std::memory_order_acquire);
+	// A subscriber being added is picked up next step rather than waited for. The live
+	// copy keeps removed subscribers alive until then.
+	if (v == seen || !lock.tryLock()) return;
+	live = subscribers;
+	seen = version.load(std::memory_order_relaxed);
+	lock.unlock();
+
+	threshold = -1;
+	for (auto& s : live)
+		if (threshold < 0 || s->minImpulse < threshold) threshold = s->minImpulse;
+}
+
+void ContactEventStream::publish(ContactEvent& e){
+	e.time = time, e.step = step;
+	unsigned long long lost = 0;
+	for (auto& s : live) {
+		if (e.impulse < s->minImpulse) continue;
+		if (!s->ring.push(e)) {
+			s->dropped.fetch_add(1, std::memory_order_relaxed);
+			++lost;
+		}
+	}
+	published.fetch_add(1, std::memory_order_relaxed);
+	if (lost > 0) dropped.fetch_add(lost, std::memory_order_relaxed);
+}
@@ -0,0 +1,147 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <qmutex.h>
+#include "vector.h"
+#include "slotmap.h"
+
+class Sphere;
+typedef Handle SphereHandle;
+
+// What a sphere hit
+enum ContactKind { CONTACT_SPHERE, CONTACT_PLANE, CONTACT_AABB, CONTACT_CAPSULE, CONTACT_OBB, CONTACT_KINDS };
+
+// One resolved contact of a sphere
+struct ContactEvent {
+	SphereHandle sphere;
+	ContactKind kind;
+	// The other sphere, for CONTACT_SPHERE
+	SphereHandle other;
+	// Index into the scene's container of that kind, -1 for CONTACT_SPHERE
+	int collider;
+	// Magnitude of the impulse applied along the contact normal
+	float impulse;
+	Vec3f pos;
+	Vec3f normal;
+	// Simulated time and step of the contact
+	double time;
+	unsigned long long step;
+};
+
+/*
+   Bounded single-producer single-consumer queue. Each side only writes its own index and
+   caches the other's, so neither ever waits for or contends with the other. Capacity is
+   rounded up to a power of two.
+*/
+template<class T> class SpscRing {
+public:
+	explicit SpscRing(int capacity) : head(0), tail(0), headCache(0), tailCache(0) {
+		size_t n = 1;
+		while (n < (size_t)capacity) n <<= 1;
+		buffer.resize(n);
+		mask = n - 1;
+	}
+
+	// Producer side. Returns false when full, leaving the queue as it was.
+	bool push(const T& value) {
+		size_t t = tail.load(std::memory_order_relaxed);
+		if (t - headCache > mask) {
+			headCache = head.load(std::memory_order_acquire);
+			if (t - headCache > mask) return false;
+		}
+		buffer[t & mask] = value;
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer side
+	bool pop(T& value) {
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h == tailCache) {
+			tailCache = tail.load(std::memory_order_acquire);
+			if (h == tailCache) return false;
+		}
+		value = buffer[h & mask];
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	int capacity() const { return (int)buffer.size(); }
+
+private:
+	std::vector<T> buffer;
+	size_t mask;
+	// Each index on its own cache line, next to the cache its owner reads
+	char pad0[64];
+	std::atomic<size_t> head;
+	size_t tailCache;
+	char pad1[64];
+	std::atomic<size_t> tail;
+	size_t headCache;
+	char pad2[64];
+};
+
+/*
+   One consumer of contact events: a ring the physics thread fills with the events at or
+   above minImpulse, and the consumer's thread drains. When the consumer falls behind, new
+   events are dropped and counted instead of stalling the step.
+*/
+class ContactSubscription {
+public:
+	ContactSubscription(float minImpulse, int capacity) : minImpulse(minImpulse), dropped(0), ring(capacity) {}
+
+	// Consumer side: takes up to max events, oldest first, and returns how many
+	int drain(ContactEvent* out, int max);
+	template<class F> int drain(F&& f) {
+		int n = 0;
+		ContactEvent e;
+		while (ring.pop(e)) f(e), ++n;
+		return n;
+	}
+
+	const float minImpulse;
+	// Events lost to a full ring
+	std::atomic<unsigned long long> dropped;
+
+private:
+	friend class ContactEventStream;
+	SpscRing<ContactEvent> ring;
+};
+
+/*
+   Fans the contacts resolved by the solver out to subscribers. Subscribing and
+   unsubscribing may happen on any thread; the physics thread picks up the change at the
+   start of a step if it gets the lock without waiting, otherwise a step later. Publishing
+   costs one comparison per contact while nobody listens.
+*/
+class ContactEventStream {
+public:
+	ContactEventStream() : version(0), seen(-1), threshold(-1), time(0), step(0), published(0), dropped(0) {}
+
+	std::shared_ptr<ContactSubscription> subscribe(float minImpulse = 0, int capacity = 4096);
+	void unsubscribe(const std::shared_ptr<ContactSubscription>& s);
+
+	// Physics thread, before the solver runs
+	void beginStep(double simTime, unsigned long long stepIndex);
+	bool listening() const { return threshold >= 0; }
+	// Whether any subscriber takes a contact with this impulse
+	bool wants(float impulse) const { return threshold >= 0 && impulse >= threshold; }
+	// Fills in the time and hands the event to every interested subscriber
+	void publish(ContactEvent& e);
+
+	// Totals over all subscribers, for metrics
+	std::atomic<unsigned long long> published, dropped;
+
+private:
+	QMutex lock;
+	std::vector<std::shared_ptr<ContactSubscription>> subscribers;
+	std::atomic<int> version;
+
+	// Physics thread's copy of the list, and the lowest threshold in it or -1 if empty
+	std::vector<std::shared_ptr<ContactSubscription>> live;
+	int seen;
+	float threshold;
+	double time;
+	unsigned long long step;
+};
@@ -0,0 +1,58 @@
+#include "forcefield.h"
+#include <algorithm>
+
+ForceField ForceField::radial(const Vec3f& center, float radius, float strength){
+	ForceField f(FIELD_RADIAL);
+	f.center = center, f.radius = radius, f.strength = strength;
+	f.min = center - Vec3f(radius, radius, radius);
+	f.max = center + Vec3f(radius, radius, radius);
+	return f;
+}
+
+ForceField ForceField::vortex(const Vec3f& center, const Vec3f& axis, float radius, float strength){
+	ForceField f = radial(center, radius, strength);
+	f.type = FIELD_VORTEX;
+	f.axis = axis;
+	f.axis.normalize();
+	return f;
+}
+
+ForceField ForceField::wind(const Vec3f& min, const Vec3f& max, const Vec3f& dir, float strength){
+	ForceField f(FIELD_WIND);
+	f.min = min, f.max = max, f.strength = strength;
+	f.axis = dir;
+	f.axis.normalize();
+	return f;
+}
+
+ForceField ForceField::drag(const Vec3f& min, const Vec3f& max, float strength){
+	ForceField f(FIELD_DRAG);
+	f.min = min, f.max = max, f.strength = strength;
+	return f;
+}
+
+Vec3f ForceField::dv(const Vec3f& pos, const Vec3f& velocity, float dt) const {
+	switch (type) {
+	case FIELD_RADIAL: {
+		Vec3f rel = pos - center;
+		float d = rel.norm();
+		if (d >= radius || d == 0) return Vec3f();
+		return (strength * (1 - d / radius) * dt / d) * rel;
+	}
+	case FIELD_VORTEX: {
+		Vec3f rel = pos - center;
+		if (rel.normsq() >= radius * radius) return Vec3f();
+		// Tangent around the axis, perpendicular to the offset from it
+		Vec3f radialPart = rel - axis.dot(rel) * axis;
+		float d = radialPart.norm();
+		if (d == 0) return Vec3f();
+		return (strength * (1 - d / radius) * dt / d) * axis.cross(radialPart);
+	}
+	case FIELD_WIND:
+		return (strength * dt) * axis;
+	case FIELD_DRAG:
+		// Never reverses the velocity, however large the step
+		return -std::min(strength * dt, 1.0f) * velocity;
+	}
+	return Vec3f();
+}
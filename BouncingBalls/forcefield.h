@@ -0,0 +1,43 @@
+#pragma once
+#include "vector.h"
+
+enum FieldType { FIELD_RADIAL, FIELD_VORTEX, FIELD_WIND, FIELD_DRAG };
+
+/*
+   A force attached to a region, applied to every sphere inside it on every step.
+   Strengths are accelerations, so light and heavy spheres respond alike.
+*/
+class ForceField {
+public:
+	// Pushes away from center (pulls in when strength < 0), fading to zero at radius
+	static ForceField radial(const Vec3f& center, float radius, float strength);
+	// Swirls around an axis through center, fading to zero at radius
+	static ForceField vortex(const Vec3f& center, const Vec3f& axis, float radius, float strength);
+	// Constant push along dir inside a box
+	static ForceField wind(const Vec3f& min, const Vec3f& max, const Vec3f& dir, float strength);
+	// Linear drag inside a box, strength is the fraction of velocity lost per second
+	static ForceField drag(const Vec3f& min, const Vec3f& max, float strength);
+
+	// Conservative bounds of the region
+	bool contains(const Vec3f& p) const {
+		return p.x >= min.x && p.y >= min.y && p.z >= min.z && p.x <= max.x && p.y <= max.y && p.z <= max.z;
+	}
+	// Velocity change over dt for a sphere inside the bounds
+	Vec3f dv(const Vec3f& pos, const Vec3f& velocity, float dt) const;
+
+	FieldType type;
+	Vec3f center, axis;
+	Vec3f min, max;
+	float radius, strength;
+
+private:
+	ForceField(FieldType type) : type(type), radius(0), strength(0) {}
+};
+
+// One-shot radial change of momentum, strength is the impulse at the center (< 0 pulls in)
+struct AreaImpulse {
+	AreaImpulse(const Vec3f& center, float radius, float strength) : center(center), radius(radius), strength(strength) {}
+
+	Vec3f center;
+	float radius, strength;
+};
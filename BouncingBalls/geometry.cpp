@@ -1,36 +1,12 @@
 #include "geometry.h"
-
-template<class C1, class C2> bool collisionDetection(C1* obj1, C2* obj2) { return false; }
-
-template<> bool collisionDetection(Sphere* s, Plane* pl) {
-	// If sphere is behind plane (as defined by normal) we have a collision
-	float dist = (s->pos - pl->a).dot(pl->normal);
-	return (dist <= s->rad);
-}
-
-template<> bool collisionDetection(Sphere* s, AABB* rect) {
-	// Same as plane but also checks for rectangle boundaries
-	float dist = (s->pos - rect->a).dot(rect->normal);
-
-	// Consider collisions even if sphere has penetrated rectangle for some time.
-	// This will eventually break down if speed is too large compared to loop processing speed.
-	if (dist <= s->rad && dist >= -10 * s->rad) {
-		Vec3f p = s->pos + dist * (-rect->normal);
-		return(p.x >= rect->minX && p.x <= rect->maxX
-			&& p.y >= rect->minY && p.y <= rect->maxY
-			&& p.z >= rect->minZ && p.z <= rect->maxZ);
-	}
-	return false;
-}
-
-template<> bool collisionDetection(Sphere* s1, Sphere* s2) {
-	return (s1->pos - s2->pos).normsq() <= (s1->rad + s2->rad) * (s1->rad + s2->rad);
-}
+#include "collision.h"
+#include <algorithm>
 
 Sphere::Sphere(Vec3f& position, float radius, float mass, float restitution, Vec3f& velocity, Vec3f& color, Vec3f& selectedColor)
 	: pos(position), rad(radius), m(mass), r(restitution),
 	origPos(position), rgb(color), selectRgb(selectedColor), 
-	selected(false), velocity(velocity), origVelocity(velocity)
+	selected(false), velocity(velocity), origVelocity(velocity),
+	active(true), pendingSteps(0), wake(0), pendingDt(0)
 {
 	// add gravity by default
 	forces.push_back(Force(Vec3f(0, -1, 0), GRAVITY_ACCEL, 0.0f));
@@ -52,10 +28,20 @@ void Sphere::draw(){
 
 void Sphere::reset(){
 	pos = origPos, velocity = origVelocity;
+	pendingSteps = 0, pendingDt = 0, wake = 0;
 	// Remove all forces except gravity
 	forces.erase(forces.begin() + 1, forces.end());
 }
 
+void Sphere::respawn(const Vec3f& position, float radius, float mass, float restitution, const Vec3f& velocity, const Vec3f& color){
+	origPos = position, origVelocity = velocity;
+	rad = radius, m = mass, r = restitution;
+	rgb = color;
+	selected = false;
+	active = true;
+	reset();
+}
+
 void Sphere::update(double dt) {
 	for (int i = 0; i < forces.size(); ++i) {
 		if (forces[i].f <= 0.01) {
@@ -71,72 +57,77 @@ void Sphere::update(double dt) {
 	pos += (dt * velocity);
 }
 
-void Sphere::collide(Scene& scene, int idx) {
-	// Sphere collision
-	int nspheres = scene.spheres.size();
-	for (int i = idx + 1; i < nspheres; ++i) {
-		Sphere* s = scene.spheres[i].get();
-		if (s != nullptr && collisionDetection(this, s)) {
-			Vec3f distVec = pos - s->pos;
-			// Calculate projections of velocities onto force vector			
-			Vec3f force = pos - s->pos;
-			force.normalize();
-			float x1_proj = force.dot(velocity);
-			Vec3f v1x = x1_proj * force;
-			Vec3f v1y = velocity - v1x;
-
-			float x2_proj = (-force).dot(s->velocity);
-			Vec3f v2x = x2_proj * (-force);
-			Vec3f v2y = s->velocity - v2x;
-
-			// Update velocities of both spheres according to Newtonian physics
-			float cor = r * s->r;
-			float m12 = m + s->m;
-			Vec3f mu12 = m * v1x + s->m * v2x;
-			velocity = v1y + (mu12 + s->m * cor * (v2x - v1x)) / m12;
-			s->velocity = v2y + (mu12 + m * cor * (v1x - v2x)) / m12;
-			
-			// Prevent merging
-			float diff = (rad + s->rad) * (rad + s->rad) - distVec.normsq();
-			if (diff > 0) {
-				distVec.normalize();
-
-				// Move spheres in opposite directions
-				pos += (diff / 2.0) * distVec;
-				s->pos -= (diff / 2.0) * distVec;
-			}
+void Sphere::advance(int n, double dt) {
+	// Forces are applied once per update. Each update's velocity gain also moves the
+	// sphere in that update and every later one, so gains are weighted by those counts.
+	Vec3f dv(0, 0, 0), dp(0, 0, 0);
+	for (Force& f : forces) {
+		if (f.decayFactor == 0) {
+			if (f.f <= 0.01) continue;
+			Vec3f a = (float)(m * f.f * DAMPENING_FACTOR) * f.dpc;
+			dv += (float)n * a;
+			dp += (float)(n * (n + 1) / 2.0) * a;
+			continue;
 		}
-	}
-
-	// Plane collision
-	int nplanes = scene.planes.size();
-	for (int i = 0; i < nplanes; ++i) {
-		Plane* p = scene.planes[i].get();
-		if (p != nullptr && collisionDetection(this, p)) {
-			// Reflect velocity around hit surface normal and apply restitution coefficient
-			velocity -= (1 + r) * velocity.dot(p->normal) * p->normal;
-			
-			// Prevent merging
-			float dist = (pos - p->a).dot(p->normal);
-			if (dist < rad) {
-				pos += (rad - dist) * p->normal;
-			}
+		for (int i = 0; i < n && f.f > 0.01; ++i) {
+			Vec3f a = (float)(m * f.f * DAMPENING_FACTOR) * f.dpc;
+			dv += a;
+			dp += (float)(n - i) * a;
+			f.decay();
 		}
 	}
+	forces.erase(std::remove_if(forces.begin(), forces.end(), [](const Force& f) { return f.f <= 0.01; }), forces.end());
+	pos += dt * ((float)n * velocity + dp);
+	velocity += dv;
+}
+
+void Sphere::catchUp(Scene& scene) {
+	if (pendingSteps == 0) return;
+	Vec3f from = pos;
+	advance(pendingSteps, pendingDt / pendingSteps);
+	pendingSteps = 0, pendingDt = 0;
+	// Static shapes were not collided with meanwhile, so stop where the path first meets one
+	float t = sweepStatics(*this, from, scene);
+	if (t < 1) pos = from + t * (pos - from);
+}
+
+float Sphere::collideSphere(Sphere* s, Scene& scene, ContactStats& contacts) {
+	// Bring a coarse-rate sphere up to the current time before touching it
+	s->catchUp(scene);
+	Contact c;
+	if (!PairKernel<Sphere, Sphere>::detect(*this, *s, c)) return -1;
 
-	// AABB collision
-	int naabbs = scene.aabbs.size();
-	for (int i = 0; i < naabbs; ++i) {
-		AABB* aabb = scene.aabbs[i].get();
-		if (aabb != nullptr && collisionDetection(this, aabb)) {
-			// Reflect velocity around hit surface normal and mult by restitution factor
-			velocity -= (1 + r) * velocity.dot(aabb->normal) * aabb->normal;
-
-			// Prevent merging
-			float dist = (pos - aabb->a).dot(aabb->normal);
-			if (dist < rad) {
-				pos += (rad - dist) * aabb->normal;
-			}
+	// Contact across the rate boundary keeps both spheres at full rate for a while
+	if (!s->active) s->wake = MULTIRATE_WAKE_STEPS;
+
+	contacts.add(c.depth);
+	return PairKernel<Sphere, Sphere>::respond(*this, *s, c);
+}
+
+void Sphere::findContacts(const Scene& scene, int idx, std::vector<SphereContact>& out) const {
+	// Each pair is handled by the sphere with the lower index. Spheres skipped by multi-rate
+	// stepping this step are handled by their active neighbors; their positions are stale
+	// until they catch up, so they are never filtered by distance.
+	auto near = [&](const Vec3f& p, float r) {
+		float reach = (rad + r) * (1 + CONTACT_MARGIN);
+		return (p - pos).normsq() < reach * reach;
+	};
+	if (scene.broadphase != nullptr && scene.orderedContacts) {
+		// Grid order depends on the cell size, index order only on the scene
+		size_t first = out.size();
+		scene.broadphase->forEachNear(pos, [&](const SphereProxy& p) {
+			if ((p.idx > idx && near(p.pos, p.rad)) || (p.idx != idx && !p.sphere->active)) out.push_back(SphereContact{ idx, p.idx, p.sphere });
+		});
+		std::sort(out.begin() + first, out.end(), [](const SphereContact& a, const SphereContact& b) { return a.otherIdx < b.otherIdx; });
+	} else if (scene.broadphase != nullptr) {
+		scene.broadphase->forEachNear(pos, [&](const SphereProxy& p) {
+			if ((p.idx > idx && near(p.pos, p.rad)) || (p.idx != idx && !p.sphere->active)) out.push_back(SphereContact{ idx, p.idx, p.sphere });
+		});
+	} else {
+		int nspheres = scene.spheres.size();
+		for (int i = 0; i < nspheres; ++i) {
+			Sphere* s = scene.spheres[i].get();
+			if (s != nullptr && ((i > idx && near(s->pos, s->rad)) || (i != idx && !s->active))) out.push_back(SphereContact{ idx, i, s });
 		}
 	}
 }
@@ -146,6 +137,10 @@ Plane::Plane(Vec3f& a, Vec3f& b, Vec3f& c, Vec3f& d, Vec3f& color)
 {
 	normal = (b - a).cross(d - a);
 	normal.normalize();
+
+	center = 0.25f * (a + b + c + d);
+	boundRad = std::fmax(std::fmax((a - center).norm(), (b - center).norm()),
+		std::fmax((c - center).norm(), (d - center).norm()));
 }
 
 void Plane::draw(){
@@ -175,3 +170,129 @@ AABB::AABB(Vec3f& a, Vec3f& b, Vec3f& c, Vec3f& d, Vec3f& color)
 	maxY = std::fmax(d.y, std::fmax(c.y, std::fmax(a.y, b.y)));
 	maxZ = std::fmax(d.z, std::fmax(c.z, std::fmax(a.z, b.z)));
 }
+
+Capsule::Capsule(const Vec3f& position, const Vec3f& axis, float halfLength, float radius, float mass, float restitution, const Vec3f& color)
+	: pos(position), axis(axis), halfLength(halfLength), rad(radius), m(mass), r(restitution), rgb(color)
+{
+	this->axis.normalize();
+}
+
+void Capsule::update(double dt) {
+	// Same per-update gravity as the spheres
+	velocity += (m * GRAVITY_ACCEL * DAMPENING_FACTOR) * Vec3f(0, -1, 0);
+	pos += (dt * velocity);
+}
+
+void Capsule::draw() const {
+	glPushMatrix();
+
+	glColor3f(rgb.x, rgb.y, rgb.z);
+	Vec3f base = end0();
+	glTranslatef(base.x, base.y, base.z);
+	GLUquadricObj* qobj = gluNewQuadric();
+	gluQuadricNormals(qobj, GLU_SMOOTH);
+	gluSphere(qobj, rad, 16, 16);
+
+	// gluCylinder runs along z, turn z onto the axis
+	Vec3f z(0, 0, 1);
+	Vec3f turn = z.cross(axis);
+	float angle = acosf(std::fmax(-1.0f, std::fmin(1.0f, z.dot(axis)))) * DEG_PER_RAD;
+	if (turn.normsq() > 1e-8f) glRotatef(angle, turn.x, turn.y, turn.z);
+	else if (axis.z < 0) glRotatef(180, 1, 0, 0);
+	gluCylinder(qobj, rad, rad, 2 * halfLength, 16, 1);
+	glTranslatef(0, 0, 2 * halfLength);
+	gluSphere(qobj, rad, 16, 16);
+	gluDeleteQuadric(qobj);
+
+	glPopMatrix();
+}
+
+OBB::OBB(const Vec3f& position, const Vec3f& halfExtents, const Vec3f& rotationAxis, float angle, float mass, float restitution, const Vec3f& color)
+	: pos(position), m(mass), r(restitution), rgb(color)
+{
+	half[0] = halfExtents.x, half[1] = halfExtents.y, half[2] = halfExtents.z;
+
+	// Rotate the world axes around rotationAxis (Rodrigues)
+	Vec3f k = rotationAxis;
+	k.normalize();
+	float rad = angle * RAD_PER_DEG, cosa = cosf(rad), sina = sinf(rad);
+	Vec3f world[3] = { Vec3f(1, 0, 0), Vec3f(0, 1, 0), Vec3f(0, 0, 1) };
+	for (int i = 0; i < 3; ++i) {
+		Vec3f v = world[i];
+		axes[i] = cosa * v + sina * k.cross(v) + ((1 - cosa) * k.dot(v)) * k;
+	}
+}
+
+void OBB::update(double dt) {
+	// Same per-update gravity as the spheres
+	velocity += (m * GRAVITY_ACCEL * DAMPENING_FACTOR) * Vec3f(0, -1, 0);
+	pos += (dt * velocity);
+}
+
+void OBB::draw() const {
+	glPushMatrix();
+
+	glColor3f(rgb.x, rgb.y, rgb.z);
+	// Columns are the box axes scaled by the half extents
+	GLfloat m[16] = {
+		half[0] * axes[0].x, half[0] * axes[0].y, half[0] * axes[0].z, 0,
+		half[1] * axes[1].x, half[1] * axes[1].y, half[1] * axes[1].z, 0,
+		half[2] * axes[2].x, half[2] * axes[2].y, half[2] * axes[2].z, 0,
+		pos.x, pos.y, pos.z, 1
+	};
+	glMultMatrixf(m);
+	glEnable(GL_NORMALIZE);
+	glutSolidCube(2);
+	glDisable(GL_NORMALIZE);
+
+	glPopMatrix();
+}
+
+bool Scene::raycast(const Vec3f& origin, const Vec3f& dir, float maxDist, RayHit& hit) const {
+	std::shared_ptr<const SpatialGrid> grid = currentIndex();
+	return grid != nullptr && grid->raycast(origin, dir, maxDist, hit);
+}
+
+std::vector<SphereProxy> Scene::overlapSphere(const Vec3f& c, float r) const {
+	std::vector<SphereProxy> out;
+	std::shared_ptr<const SpatialGrid> grid = currentIndex();
+	if (grid != nullptr) grid->overlapSphere(c, r, out);
+	return out;
+}
+
+std::vector<SphereProxy> Scene::overlapBox(const Vec3f& min, const Vec3f& max) const {
+	std::vector<SphereProxy> out;
+	std::shared_ptr<const SpatialGrid> grid = currentIndex();
+	if (grid != nullptr) grid->overlapBox(min, max, out);
+	return out;
+}
+
+std::vector<SphereProxy> Scene::nearest(const Vec3f& p, int k) const {
+	std::vector<SphereProxy> out;
+	std::shared_ptr<const SpatialGrid> grid = currentIndex();
+	if (grid != nullptr) grid->nearest(p, k, out);
+	return out;
+}
+
+void Scene::publishIndex(std::shared_ptr<const SpatialGrid> grid) {
+	QMutexLocker lock(&indexLock);
+	index.swap(grid);
+	// The previous index is released outside the lock
+}
+
+std::shared_ptr<const SpatialGrid> Scene::currentIndex() const {
+	QMutexLocker lock(&indexLock);
+	return index;
+}
+
+void Scene::publishRenderState(std::shared_ptr<const RenderState> state) {
+	QMutexLocker lock(&renderLock);
+	renderPrev.swap(renderCurr);
+	renderCurr.swap(state);
+	// The state two steps old is released outside the lock
+}
+
+void Scene::renderStates(std::shared_ptr<const RenderState>& prev, std::shared_ptr<const RenderState>& curr) const {
+	QMutexLocker lock(&renderLock);
+	prev = renderPrev, curr = renderCurr;
+}
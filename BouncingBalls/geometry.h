@@ -3,30 +3,72 @@
 #include <qdebug.h>
 #include <vector>
 #include <memory>
+#include <qmutex.h>
 #include "constants.h"
 #include "vector.h"
 #include "force.h"
+#include "forcefield.h"
+#include "emitter.h"
+#include "events.h"
+#include "spatial.h"
 
 class Scene;
+struct RenderState;
 
-class GeomObject {
-public:
-	virtual void draw() {}
-	virtual void reset() {}
-	virtual void update(double elapsedTime) {}
-	virtual void collide(Scene& objects, int idx) {}
+// Contacts resolved during the current step
+struct ContactStats {
+	ContactStats() { clear(); }
+
+	void clear() { count = 0, sumPenetration = 0, maxPenetration = 0; }
+
+	void add(float depth) {
+		count++;
+		sumPenetration += depth;
+		if (depth > maxPenetration) maxPenetration = depth;
+	}
+
+	void merge(const ContactStats& o) {
+		count += o.count;
+		sumPenetration += o.sumPenetration;
+		if (o.maxPenetration > maxPenetration) maxPenetration = o.maxPenetration;
+	}
+
+	int count;
+	double sumPenetration;
+	float maxPenetration;
+};
+
+// A sphere pair found by the narrowphase, resolved by the sphere at idx
+struct SphereContact {
+	int idx, otherIdx;
+	Sphere* other;
 };
 
-class Sphere : public GeomObject {
+/*
+   Shapes are plain classes without a common base. Collisions between them are dispatched
+   at compile time by the shape registry in collision.h.
+*/
+class Sphere {
 public:
 	Sphere(Vec3f& position, float radius, float mass, float restitution = 0.8f,
 		   Vec3f& velocity = Vec3f(0, 0, 0), Vec3f& color = Vec3f(1, 0.9, 0.9),
 		   Vec3f& selectedColor = Vec3f(0.9, 0.1, 0.1));
 
-	void draw() override;
-	void reset() override;
-	void update(double dt) override;
-	void collide(Scene& scene, int idx) override;
+	void draw();
+	void reset();
+	// Starts over as a new sphere, reusing this one's storage
+	void respawn(const Vec3f& position, float radius, float mass, float restitution, const Vec3f& velocity, const Vec3f& color);
+	void update(double dt);
+	// Narrowphase: spheres this one may touch and is responsible for, in response order.
+	// Read-only, so it can run for many spheres in parallel.
+	void findContacts(const Scene& scene, int idx, std::vector<SphereContact>& out) const;
+	// Returns the impulse applied, or -1 if the spheres do not touch
+	float collideSphere(Sphere* s, Scene& scene, ContactStats& contacts);
+	// Same as n updates of dt, in one go
+	void advance(int n, double dt);
+	// Integrates the steps skipped while running at a coarse rate in one go, stopping
+	// at the first static shape in the way
+	void catchUp(Scene& scene);
 
 	Vec3f pos;
 	float rad, m, r;
@@ -36,17 +78,25 @@ public:
 	std::vector<Force> forces;
 	Vec3f velocity;
 	Vec3f origVelocity;
+
+	// Multi-rate stepping state, see PhysicsEngine::integrate
+	bool active;
+	int pendingSteps, wake;
+	double pendingDt;
 };
 
-class Plane : public GeomObject {
+class Plane {
 public:
 	Plane(Vec3f& a, Vec3f& b, Vec3f& c, Vec3f& d, Vec3f& color);
 
-	void draw() override;
+	void draw();
 
 	Vec3f a, b, c, d;
 	Vec3f rgb;
 	Vec3f normal;
+	// Bounding sphere, used for view culling
+	Vec3f center;
+	float boundRad;
 };
 
 class AABB : public Plane {
@@ -56,13 +106,99 @@ public:
 	float minX, minY, minZ, maxX, maxY, maxZ;
 };
 
+// Moving capsule: the points within rad of a segment of 2 * halfLength along axis.
+// Orientation is fixed, contacts only change its linear velocity.
+class Capsule {
+public:
+	Capsule(const Vec3f& position, const Vec3f& axis, float halfLength, float radius, float mass,
+		float restitution = 0.6f, const Vec3f& color = Vec3f(0.9f, 0.6f, 0.2f));
+
+	void update(double dt);
+	void draw() const;
+
+	Vec3f end0() const { return pos - halfLength * axis; }
+	Vec3f end1() const { return pos + halfLength * axis; }
+
+	Vec3f pos, velocity, axis;
+	float halfLength, rad, m, r;
+	Vec3f rgb;
+};
+
+// Moving oriented box. Orientation is fixed, contacts only change its linear velocity.
+class OBB {
+public:
+	// Box rotated by angle degrees around rotationAxis
+	OBB(const Vec3f& position, const Vec3f& halfExtents, const Vec3f& rotationAxis, float angle, float mass,
+		float restitution = 0.6f, const Vec3f& color = Vec3f(0.3f, 0.6f, 0.9f));
+
+	void update(double dt);
+	void draw() const;
+
+	Vec3f pos, velocity;
+	Vec3f axes[3];
+	float half[3];
+	float m, r;
+	Vec3f rgb;
+};
+
 // Use a master class with all possible types of geometry, instead of polymorphism, 
-// to avoid dynamic casting for collision detection.
+// to avoid dynamic casting for collision detection. Each shape type has its own
+// container, see ShapeStorage in collision.h.
 class Scene {
 public:
-	Scene() {}
+	Scene() : broadphase(nullptr), orderedContacts(false), contactEvents(nullptr) {}
+
+	/*
+	   Spatial queries against the last index published by the physics engine.
+	   Safe to call from any thread; results are copies and never touch the GPU.
+	*/
+	bool raycast(const Vec3f& origin, const Vec3f& dir, float maxDist, RayHit& hit) const;
+	std::vector<SphereProxy> overlapSphere(const Vec3f& c, float r) const;
+	std::vector<SphereProxy> overlapBox(const Vec3f& min, const Vec3f& max) const;
+	std::vector<SphereProxy> nearest(const Vec3f& p, int k) const;
 
-	std::vector<std::unique_ptr<Sphere>> spheres;
+	void publishIndex(std::shared_ptr<const SpatialGrid> grid);
+	std::shared_ptr<const SpatialGrid> currentIndex() const;
+
+	// The two latest render states from the physics engine, oldest first
+	void publishRenderState(std::shared_ptr<const RenderState> state);
+	void renderStates(std::shared_ptr<const RenderState>& prev, std::shared_ptr<const RenderState>& curr) const;
+
+	// The sphere behind a handle, or nullptr once it has been removed
+	Sphere* sphere(SphereHandle h) {
+		std::unique_ptr<Sphere>* s = spheres.get(h);
+		return s != nullptr ? s->get() : nullptr;
+	}
+
+	SlotMap<std::unique_ptr<Sphere>> spheres;
 	std::vector<std::unique_ptr<Plane>> planes;
 	std::vector<std::unique_ptr<AABB>> aabbs;
+	std::vector<std::unique_ptr<Capsule>> capsules;
+	std::vector<std::unique_ptr<OBB>> obbs;
+	// Applied to every sphere inside them on every step
+	std::vector<ForceField> fields;
+	// Continuous spawning and despawning, see cycleSpheres
+	std::vector<Emitter> emitters;
+	std::vector<KillVolume> killVolumes;
+	// Despawned spheres waiting to be emitted again
+	std::vector<std::unique_ptr<Sphere>> spherePool;
+
+	// Grid of the step in progress, only valid on the physics thread
+	const SpatialGrid* broadphase;
+	ContactStats contacts;
+	// Resolve sphere pairs in index order instead of grid order, see PhysicsEngine::deterministic
+	bool orderedContacts;
+	// Receives the contacts resolved by the solver, set by the engine
+	ContactEventStream* contactEvents;
+
+	// Held by the physics thread while it adds or removes spheres. Other threads
+	// must hold it to iterate or dereference spheres.
+	mutable QMutex structureLock;
+
+private:
+	std::shared_ptr<const SpatialGrid> index;
+	mutable QMutex indexLock;
+
+	std::shared_ptr<const RenderState> renderPrev, renderCurr;
+	mutable QMutex renderLock;
 };
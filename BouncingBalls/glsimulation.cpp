@@ -1,5 +1,6 @@
 #include "glsimulation.h"
 #include <QKeyEvent>
+#include <QCoreApplication>
 #include <qtimer.h>
 #include <qtime>
 #include <windows.h>
@@ -15,33 +16,72 @@
 #include "constants.h"
 
 GLSimulation::GLSimulation(QWidget* parent)
-	: QOpenGLWidget(parent), fps(60), camera(Camera3D(0, 10, 1)), selected(nullptr),
-	zoom(1.0f), fov(45.0f), frames(0)
+	: QOpenGLWidget(parent), fps(60), camera(Camera3D(0, 10, 1)),
+	frames(0), storm(false), fountain(false), roiMode(ROI_OFF), roiSize(10.0f),
+	roiBoxMin(-10, 0, -10), roiBoxMax(10, 15, 10)
 {
 	// Setup scene
 	world.planes.push_back(std::make_unique<Plane>(Plane(Vec3f(-30, 0, 30), Vec3f(30, 0, 30), Vec3f(30, 0, -30), Vec3f(-30, 0, -30), Vec3f(0.5, 0.7, 0.5))));
 	world.spheres.push_back(std::make_unique<Sphere>(Sphere(Vec3f(0, 10, 0), 0.2, 1)));
+	// Balls that fall off the floor are despawned instead of falling forever
+	world.killVolumes.push_back(KillVolume(Vec3f(-1e4f, -1e4f, -1e4f), Vec3f(1e4f, -20, 1e4f)));
 
 	// Start the physics engine in a separate thread
 	physEngine = new PhysicsEngine(world);
+
+	// Viewers in other processes can follow the simulation through shared memory
+	QByteArray streamName = qgetenv("BOUNCINGBALLS_STREAM");
+	if (!streamName.isEmpty()) {
+		stateStream = std::make_unique<StateStreamWriter>(QString::fromLocal8Bit(streamName));
+		if (stateStream->open()) physEngine->stream = stateStream.get();
+#ifdef DEBUG
+		else qDebug() << "Stream:" << stateStream->errorString();
+#endif
+	}
+	// Tight pacing for high physics rates: spin before each deadline, real-time priority, a core of its own
+	if (!qgetenv("BOUNCINGBALLS_SPIN_US").isEmpty())
+		physEngine->pacer.spinNs = qgetenv("BOUNCINGBALLS_SPIN_US").toLongLong() * 1000;
+	if (!qgetenv("BOUNCINGBALLS_PHYSICS_PRIORITY").isEmpty())
+		physEngine->pacer.realtimePriority = qgetenv("BOUNCINGBALLS_PHYSICS_PRIORITY").toInt();
+	if (!qgetenv("BOUNCINGBALLS_PHYSICS_CORE").isEmpty())
+		physEngine->pacer.core = qgetenv("BOUNCINGBALLS_PHYSICS_CORE").toInt();
+	// History to scrub back through, 0 MB turns it off
+	physEngine->rewind.budget = REWIND_BUDGET_BYTES;
+	if (!qgetenv("BOUNCINGBALLS_REWIND_MB").isEmpty())
+		physEngine->rewind.budget = (size_t)qgetenv("BOUNCINGBALLS_REWIND_MB").toLongLong() << 20;
 	physEngine->start();
+
+	if (!qgetenv("BOUNCINGBALLS_TRACE").isEmpty())
+		Tracer::instance().setEnabled(true);
+	// Hardware counters per physics phase, in the metrics and the debug stats
+	if (!qgetenv("BOUNCINGBALLS_PERF_COUNTERS").isEmpty() && !PerfScope::enable()) {
+#ifdef DEBUG
+		qDebug() << "Performance counters are not available";
+#endif
+	}
+
+	// Unattended runs can have telemetry scraped from a textfile
+	QByteArray metricsFile = qgetenv("BOUNCINGBALLS_METRICS_FILE");
+	if (!metricsFile.isEmpty()) {
+		metricsExporter = std::make_unique<MetricsExporter>(physEngine->metrics, QString::fromLocal8Bit(metricsFile));
+		contactMeter = std::make_unique<ContactMeter>(physEngine->contactEvents, physEngine->metrics);
+	}
+}
+
+GLSimulation::~GLSimulation(){
+	metricsExporter.reset();
+	contactMeter.reset();
+	// Joins the physics thread, after which nothing of this window is touched by it
+	delete physEngine;
 }
 
 void GLSimulation::initializeGL(){
 	initializeOpenGLFunctions();
+	Tracer::instance().setThreadName("gui");
 	setMouseTracking(true);
 	srand(time(NULL));
 
-	glClearColor(0, 0, 0, 1);
-
-	glEnable(GL_DEPTH_TEST);
-	glDepthRange(0.0f, 1.0f);
-
-	glEnable(GL_LIGHT0);
-	glEnable(GL_LIGHTING);
-	glColorMaterial(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE);
-	glEnable(GL_COLOR_MATERIAL);
-	glShadeModel(GL_SMOOTH);
+	renderer.initialize();
 
 	fpsTimer.setTimerType(Qt::PreciseTimer);
 	connect(&fpsTimer, &QTimer::timeout, this, &GLSimulation::frame_tick);
@@ -51,113 +91,59 @@ void GLSimulation::initializeGL(){
 }
 
 void GLSimulation::resizeGL(int w, int h){
-	glViewport(0, 0, w, h);
-	glMatrixMode(GL_PROJECTION);
-	glLoadIdentity();
-	gluPerspective(fov, (float)w / h, 0.1, 100.0);
-	glMatrixMode(GL_MODELVIEW);
-	glLoadIdentity();
+	renderer.resize(w, h);
 }
 
 void GLSimulation::paintGL(){
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-	// Set background color
-	glClearColor(117.0f / 255.0f, 1.0f, 250.0f / 255.0f, 1.0f);
-
-	glLoadIdentity();
-
-	// Scale with zoom factor
-	glScalef(zoom, zoom, 1.0f);
-
-	// Move scene relative to camera position
-	glRotatef(camera.rotX, 1.0, 0.0, 0.0);
-	glRotatef(camera.rotY, 0.0, 1.0, 0.0);
-	glTranslated(-camera.x, -camera.y, -camera.z);
-
-	// Set light to static position
-	GLfloat ambient[] = { 0.1f, 0.1f, 0.1f, 1.0f };
-	glLightfv(GL_LIGHT0, GL_AMBIENT, ambient);
-	GLfloat pos[] = { 0.0, 50.0f, 0.0f, 1.0f };
-	glLightfv(GL_LIGHT0, GL_POSITION, pos);
-
-	int nplanes = world.planes.size();
-	for (int i = 0; i < nplanes; ++i)
-		world.planes[i]->draw();
-	int naabbs = world.aabbs.size();
-	for (int i = 0; i < naabbs; ++i)
-		world.aabbs[i]->draw();
-	int nspheres = world.spheres.size();
-	for (int i = 0; i < nspheres; ++i)
-		world.spheres[i]->draw();
+	TRACE_SCOPE("paintGL");
+	renderer.render(world, camera, selected, renderClockNs());
 
 	frames++;
 }
 
 void GLSimulation::handleKeyobardEvents(){
-	if (keystates[Qt::Key_W]) {
-		// Move forward
-		camera.x += float(sin(camera.rotY * RAD_PER_DEG)) * camera.v;
-		camera.y -= float(sin(camera.rotX * RAD_PER_DEG)) * camera.v;
-		camera.z -= float(cos(camera.rotY * RAD_PER_DEG)) * camera.v;
-	}
-	if (keystates[Qt::Key_S]) {
-		// Move backwards
-		camera.x -= float(sin(camera.rotY * RAD_PER_DEG)) * camera.v;
-		camera.y += float(sin(camera.rotX * RAD_PER_DEG)) * camera.v;
-		camera.z += float(cos(camera.rotY * RAD_PER_DEG)) * camera.v;
-	}
-	if (keystates[Qt::Key_A]) {
-		// Move left
-		camera.x -= float(cos(camera.rotY * RAD_PER_DEG)) * camera.v;
-		camera.z -= float(sin(camera.rotY * RAD_PER_DEG)) * camera.v;
-	}
-	if (keystates[Qt::Key_D]) {
-		// Move right
-		camera.x += float(cos(camera.rotY * RAD_PER_DEG)) * camera.v;
-		camera.z += float(sin(camera.rotY * RAD_PER_DEG)) * camera.v;
-	}
-	if (keystates[Qt::Key_Q]) {
-		// Move down
-		camera.y -= camera.v;
-	}
-	if (keystates[Qt::Key_E]) {
-		// Move up
-		camera.y += camera.v;
-	}
+	camera.fly(keystates[Qt::Key_W], keystates[Qt::Key_S], keystates[Qt::Key_A], keystates[Qt::Key_D],
+		keystates[Qt::Key_Q], keystates[Qt::Key_E]);
 }
 
-Vec3f GLSimulation::mouseToWorld(int x, int y){
+void GLSimulation::mouseRay(int x, int y, Vec3f& origin, Vec3f& dir){
 	double yCart = (double)height() - y - 1;
 
-	makeCurrent();
-
-	// Read conversion matrices
-	GLint vport[4];
+	// Unproject with the matrices cached by the last paint, so we never read back from the GPU
 	GLdouble mmat[16];
 	GLdouble pmat[16];
-	glGetIntegerv(GL_VIEWPORT, vport);
-	glGetDoublev(GL_MODELVIEW_MATRIX, mmat);
-	glGetDoublev(GL_PROJECTION_MATRIX, pmat);
-	
-	// Read depth buffer
-	float depth;
-	glReadPixels(x, yCart, 1, 1, GL_DEPTH_COMPONENT, GL_FLOAT, &depth);
+	for (int i = 0; i < 16; ++i)
+		mmat[i] = renderer.modelview[i], pmat[i] = renderer.projection[i];
+
+	double nearX, nearY, nearZ, farX, farY, farZ;
+	gluUnProject(x, yCart, 0.0, mmat, pmat, renderer.viewport, &nearX, &nearY, &nearZ);
+	gluUnProject(x, yCart, 1.0, mmat, pmat, renderer.viewport, &farX, &farY, &farZ);
+
+	origin = Vec3f(nearX, nearY, nearZ);
+	dir = Vec3f(farX, farY, farZ) - origin;
+	dir.normalize();
+}
 
-	// Convert to world coordinates
-	double posX, posY, posZ;
-	gluUnProject(x, yCart, depth, mmat, pmat, vport, &posX, &posY, &posZ);
+Vec3f GLSimulation::viewTarget(){
+	Vec3f origin, dir;
+	mouseRay(width() / 2, height() / 2, origin, dir);
 
-	return Vec3f(posX, posY, posZ);
+	RayHit hit;
+	if (world.raycast(origin, dir, 100.0f, hit))
+		return hit.point;
+	// Otherwise where the view meets the floor, or a fixed distance ahead
+	if (dir.y < 0 && origin.y > 0)
+		return origin + (-origin.y / dir.y) * dir;
+	return origin + 10.0f * dir;
 }
 
 void GLSimulation::keyPressEvent(QKeyEvent* event){
+	TRACE_SCOPE("keyPress");
 	keystates[event->key()] = true;
 
 	if (event->key() == Qt::Key_Escape) {
-		// Exit
-		physEngine->stop();
-		exit(0);
+		// Exit through main, which stops the engine before the job pool
+		QCoreApplication::quit();
 	}
 
 	if (event->key() == Qt::Key_Space) {
@@ -167,8 +153,7 @@ void GLSimulation::keyPressEvent(QKeyEvent* event){
 
 	if (event->key() == Qt::Key_R) {
 		// Reset all simulated objects
-		for (int i = 0; i < world.spheres.size(); ++i)
-			world.spheres[i]->reset();
+		resetAllButtonPressed();
 	}
 
 	if (event->key() == Qt::Key_Right) {
@@ -176,9 +161,15 @@ void GLSimulation::keyPressEvent(QKeyEvent* event){
 		physEngine->step();
 	}
 
+	if (event->key() == Qt::Key_Left) {
+		// Pause and scrub back; space resumes from there
+		if (physEngine->running) physEngine->flip();
+		physEngine->rewindBy(REWIND_SCRUB_SECONDS);
+	}
+
 	if (event->key() == Qt::Key_Z) {
 		// Reset zoom
-		zoom = 1.0f;
+		renderer.zoom = 1.0f;
 	}
 
 	if (event->key() == Qt::Key_G) {
@@ -186,18 +177,117 @@ void GLSimulation::keyPressEvent(QKeyEvent* event){
 		generateBalls();
 	}
 
+	if (event->key() == Qt::Key_B) {
+		// Spawn a block of balls in front of the camera, keeping the existing ones
+		spawnBalls(2000);
+	}
+
+	if (event->key() == Qt::Key_M) {
+		// Cycle multi-rate stepping: off, around camera, around selection, fixed box
+		roiMode = RoiMode((roiMode + 1) % ROI_MODES);
+		physEngine->multiRate = roiMode != ROI_OFF;
+		updateRegionOfInterest();
+	}
+
+	if (event->key() == Qt::Key_I) {
+		// Toggle per-step diagnostics
+		physEngine->diagnostics = !physEngine->diagnostics;
+		physEngine->diagnosticsSeries.clear();
+	}
+
+	if (event->key() == Qt::Key_N) {
+		// Cycle sphere placement between steps: latest state, interpolated, extrapolated
+		renderer.interpolator.mode = RenderBlend((renderer.interpolator.mode + 1) % BLEND_MODES);
+	}
+
+	if (event->key() == Qt::Key_X || event->key() == Qt::Key_C) {
+		// Blast (X) or implode (C) around whatever is in the middle of the view
+		float strength = event->key() == Qt::Key_X ? 8.0f : -8.0f;
+		physEngine->blast(AreaImpulse(viewTarget(), 6.0f, strength));
+	}
+
+	if (event->key() == Qt::Key_J || event->key() == Qt::Key_U) {
+		// Drop a capsule (J) or a box (U) above whatever is in the middle of the view
+		Vec3f at = viewTarget() + Vec3f(0, 4, 0);
+		Vec3f axis(-1.0f + (rand() % 200) / 100.0f, 0.5f + (rand() % 100) / 100.0f, -1.0f + (rand() % 200) / 100.0f);
+		float angle = rand() % 90;
+		if (event->key() == Qt::Key_J) {
+			physEngine->post([at, axis](Scene& scene) { scene.capsules.push_back(std::make_unique<Capsule>(at, axis, 0.8f, 0.3f, 1.5f)); });
+		} else {
+			physEngine->post([at, axis, angle](Scene& scene) {
+				scene.obbs.push_back(std::make_unique<OBB>(at, Vec3f(0.8f, 0.4f, 0.5f), axis, angle, 2.0f));
+			});
+		}
+	}
+
+	if (event->key() == Qt::Key_V) {
+		// Toggle a storm: a vortex over the floor with drag near the ground
+		storm = !storm;
+		bool on = storm;
+		physEngine->post([on](Scene& scene) {
+			scene.fields.clear();
+			if (!on) return;
+			scene.fields.push_back(ForceField::vortex(Vec3f(0, 5, 0), Vec3f(0, 1, 0), 20.0f, 6.0f));
+			scene.fields.push_back(ForceField::radial(Vec3f(0, 0, 0), 20.0f, -1.5f));
+			scene.fields.push_back(ForceField::wind(Vec3f(-30, 0, -30), Vec3f(30, 4, 30), Vec3f(0, 1, 0), 1.2f));
+			scene.fields.push_back(ForceField::drag(Vec3f(-30, 0, -30), Vec3f(30, 1, 30), 0.5f));
+		});
+	}
+
+	if (event->key() == Qt::Key_F) {
+		// Toggle a fountain in the middle of the floor
+		fountain = !fountain;
+		bool on = fountain;
+		physEngine->post([on](Scene& scene) {
+			scene.emitters.clear();
+			if (!on) return;
+			Emitter e = Emitter::disc(Vec3f(0, 0.5f, 0), Vec3f(0, 1, 0), 1.0f, Vec3f(0, 12, 0), 300.0f);
+			e.spread = 12;
+			e.color = Vec3f(0.6f, 0.8f, 1.0f);
+			scene.emitters.push_back(e);
+		});
+	}
+
+	if (event->key() == Qt::Key_O) {
+		// Toggle mutual gravitation between balls
+		physEngine->nbody = !physEngine->nbody;
+	}
+
+	if (event->key() == Qt::Key_K) {
+		// Toggle deterministic stepping
+		physEngine->deterministic = !physEngine->deterministic;
+	}
+
+	if (event->key() == Qt::Key_H) {
+		// Toggle budgeted stepping: hold the physics rate by lowering quality under load
+		physEngine->stepBudgetMs = physEngine->stepBudgetMs > 0 ? 0 : 1000.0f / physEngine->fps;
+	}
+
+	if (event->key() == Qt::Key_L) {
+		// Toggle tuning of grid, worker and batch settings from measured step times
+		physEngine->autotune = !physEngine->autotune;
+	}
+
+	if (event->key() == Qt::Key_T) {
+		// Start tracing, or stop and write the last 10 seconds as a Chrome trace
+		Tracer& tracer = Tracer::instance();
+		if (tracer.enabled()) {
+			tracer.setEnabled(false);
+			bool written = tracer.exportJson("trace.json", 10000);
+			#ifdef DEBUG
+			if (written) qDebug() << "Trace written to trace.json";
+			#endif
+		} else {
+			tracer.setEnabled(true);
+		}
+	}
+
 	if (event->key() == Qt::Key_Backspace) {
 		// Delete selected ball
-		if (selected != nullptr) {
-			int nspheres = world.spheres.size();
-			for (int i = 0; i < nspheres; ++i) {
-				Sphere* s = world.spheres[i].get();
-				if (s != nullptr && s == selected) {
-					world.spheres.erase(world.spheres.begin() + i);
-					selected = nullptr;
-					break;
-				}
-			}
+		if (selected.valid()) {
+			SphereHandle h = selected;
+			physEngine->post([h](Scene& scene) { scene.spheres.erase(h); });
+			selected = SphereHandle();
 		}
 	}
 }
@@ -209,38 +299,40 @@ void GLSimulation::keyReleaseEvent(QKeyEvent* event){
 }
 
 void GLSimulation::mousePressEvent(QMouseEvent* e){
+	TRACE_SCOPE("mousePress");
 	keystates[e->button()] = true;
 
 	if (e->button() == Qt::LeftButton) {
 		// Select ball
-		Vec3f wcoord(mouseToWorld(e->x(), e->y()));
+		Vec3f origin, dir;
+		mouseRay(e->x(), e->y(), origin, dir);
 		lastX = e->x(), lastY = e->y();
 
 		// Check for ball selection
-		for (int i = 0; i < world.spheres.size(); ++i) {
-			Sphere* s = world.spheres[i].get();
-			if ((s->pos - wcoord).normsq() <= (double)s->rad * s->rad + 0.02 && s != selected) {
-				if (selected != nullptr) { selected->selected = false; }
-				s->selected = true;
-
-				// Disable global selection to prevent update due to cyclic trigger
-				selected = nullptr;
-					
-				// These are emitted synchronously so we don't have race condition with the above
-				emit massChanged(s->m);
-				emit restitutionChanged(s->r);
-				emit radiusChanged(s->rad);
-				emit xChanged((s->origPos.x + 25) * 2);
-				emit yChanged(s->origPos.y * 5);
-				emit zChanged((s->origPos.z + 25) * 2);
-				emit vxChanged(s->origVelocity.x);
-				emit vyChanged(s->origVelocity.y);
-				emit vzChanged(s->origVelocity.z);
-					
-				// Update selection
-				selected = s;
-				break;
-			}
+		RayHit hit;
+		QMutexLocker lock(&world.structureLock);
+		Sphere* s = world.raycast(origin, dir, 100.0f, hit) ? world.sphere(hit.handle) : nullptr;
+		if (s != nullptr && hit.handle != selected) {
+			Sphere* prev = world.sphere(selected);
+			if (prev != nullptr) { prev->selected = false; }
+			s->selected = true;
+
+			// Disable global selection to prevent update due to cyclic trigger
+			selected = SphereHandle();
+
+			// These are emitted synchronously so we don't have race condition with the above
+			emit massChanged(s->m);
+			emit restitutionChanged(s->r);
+			emit radiusChanged(s->rad);
+			emit xChanged((s->origPos.x + 25) * 2);
+			emit yChanged(s->origPos.y * 5);
+			emit zChanged((s->origPos.z + 25) * 2);
+			emit vxChanged(s->origVelocity.x);
+			emit vyChanged(s->origVelocity.y);
+			emit vzChanged(s->origVelocity.z);
+
+			// Update selection
+			selected = hit.handle;
 		}
 	} else if (e->button() == Qt::RightButton) {
 		// Create a new ball at cursor position
@@ -252,26 +344,19 @@ void GLSimulation::mousePressEvent(QMouseEvent* e){
 		Vec3f newPos(x, y, z);
 			
 		// Check if new position does not collide with existing balls
-		bool foundCollision = false;
-		int nspheres = world.spheres.size();
-		for (int i = 0; i < nspheres; ++i) {
-			Sphere* s = world.spheres[i].get();
-			if (s != nullptr) {
-				if ((s->pos - newPos).normsq() <= s->rad * s->rad + 0.5 * 0.5 + 0.02) {
-					foundCollision = true;
-					break;
-				}
-			}
-		}
-		if (!foundCollision) {
-			if (selected != nullptr) {
+		QMutexLocker lock(&world.structureLock);
+		Sphere* sel = world.sphere(selected);
+		float newRad = sel != nullptr ? sel->rad : 0.2f;
+		if (world.overlapSphere(newPos, newRad + 0.1f).empty()) {
+			std::vector<std::unique_ptr<Sphere>> batch;
+			if (sel != nullptr) {
 				// use values of currently selected ball
-				world.spheres.push_back(std::make_unique<Sphere>(
-					Sphere(Vec3f(x, y, z), selected->rad, selected->m, selected->r, selected->origVelocity)));
+				batch.push_back(std::make_unique<Sphere>(
+					Sphere(Vec3f(x, y, z), sel->rad, sel->m, sel->r, sel->origVelocity)));
 			} else {
-				world.spheres.push_back(std::make_unique<Sphere>(Sphere(Vec3f(x, y, z), 0.2, 0.5)));
+				batch.push_back(std::make_unique<Sphere>(Sphere(Vec3f(x, y, z), 0.2, 0.5)));
 			}
-			
+			physEngine->addSpheres(std::move(batch));
 		}
 	}
 }
@@ -286,20 +371,15 @@ void GLSimulation::mouseMoveEvent(QMouseEvent* e){
 		int diffX = (e->x() - lastX) * 0.2;
 		int diffY = (e->y() - lastY) * 0.2;
 		lastX = e->x(), lastY = e->y();
-		camera.rotY += diffX;
-		camera.rotX += diffY;
-		if (camera.rotX >= 360) camera.rotX -= 360;
-		if (camera.rotX <= -360) camera.rotX += 360;
-		if (camera.rotY >= 360) camera.rotY -= 360;
-		if (camera.rotY <= -360) camera.rotY += 360;
+		camera.turn(diffX, diffY);
 	}
 }
 
 void GLSimulation::wheelEvent(QWheelEvent* event){
 	if (event->delta() > 0) {
-		zoom += 0.2f;
+		renderer.zoom += 0.2f;
 	} else if (event->delta() < 0) {
-		zoom -= 0.2f;
+		renderer.zoom -= 0.2f;
 	}
 }
 
@@ -308,15 +388,15 @@ void GLSimulation::closeEvent(QCloseEvent* event) {
 }
 
 void GLSimulation::renderLoop() {
+	TRACE_SCOPE("renderLoop");
 	handleKeyobardEvents();
+	updateRegionOfInterest();
 	update();
 	QTimer::singleShot(1000.0f / fps, this, &GLSimulation::renderLoop);
 }
 
 void GLSimulation::generateBalls(){
-	bool physRunning = physEngine->running;
-	if (physRunning) physEngine->stop();
-	world.spheres.clear();
+	std::vector<std::unique_ptr<Sphere>> batch;
 	for (float x = -5; x < 5; x += 0.5) {
 		for (float y = 12; y <= 15; y += 1) {
 			for (float z = -5; z < 5; z += 0.5) {
@@ -325,90 +405,132 @@ void GLSimulation::generateBalls(){
 				float vx = -10.0 + (rand() % 2000) / 100.0;
 				float vy = -10.0 + (rand() % 1000) / 100.0;
 				float vz = -10.0 + (rand() % 2000) / 100.0;
-				world.spheres.push_back(std::make_unique<Sphere>(Sphere(Vec3f(x, y, z), 0.2, mass, restitution, Vec3f(vx, vy, vz))));
+				batch.push_back(std::make_unique<Sphere>(Sphere(Vec3f(x, y, z), 0.2, mass, restitution, Vec3f(vx, vy, vz))));
 			}
 		}
 	}
-	if(physRunning) physEngine->flip();
+	// Replace the scene in one edit so the engine never steps a half-built scene
+	physEngine->addSpheres(std::move(batch), true);
+	selected = SphereHandle();
+}
+
+void GLSimulation::spawnBalls(int count){
+	// Region centered a few units in front of the camera, kept above the floor
+	float x = camera.x + float(sin(camera.rotY * RAD_PER_DEG)) * 8;
+	float y = camera.y - float(sin(camera.rotX * RAD_PER_DEG)) * 8;
+	float z = camera.z - float(cos(camera.rotY * RAD_PER_DEG)) * 8;
+	Vec3f min(x - 4, std::fmax(y - 3, 0.0f), z - 4);
+	Vec3f max(x + 4, std::fmax(y + 3, 1.0f), z + 4);
+
+	std::shared_ptr<const SpatialGrid> index = world.currentIndex();
+	physEngine->addSpheres(spawner.spawn(min, max, count, SpawnParams(), index.get()));
+}
+
+void GLSimulation::updateRegionOfInterest(){
+	Vec3f extent(roiSize, roiSize, roiSize);
+	if (roiMode == ROI_CAMERA) {
+		physEngine->setRegionOfInterest(camera.eye() - extent, camera.eye() + extent);
+	} else if (roiMode == ROI_SELECTION && selected.valid()) {
+		QMutexLocker lock(&world.structureLock);
+		Sphere* s = world.sphere(selected);
+		if (s != nullptr) physEngine->setRegionOfInterest(s->pos - extent, s->pos + extent);
+	} else if (roiMode == ROI_BOX) {
+		physEngine->setRegionOfInterest(roiBoxMin, roiBoxMax);
+	} else {
+		// Without a region only slow spheres are stepped at a coarse rate
+		physEngine->clearRegionOfInterest();
+	}
 }
 
 void GLSimulation::frame_tick() {
 	#ifdef DEBUG
 	qDebug() << "FPS: " << frames;
+	StepDiagnostics d;
+	if (physEngine->diagnostics && physEngine->diagnosticsSeries.latest(d)) {
+		qDebug() << "Step" << d.step << "E:" << d.energy() << "p: (" << d.px << "," << d.py << "," << d.pz << ")"
+			<< "vmax:" << d.maxSpeed << "contacts:" << d.contacts << "max penetration:" << d.maxPenetration;
+	}
+	if (physEngine->deterministic)
+		qDebug() << "Step" << physEngine->steps << "state hash:" << QString::number(physEngine->lastStateHash, 16);
+	if (PerfScope::enabled())
+		qDebug().noquote() << QString::fromStdString(physEngine->metrics.phaseSummary());
 	#endif
+	physEngine->metrics.renderFps.store(frames, std::memory_order_relaxed);
 	frames = 0;
 }
 
+void GLSimulation::editSelected(std::function<void(Sphere*)> edit){
+	if (!selected.valid()) return;
+	// The handle goes stale if the ball is removed before the edit runs
+	SphereHandle h = selected;
+	physEngine->post([h, edit](Scene& scene) {
+		Sphere* s = scene.sphere(h);
+		if (s != nullptr) edit(s);
+	});
+}
+
 void GLSimulation::updateMass(double mass) {
-	if (selected != nullptr) {
-		selected->m = mass;
-	}
+	editSelected([=](Sphere* s) { s->m = mass; });
 }
 
 void GLSimulation::updateRestitution(double res){
-	if (selected != nullptr) {
-		selected->r = res;
-	}
+	editSelected([=](Sphere* s) { s->r = res; });
 }
 
 void GLSimulation::updateRadius(double radius){
-	if (selected != nullptr) {
-		selected->rad = radius;
-	}
+	editSelected([=](Sphere* s) { s->rad = radius; });
 }
 
 void GLSimulation::updateX(int x){
-	if (selected != nullptr) {
-		float newX = (x - 50) * 0.5f;
-		selected->origPos.x = newX;
-		if (!physEngine->running) {
-			selected->pos.x = newX;
-		}
-	}
+	float newX = (x - 50) * 0.5f;
+	bool paused = !physEngine->running;
+	editSelected([=](Sphere* s) {
+		s->origPos.x = newX;
+		if (paused) s->pos.x = newX;
+	});
 }
 
 void GLSimulation::updateY(int y){
 	float newY = y * 0.2f;
-	if (selected != nullptr && newY >= selected->rad) {
-		selected->origPos.y = newY;
-		if (!physEngine->running) {
-			selected->pos.y = newY;
-		}
-	}
+	bool paused = !physEngine->running;
+	editSelected([=](Sphere* s) {
+		if (newY < s->rad) return;
+		s->origPos.y = newY;
+		if (paused) s->pos.y = newY;
+	});
 }
 
 void GLSimulation::updateZ(int z){
-	if (selected != nullptr) {
-		float newZ = (z - 50) * 0.5f;
-		selected->origPos.z = newZ;
-		if (!physEngine->running) {
-			selected->pos.z = newZ;
-		}
-	}
+	float newZ = (z - 50) * 0.5f;
+	bool paused = !physEngine->running;
+	editSelected([=](Sphere* s) {
+		s->origPos.z = newZ;
+		if (paused) s->pos.z = newZ;
+	});
 }
 
 void GLSimulation::updateVx(double v){
-	if (selected != nullptr) {
-		selected->origVelocity.x = v;
-		if(!physEngine->running)
-			selected->velocity.x = v;
-	}
+	bool paused = !physEngine->running;
+	editSelected([=](Sphere* s) {
+		s->origVelocity.x = v;
+		if (paused) s->velocity.x = v;
+	});
 }
 
 void GLSimulation::updateVy(double v){
-	if (selected != nullptr) {
-		selected->origVelocity.y = v;
-		if(!physEngine->running)
-			selected->velocity.y = v;
-	}
+	bool paused = !physEngine->running;
+	editSelected([=](Sphere* s) {
+		s->origVelocity.y = v;
+		if (paused) s->velocity.y = v;
+	});
 }
 
 void GLSimulation::updateVz(double v){
-	if (selected != nullptr) {
-		selected->origVelocity.z = v;
-		if(!physEngine->running)
-			selected->velocity.z = v;
-	}
+	bool paused = !physEngine->running;
+	editSelected([=](Sphere* s) {
+		s->origVelocity.z = v;
+		if (paused) s->velocity.z = v;
+	});
 }
 
 void GLSimulation::updateCameraSpeed(double v){
@@ -432,31 +554,37 @@ void GLSimulation::stepButtonPressed(){
 }
 
 void GLSimulation::resetCurrentButtonPressed(){
-	if (selected != nullptr) {
-		selected->reset();
-	}
+	editSelected([](Sphere* s) { s->reset(); });
 }
 
 void GLSimulation::resetAllButtonPressed(){
-	for (int i = 0; i < world.spheres.size(); ++i)
-		world.spheres[i]->reset();
+	physEngine->post([](Scene& scene) {
+		for (int i = 0; i < scene.spheres.size(); ++i)
+			scene.spheres[i]->reset();
+	});
 }
 
 void GLSimulation::clearAllButtonPressed(){
-	bool physRunning = physEngine->running;
-	if(physRunning) physEngine->stop();
-	world.spheres.clear();
-	selected = nullptr;
-	if(physRunning) physEngine->flip();
+	PhysicsEngine* engine = physEngine;
+	physEngine->post([engine](Scene& scene) {
+		scene.spheres.clear();
+		scene.capsules.clear();
+		scene.obbs.clear();
+		engine->rewind.clear();
+	});
+	selected = SphereHandle();
 }
 
 void GLSimulation::addExternalForce(Vec3f& dir, float power, float decay){
-	if(selected != nullptr){
-		selected->forces.push_back(Force(dir, power, decay));
-	}
+	Force force(dir, power, decay);
+	editSelected([=](Sphere* s) { s->forces.push_back(force); });
 }
 
 void GLSimulation::switchWallsButtonPressed(bool state){
+	physEngine->post([state](Scene& scene) { setWalls(scene, state); });
+}
+
+void GLSimulation::setWalls(Scene& world, bool state){
 	if (state) {
 		// left wall
 		world.aabbs.push_back(std::make_unique<AABB>(AABB(Vec3f(-30, 0, 30), Vec3f(-30, 0, -30), Vec3f(-30, 15, -30), Vec3f(-30, 15, 30), Vec3f(0.5, 0.4, 0.8))));
@@ -3,18 +3,27 @@
 #include <QOpenGLFunctions>
 #include "physics.h"
 #include "camera.h"
+#include "spawner.h"
+#include "renderer.h"
+#include "statestream.h"
+
+// Where the full-rate region follows when multi-rate stepping is on
+enum RoiMode { ROI_OFF, ROI_CAMERA, ROI_SELECTION, ROI_BOX, ROI_MODES };
 
 class GLSimulation : public QOpenGLWidget, public QOpenGLFunctions {
 	Q_OBJECT
 public:
 	explicit GLSimulation(QWidget* parent = 0);
+	~GLSimulation();
 
 	void initializeGL() override;
 	void resizeGL(int w, int h) override;
 	void paintGL() override;
 
 	void handleKeyobardEvents();
-	Vec3f mouseToWorld(int x, int y);
+	void mouseRay(int x, int y, Vec3f& origin, Vec3f& dir);
+	// Point under the middle of the view
+	Vec3f viewTarget();
 
 	void keyPressEvent(QKeyEvent* event) override;
 	void keyReleaseEvent(QKeyEvent* event) override;
@@ -30,6 +39,11 @@ public:
 	void frame_tick();
 	void renderLoop();
 	void generateBalls();
+	void spawnBalls(int count);
+	void updateRegionOfInterest();
+	// Posts an edit of the selected ball to the physics thread
+	void editSelected(std::function<void(Sphere*)> edit);
+	static void setWalls(Scene& world, bool state);
 
 signals:
 	void massChanged(double mass);
@@ -67,12 +81,21 @@ public slots:
 private:
 	int fps, frames;
 	float lastX, lastY;
-	float zoom, fov;
 	Camera3D camera;
+	SceneRenderer renderer;
 	QMap<int, bool> keystates;
 	Scene world;
 	QTimer fpsTimer;
 
-	Sphere* selected;
+
+	SphereHandle selected;
 	PhysicsEngine* physEngine;
+	std::unique_ptr<MetricsExporter> metricsExporter;
+	std::unique_ptr<ContactMeter> contactMeter;
+	std::unique_ptr<StateStreamWriter> stateStream;
+	BulkSpawner spawner;
+	bool storm, fountain;
+	RoiMode roiMode;
+	float roiSize;
+	Vec3f roiBoxMin, roiBoxMax;
 };
@@ -0,0 +1,207 @@
+#include "gravity.h"
+#include "jobs.h"
+#include <algorithm>
+
+static bool bodyOrder(unsigned long long ca, int ia, unsigned long long cb, int ib){
+	return ca < cb || (ca == cb && ia < ib);
+}
+
+void NBodyGravity::accelerations(const SlotMap<std::unique_ptr<Sphere>>& spheres, std::vector<Vec3f>& accel){
+	if (reference) bruteForce(spheres, accel);
+	else barnesHut(spheres, accel);
+}
+
+void NBodyGravity::sortBodies(const SlotMap<std::unique_ptr<Sphere>>& spheres){
+	bodies.clear();
+	Vec3f min(1e30f, 1e30f, 1e30f), max(-1e30f, -1e30f, -1e30f);
+	int n = spheres.size();
+	for (int i = 0; i < n; ++i) {
+		const Sphere* s = spheres[i].get();
+		if (s == nullptr) continue;
+		Body b;
+		b.pos = s->pos, b.m = s->m, b.idx = i;
+		bodies.push_back(b);
+		min = Vec3f(std::fmin(min.x, s->pos.x), std::fmin(min.y, s->pos.y), std::fmin(min.z, s->pos.z));
+		max = Vec3f(std::fmax(max.x, s->pos.x), std::fmax(max.y, s->pos.y), std::fmax(max.z, s->pos.z));
+	}
+	if (bodies.empty()) return;
+
+	// Cubic root cell, padded so the maximum still quantizes inside it
+	Vec3f extent = max - min;
+	rootHalfSize = std::fmax(std::fmax(extent.x, extent.y), std::fmax(extent.z, 1e-3f)) * 0.5f * 1.001f;
+	rootCenter = 0.5f * (min + max);
+	Vec3f corner = rootCenter - Vec3f(rootHalfSize, rootHalfSize, rootHalfSize);
+	float scale = ((1 << GRAVITY_MORTON_BITS) - 1) / (2 * rootHalfSize);
+
+	int nbodies = bodies.size();
+	auto encode = [this, corner, scale](int begin, int end) {
+		for (int i = begin; i < end; ++i) {
+			Vec3f q = scale * (bodies[i].pos - corner);
+			bodies[i].code = expandBits((unsigned)q.x) << 2 | expandBits((unsigned)q.y) << 1 | expandBits((unsigned)q.z);
+		}
+		std::sort(bodies.begin() + begin, bodies.begin() + end, [](const Body& a, const Body& b) {
+			return bodyOrder(a.code, a.idx, b.code, b.idx);
+		});
+	};
+
+	// Encode and sort chunks in parallel, then merge them pairwise
+	JobSystem::instance().parallelFor(nbodies, GRAVITY_CHUNK, encode);
+	for (int width = GRAVITY_CHUNK; width < nbodies; width *= 2) {
+		for (int begin = 0; begin + width < nbodies; begin += 2 * width) {
+			std::inplace_merge(bodies.begin() + begin, bodies.begin() + begin + width,
+				bodies.begin() + std::min(nbodies, begin + 2 * width), [](const Body& a, const Body& b) {
+				return bodyOrder(a.code, a.idx, b.code, b.idx);
+			});
+		}
+	}
+}
+
+void NBodyGravity::splitOctants(int begin, int end, int level, int bounds[9]) const {
+	int shift = 3 * (GRAVITY_MORTON_BITS - 1 - level);
+	bounds[0] = begin;
+	for (int oct = 1; oct <= 8; ++oct) {
+		bounds[oct] = std::partition_point(bodies.begin() + bounds[oct - 1], bodies.begin() + end, [shift, oct](const Body& b) {
+			return (int)((b.code >> shift) & 7) < oct;
+		}) - bodies.begin();
+	}
+}
+
+static Vec3f octantCenter(const Vec3f& center, float halfSize, int oct){
+	float q = halfSize * 0.5f;
+	return Vec3f(center.x + (oct & 4 ? q : -q), center.y + (oct & 2 ? q : -q), center.z + (oct & 1 ? q : -q));
+}
+
+int NBodyGravity::build(std::vector<Node>& out, int begin, int end, int level, const Vec3f& center, float halfSize) const {
+	int id = out.size();
+	out.push_back(Node());
+	out[id].center = center, out[id].halfSize = halfSize;
+	out[id].begin = begin, out[id].end = end;
+	out[id].leaf = end - begin <= leafSize || level == GRAVITY_MORTON_BITS;
+	for (int oct = 0; oct < 8; ++oct) out[id].child[oct] = -1;
+
+	float mass = 0;
+	Vec3f moment;
+	if (out[id].leaf) {
+		for (int b = begin; b < end; ++b) {
+			mass += bodies[b].m;
+			moment += bodies[b].m * bodies[b].pos;
+		}
+	} else {
+		int bounds[9];
+		splitOctants(begin, end, level, bounds);
+		for (int oct = 0; oct < 8; ++oct) {
+			if (bounds[oct] == bounds[oct + 1]) continue;
+			int c = build(out, bounds[oct], bounds[oct + 1], level + 1, octantCenter(center, halfSize, oct), halfSize * 0.5f);
+			out[id].child[oct] = c;
+			mass += out[c].mass;
+			moment += out[c].mass * out[c].com;
+		}
+	}
+	out[id].mass = mass;
+	out[id].com = mass > 0 ? moment / mass : center;
+	return id;
+}
+
+Vec3f NBodyGravity::accelerationAt(const Vec3f& p, int self) const {
+	Vec3f a;
+	float eps2 = softening * softening;
+	float theta2 = theta * theta;
+	// Depth is bounded by the Morton bits, and each level pushes at most 8 children
+	int stack[8 * (GRAVITY_MORTON_BITS + 1)];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		const Node& n = nodes[stack[--top]];
+		if (n.leaf) {
+			for (int b = n.begin; b < n.end; ++b) {
+				if (bodies[b].idx == self) continue;
+				Vec3f r = bodies[b].pos - p;
+				float d2 = r.normsq() + eps2;
+				a += (G * bodies[b].m / (d2 * sqrtf(d2))) * r;
+			}
+			continue;
+		}
+
+		Vec3f r = n.com - p;
+		float d2 = r.normsq();
+		float size = 2 * n.halfSize;
+		bool inside = fabsf(p.x - n.center.x) <= n.halfSize && fabsf(p.y - n.center.y) <= n.halfSize && fabsf(p.z - n.center.z) <= n.halfSize;
+		if (!inside && size * size < theta2 * d2) {
+			d2 += eps2;
+			a += (G * n.mass / (d2 * sqrtf(d2))) * r;
+		} else {
+			for (int oct = 0; oct < 8; ++oct)
+				if (n.child[oct] >= 0) stack[top++] = n.child[oct];
+		}
+	}
+	return a;
+}
+
+void NBodyGravity::evaluate(int begin, int end, std::vector<Vec3f>& accel) const {
+	for (int b = begin; b < end; ++b)
+		accel[bodies[b].idx] = accelerationAt(bodies[b].pos, bodies[b].idx);
+}
+
+void NBodyGravity::barnesHut(const SlotMap<std::unique_ptr<Sphere>>& spheres, std::vector<Vec3f>& accel){
+	accel.assign(spheres.size(), Vec3f());
+	sortBodies(spheres);
+	nodes.clear();
+	int n = bodies.size();
+	if (n == 0) return;
+
+	if (n <= GRAVITY_CHUNK || n <= leafSize) {
+		build(nodes, 0, n, 0, rootCenter, rootHalfSize);
+	} else {
+		// Build the eight top-level subtrees in parallel, then splice them under the root
+		int bounds[9];
+		splitOctants(0, n, 0, bounds);
+		std::vector<Node> subtrees[8];
+		JobSystem::instance().parallelFor(8, 1, [&](int oct, int) {
+			if (bounds[oct] != bounds[oct + 1])
+				build(subtrees[oct], bounds[oct], bounds[oct + 1], 1, octantCenter(rootCenter, rootHalfSize, oct), rootHalfSize * 0.5f);
+		});
+
+		Node root;
+		root.center = rootCenter, root.halfSize = rootHalfSize;
+		root.begin = 0, root.end = n;
+		root.leaf = false;
+		root.mass = 0;
+		Vec3f moment;
+		nodes.push_back(root);
+		for (int oct = 0; oct < 8; ++oct) {
+			nodes[0].child[oct] = -1;
+			if (subtrees[oct].empty()) continue;
+			int offset = nodes.size();
+			for (Node& node : subtrees[oct]) {
+				for (int c = 0; c < 8; ++c)
+					if (node.child[c] >= 0) node.child[c] += offset;
+				nodes.push_back(node);
+			}
+			nodes[0].child[oct] = offset;
+			nodes[0].mass += nodes[offset].mass;
+			moment += nodes[offset].mass * nodes[offset].com;
+		}
+		nodes[0].com = nodes[0].mass > 0 ? moment / nodes[0].mass : rootCenter;
+	}
+
+	JobSystem::instance().parallelFor(n, GRAVITY_CHUNK, [&](int begin, int end) { evaluate(begin, end, accel); });
+}
+
+void NBodyGravity::bruteForce(const SlotMap<std::unique_ptr<Sphere>>& spheres, std::vector<Vec3f>& accel) const {
+	int n = spheres.size();
+	accel.assign(n, Vec3f());
+	float eps2 = softening * softening;
+	for (int i = 0; i < n; ++i) {
+		const Sphere* s = spheres[i].get();
+		if (s == nullptr) continue;
+		Vec3f a;
+		for (int j = 0; j < n; ++j) {
+			const Sphere* o = spheres[j].get();
+			if (o == nullptr || j == i) continue;
+			Vec3f r = o->pos - s->pos;
+			float d2 = r.normsq() + eps2;
+			a += (G * o->m / (d2 * sqrtf(d2))) * r;
+		}
+		accel[i] = a;
+	}
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include "geometry.h"
+
+// Bodies per reduction chunk when accelerations are evaluated in parallel
+const int GRAVITY_CHUNK = 4096;
+// Bits of each axis in the Morton codes ordering the octree
+const int GRAVITY_MORTON_BITS = 21;
+
+/*
+   Mutual gravitation between spheres. The Barnes-Hut octree treats any cell that spans
+   less than theta radians from a body as a point mass at its center of mass, giving
+   O(n log n) instead of direct summation. theta = 0 is exact. Bodies are sorted by Morton
+   code so every octree cell is a contiguous range, the top-level subtrees are built in
+   parallel, and accelerations are evaluated in parallel in fixed chunks so results do not
+   depend on the thread count.
+*/
+class NBodyGravity {
+public:
+	NBodyGravity() : G(0.05f), theta(0.5f), softening(0.1f), leafSize(8), reference(false) {}
+
+	// Acceleration of every sphere, by storage index
+	void accelerations(const SlotMap<std::unique_ptr<Sphere>>& spheres, std::vector<Vec3f>& accel);
+	void barnesHut(const SlotMap<std::unique_ptr<Sphere>>& spheres, std::vector<Vec3f>& accel);
+	// Direct O(n^2) summation, for validating the tree
+	void bruteForce(const SlotMap<std::unique_ptr<Sphere>>& spheres, std::vector<Vec3f>& accel) const;
+
+	float G;
+	// Opening angle: larger is faster and less accurate
+	float theta;
+	// Plummer softening length, keeps close encounters finite
+	float softening;
+	int leafSize;
+	// Use bruteForce instead of the tree
+	bool reference;
+
+private:
+	struct Body {
+		unsigned long long code;
+		Vec3f pos;
+		float m;
+		int idx;
+	};
+
+	struct Node {
+		Vec3f com, center;
+		float mass, halfSize;
+		// Bodies covered, a contiguous range of the sorted bodies
+		int begin, end;
+		bool leaf;
+		int child[8];
+	};
+
+	void sortBodies(const SlotMap<std::unique_ptr<Sphere>>& spheres);
+	int build(std::vector<Node>& out, int begin, int end, int level, const Vec3f& center, float halfSize) const;
+	void splitOctants(int begin, int end, int level, int bounds[9]) const;
+	Vec3f accelerationAt(const Vec3f& p, int self) const;
+	void evaluate(int begin, int end, std::vector<Vec3f>& accel) const;
+
+	std::vector<Body> bodies;
+	std::vector<Node> nodes;
+	Vec3f rootCenter;
+	float rootHalfSize;
+};
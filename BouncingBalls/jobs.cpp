@@ -0,0 +1,210 @@
+#include "jobs.h"
+#include <string>
+#include <algorithm>
+#include <qelapsedtimer.h>
+#include "trace.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+// Index of the worker running on this thread, -1 outside the pool
+static thread_local int workerIndex = -1;
+
+JobSystem& JobSystem::instance(){
+	static JobSystem* jobs = new JobSystem();
+	return *jobs;
+}
+
+static void pinThread(std::thread& thread, int core){
+#ifdef _WIN32
+	SetThreadAffinityMask(thread.native_handle(), DWORD_PTR(1) << core);
+#else
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(core, &set);
+	pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#endif
+}
+
+void JobSystem::configure(int count, bool pin){
+	stop();
+	int cores = std::max((int)std::thread::hardware_concurrency(), 1);
+	if (count <= 0) count = cores - 1;
+
+	quit = false;
+	queues.clear();
+	for (int i = 0; i <= count; ++i)
+		queues.push_back(std::make_unique<Queue>());
+	for (int i = 0; i < count; ++i) {
+		threads.push_back(std::thread(&JobSystem::workerLoop, this, i));
+		if (pin) pinThread(threads.back(), (i + 1) % cores);
+	}
+	active = count;
+}
+
+void JobSystem::setActiveWorkers(int n){
+	QMutexLocker lock(&sleepLock);
+	active = std::min(std::max(n, 0), workers());
+	wake.wakeAll();
+}
+
+void JobSystem::stop(){
+	{
+		QMutexLocker lock(&sleepLock);
+		quit = true;
+		wake.wakeAll();
+	}
+	for (std::thread& t : threads)
+		t.join();
+	threads.clear();
+}
+
+void JobSystem::shutdown(){
+	stop();
+	active = 0;
+}
+
+int JobSystem::self() const {
+	return workerIndex >= 0 ? workerIndex : (int)queues.size() - 1;
+}
+
+void JobSystem::submit(std::function<void()> fn, JobCounter& counter){
+	counter.pending.fetch_add(1, std::memory_order_relaxed);
+	Queue& q = *queues[self()];
+	{
+		QMutexLocker lock(&q.lock);
+		q.jobs.push_back(Job{ std::move(fn), &counter, PerfScope::current() });
+	}
+	queued.fetch_add(1, std::memory_order_release);
+	if (active.load(std::memory_order_relaxed) > 0) {
+		// Taking the lock orders this with a worker deciding to sleep. Inactive workers
+		// ignore wakes, so one of them must not swallow the only one.
+		QMutexLocker lock(&sleepLock);
+		if (active < workers()) wake.wakeAll();
+		else wake.wakeOne();
+	}
+}
+
+bool JobSystem::pop(int me, Job& job){
+	if (queued.load(std::memory_order_acquire) == 0) return false;
+	int n = queues.size();
+	for (int k = 0; k < n; ++k) {
+		int i = (me + k) % n;
+		Queue& q = *queues[i];
+		QMutexLocker lock(&q.lock);
+		if (q.jobs.empty()) continue;
+		// Own jobs newest first for locality, stolen ones oldest first
+		if (k == 0) {
+			job = std::move(q.jobs.back());
+			q.jobs.pop_back();
+		} else {
+			job = std::move(q.jobs.front());
+			q.jobs.pop_front();
+		}
+		queued.fetch_sub(1, std::memory_order_relaxed);
+		return true;
+	}
+	return false;
+}
+
+static void execute(Job& job){
+	// Jobs of the phase already charged on this thread need no switch
+	if (PerfScope::enabled() && job.phase != PerfScope::current()) {
+		PerfScope scope(job.phase);
+		job.fn();
+	} else {
+		job.fn();
+	}
+	job.counter->pending.fetch_sub(1, std::memory_order_release);
+}
+
+void JobSystem::wait(JobCounter& counter){
+	int me = self();
+	while (counter.pending.load(std::memory_order_acquire) > 0) {
+		Job job;
+		if (pop(me, job)) execute(job);
+		else std::this_thread::yield();
+	}
+}
+
+void JobSystem::workerLoop(int index){
+	workerIndex = index;
+	Tracer::instance().setThreadName(("worker " + std::to_string(index)).c_str());
+	while (!quit) {
+		Job job;
+		bool idle = index >= active.load(std::memory_order_relaxed);
+		if (!idle && pop(index, job)) {
+			execute(job);
+			continue;
+		}
+		QMutexLocker lock(&sleepLock);
+		if (!quit && (index >= active || queued.load(std::memory_order_acquire) == 0))
+			wake.wait(&sleepLock);
+	}
+}
+
+void JobSystem::parallelFor(int n, int grain, const std::function<void(int, int)>& fn){
+	grain = std::max(grain, 1);
+	int nchunks = chunks(n, grain);
+	if (nchunks == 0) return;
+	if (nchunks == 1 || activeWorkers() == 0) {
+		for (int c = 0; c < nchunks; ++c)
+			fn(c * grain, std::min(n, (c + 1) * grain));
+		return;
+	}
+
+	JobCounter counter;
+	for (int c = 1; c < nchunks; ++c) {
+		int begin = c * grain, end = std::min(n, (c + 1) * grain);
+		submit([&fn, begin, end]() { fn(begin, end); }, counter);
+	}
+	fn(0, std::min(n, grain));
+	wait(counter);
+}
+
+int TaskGraph::add(const char* name, std::function<void()> fn, std::initializer_list<int> after){
+	int id = tasks.size();
+	tasks.push_back(std::make_unique<Task>());
+	Task& t = *tasks.back();
+	t.name = name;
+	t.fn = std::move(fn);
+	t.deps = after.size();
+	t.remaining = 0;
+	t.ns = 0;
+	for (int dep : after)
+		tasks[dep]->next.push_back(id);
+	return id;
+}
+
+void TaskGraph::launch(JobSystem& jobs, int id, JobCounter& done){
+	jobs.submit([this, &jobs, id, &done]() {
+		Task& t = *tasks[id];
+		{
+			TraceScope scope(t.name);
+			PerfScope perf(&t.perf);
+			QElapsedTimer timer;
+			timer.start();
+			t.fn();
+			t.ns = timer.nsecsElapsed();
+		}
+		// Dependents are submitted before this job counts as done, so `done` never drains early
+		for (int n : t.next)
+			if (tasks[n]->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				launch(jobs, n, done);
+	}, done);
+}
+
+void TaskGraph::run(JobSystem& jobs){
+	bool perf = PerfScope::enabled();
+	for (auto& t : tasks) {
+		t->remaining.store(t->deps, std::memory_order_relaxed);
+		if (perf) t->perf.clear();
+	}
+	JobCounter done;
+	int n = tasks.size();
+	for (int id = 0; id < n; ++id)
+		if (tasks[id]->deps == 0) launch(jobs, id, done);
+	jobs.wait(done);
+}
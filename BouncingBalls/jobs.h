@@ -0,0 +1,114 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <initializer_list>
+#include <qmutex.h>
+#include <qwaitcondition.h>
+#include "perfcounters.h"
+
+// Counts jobs still running; whoever waits on it helps run queued jobs meanwhile
+struct JobCounter {
+	JobCounter() : pending(0) {}
+	std::atomic<int> pending;
+};
+
+struct Job {
+	std::function<void()> fn;
+	JobCounter* counter;
+	// Phase of the submitter, charged with the job's hardware counters
+	PerfPhase* phase;
+};
+
+/*
+   Persistent worker pool shared by all engine work. Every worker owns a deque: it pushes
+   and pops its own jobs at the back and steals from the front of the others. Threads
+   outside the pool submit to a shared queue and help while they wait, so nested waits
+   (a job running a parallel loop) never deadlock.
+*/
+class JobSystem {
+public:
+	// Never destroyed, so that no thread still running at exit submits to a dead pool
+	static JobSystem& instance();
+
+	// Stops the workers for good. Called on the way out, after every engine has stopped;
+	// anything submitted later runs on the thread that waits for it.
+	void shutdown();
+
+	// Restarts the pool with `threads` workers, 0 for one per core besides the caller.
+	// With pin, worker i is bound to core i + 1, leaving core 0 to the caller.
+	void configure(int threads, bool pin);
+	int workers() const { return (int)threads.size(); }
+	// Lets only the first n workers take jobs, the rest sleep. Cheaper than configure and
+	// safe while jobs run; chunking and therefore results are unaffected.
+	void setActiveWorkers(int n);
+	int activeWorkers() const { return active.load(std::memory_order_relaxed); }
+
+	void submit(std::function<void()> fn, JobCounter& counter);
+	void wait(JobCounter& counter);
+
+	// Number of chunks parallelFor splits n items into
+	static int chunks(int n, int grain) { return n > 0 ? (n + grain - 1) / grain : 0; }
+	// Runs fn(begin, end) for every chunk of `grain` items in [0, n) and returns when all are
+	// done. Chunk boundaries depend only on n and grain, so per-chunk results combined in
+	// chunk order do not depend on the thread count.
+	void parallelFor(int n, int grain, const std::function<void(int, int)>& fn);
+
+private:
+	JobSystem() : queued(0), active(0), quit(false) { configure(0, false); }
+
+	struct Queue {
+		QMutex lock;
+		std::deque<Job> jobs;
+	};
+
+	void stop();
+	void workerLoop(int index);
+	bool pop(int self, Job& job);
+	int self() const;
+
+	// One per worker, plus the shared queue of outside threads at the end
+	std::vector<std::unique_ptr<Queue>> queues;
+	std::vector<std::thread> threads;
+	std::atomic<int> queued;
+	std::atomic<int> active;
+	std::atomic<bool> quit;
+	QMutex sleepLock;
+	QWaitCondition wake;
+};
+
+/*
+   Tasks with dependencies, run on a JobSystem. Each task starts as soon as all the tasks
+   it was added after have finished; independent tasks run concurrently. The graph is
+   built once and can be run any number of times.
+*/
+class TaskGraph {
+public:
+	// Returns the task's id, for use in later `after` lists. name must be a string literal.
+	int add(const char* name, std::function<void()> fn, std::initializer_list<int> after = {});
+	void run(JobSystem& jobs);
+	int size() const { return tasks.size(); }
+	const char* name(int id) const { return tasks[id]->name; }
+	// Wall time the task took in the last run
+	long long elapsedNs(int id) const { return tasks[id]->ns; }
+	// Hardware counters of the task and its parallel loops in the last run, see PerfScope
+	PerfCounts perfCounts(int id) const { return tasks[id]->perf.load(); }
+
+private:
+	struct Task {
+		const char* name;
+		std::function<void()> fn;
+		std::vector<int> next;
+		int deps;
+		std::atomic<int> remaining;
+		long long ns;
+		PerfPhase perf;
+	};
+
+	void launch(JobSystem& jobs, int id, JobCounter& done);
+
+	std::vector<std::unique_ptr<Task>> tasks;
+};
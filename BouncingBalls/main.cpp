@@ -1,10 +1,179 @@
 #include "bouncingballs.h"
+#include "capture.h"
+#include "jobs.h"
+#include "statestream.h"
+#include "viewer.h"
+#include "glsimulation.h"
+#include "spawner.h"
 #include <QtWidgets/QApplication>
+#include <QCommandLineParser>
+#include <qtimer.h>
+#include <string.h>
+#include <csignal>
+#include <memory>
+#include <algorithm>
+
+// Set from SIGINT/SIGTERM, the server's event loop polls it since a handler may not call into Qt
+static volatile std::sig_atomic_t stopRequested = 0;
+
+static void requestStop(int){
+	stopRequested = 1;
+}
+
+// Runs the simulation without a window, publishing every step for viewers to attach to
+static int serve(QCoreApplication& app, const QString& name, bool delta, int balls, unsigned seed, bool autotune, float budgetMs,
+	int fps, const StepPacer& pacer){
+	StateStreamWriter stream(name, STREAM_MAX_SPHERES, delta);
+	if (!stream.open()) {
+		qCritical() << "Stream:" << stream.errorString();
+		return 1;
+	}
+
+	Scene world;
+	world.planes.push_back(std::make_unique<Plane>(Plane(Vec3f(-30, 0, 30), Vec3f(30, 0, 30), Vec3f(30, 0, -30), Vec3f(-30, 0, -30), Vec3f(0.5, 0.7, 0.5))));
+	GLSimulation::setWalls(world, true);
+	world.killVolumes.push_back(KillVolume(Vec3f(-1e4f, -1e4f, -1e4f), Vec3f(1e4f, -20, 1e4f)));
+
+	PhysicsEngine engine(world, fps);
+	engine.stream = &stream;
+	engine.autotune = autotune;
+	engine.stepBudgetMs = budgetMs;
+	engine.pacer.spinNs = pacer.spinNs;
+	engine.pacer.realtimePriority = pacer.realtimePriority;
+	engine.pacer.core = pacer.core;
+	BulkSpawner spawner(seed);
+	engine.addSpheres(spawner.spawn(Vec3f(-25, 1, -25), Vec3f(25, 12, 25), balls, SpawnParams(), nullptr));
+	engine.flip();
+	engine.start();
+	qInfo() << "Serving" << balls << "balls on stream" << name;
+
+	// Ctrl+C or a kill ends the event loop, so the engine is stopped and the summary printed
+	std::signal(SIGINT, requestStop);
+	std::signal(SIGTERM, requestStop);
+	QTimer stopPoll;
+	QObject::connect(&stopPoll, &QTimer::timeout, [&app]() {
+		if (stopRequested) app.quit();
+	});
+	stopPoll.start(100);
+	int code = app.exec();
+	engine.stop();
+	if (PerfScope::enabled())
+		qInfo().noquote() << QString::fromStdString(engine.metrics.phaseSummary());
+	return code;
+}
+
+// Runs whichever mode the options select, with every engine stopped by the time it returns
+static int run(QCoreApplication& a, QCommandLineParser& parser){
+	parser.addHelpOption();
+	QCommandLineOption captureOption("capture", "Render offscreen and encode a video to <file> instead of opening a window.", "file");
+	QCommandLineOption encoderOption("encoder", "Encoder program fed raw frames on stdin (default ffmpeg).", "program", "ffmpeg");
+	QCommandLineOption sizeOption("size", "Capture resolution (default 1280x720).", "WxH", "1280x720");
+	QCommandLineOption fpsOption("capture-fps", "Frames per simulated second (default 30).", "fps", "30");
+	QCommandLineOption stepsOption("steps-per-frame", "Physics steps between captured frames (default 10).", "steps", "10");
+	QCommandLineOption durationOption("duration", "Simulated seconds to capture (default 10).", "seconds", "10");
+	QCommandLineOption ballsOption("balls", "Balls spawned for the capture or server (default 2000).", "count", "2000");
+	QCommandLineOption seedOption("seed", "Spawn seed for the capture or server (default 1).", "seed", "1");
+	QCommandLineOption softwareOption("software-gl", "Use the software OpenGL implementation.");
+	QCommandLineOption threadsOption("threads", "Worker threads for the engine (default one per core).", "count", "0");
+	QCommandLineOption pinOption("pin-threads", "Bind each worker thread to its own core.");
+	QCommandLineOption serveOption("serve", "Simulate without a window and publish every step to the shared-memory stream <name>.", "name");
+	QCommandLineOption viewOption("view", "Open a viewer of the shared-memory stream <name> instead of a simulation.", "name");
+	QCommandLineOption noDeltaOption("no-delta", "Publish every sphere in every frame of the stream.");
+	QCommandLineOption budgetOption("step-budget", "Wall time per step of the server; quality is lowered to stay within it.", "ms", "0");
+	QCommandLineOption rateOption("physics-fps", "Physics steps per second of the server (default 300).", "fps", "300");
+	QCommandLineOption spinOption("spin-us", "Spin this long before each physics deadline instead of sleeping.", "us", "0");
+	QCommandLineOption priorityOption("physics-priority", "Real-time priority of the server's physics thread (Linux SCHED_FIFO 1-99).", "priority", "0");
+	QCommandLineOption coreOption("physics-core", "Bind the server's physics thread to core <n>.", "n", "-1");
+	QCommandLineOption perfOption("perf-counters", "Count cycles, instructions, cache and branch misses per physics phase (Linux).");
+	QCommandLineOption autotuneOption("autotune", "Let the server pick grid, worker and batch settings from measured step times.");
+	parser.addOption(captureOption);
+	parser.addOption(encoderOption);
+	parser.addOption(sizeOption);
+	parser.addOption(fpsOption);
+	parser.addOption(stepsOption);
+	parser.addOption(durationOption);
+	parser.addOption(ballsOption);
+	parser.addOption(seedOption);
+	parser.addOption(softwareOption);
+	parser.addOption(threadsOption);
+	parser.addOption(pinOption);
+	parser.addOption(serveOption);
+	parser.addOption(viewOption);
+	parser.addOption(noDeltaOption);
+	parser.addOption(autotuneOption);
+	parser.addOption(budgetOption);
+	parser.addOption(rateOption);
+	parser.addOption(spinOption);
+	parser.addOption(priorityOption);
+	parser.addOption(coreOption);
+	parser.addOption(perfOption);
+	parser.process(a);
+
+	if (parser.isSet(threadsOption) || parser.isSet(pinOption))
+		JobSystem::instance().configure(parser.value(threadsOption).toInt(), parser.isSet(pinOption));
+	if (parser.isSet(perfOption) && !PerfScope::enable())
+		qWarning() << "Performance counters are not available";
+
+	if (parser.isSet(captureOption)) {
+		CaptureSettings settings;
+		settings.output = parser.value(captureOption);
+		settings.encoder = parser.value(encoderOption);
+		QStringList size = parser.value(sizeOption).split('x');
+		if (size.size() == 2)
+			settings.width = std::max(size[0].toInt(), 16), settings.height = std::max(size[1].toInt(), 16);
+		settings.fps = std::max(parser.value(fpsOption).toInt(), 1);
+		settings.stepsPerFrame = std::max(parser.value(stepsOption).toInt(), 1);
+		settings.duration = parser.value(durationOption).toDouble();
+		settings.balls = parser.value(ballsOption).toInt();
+		settings.seed = parser.value(seedOption).toUInt();
+
+		FrameCapture capture(settings);
+		if (!capture.run()) {
+			qCritical() << "Capture:" << capture.errorString();
+			return 1;
+		}
+		qInfo() << "Capture: wrote" << capture.framesWritten() << "frames";
+		if (PerfScope::enabled())
+			qInfo().noquote() << QString::fromStdString(capture.metrics().phaseSummary());
+		return 0;
+	}
+
+	if (parser.isSet(serveOption)) {
+		StepPacer pacer;
+		pacer.spinNs = parser.value(spinOption).toLongLong() * 1000;
+		pacer.realtimePriority = parser.value(priorityOption).toInt();
+		pacer.core = parser.value(coreOption).toInt();
+		return serve(a, parser.value(serveOption), !parser.isSet(noDeltaOption), parser.value(ballsOption).toInt(), parser.value(seedOption).toUInt(),
+			parser.isSet(autotuneOption), parser.value(budgetOption).toFloat(), std::max(parser.value(rateOption).toInt(), 1), pacer);
+	}
+
+	if (parser.isSet(viewOption)) {
+		StreamViewer viewer(parser.value(viewOption));
+		viewer.show();
+		return a.exec();
+	}
 
-int main(int argc, char *argv[])
-{
-	QApplication a(argc, argv);
 	BouncingBalls w;
 	w.show();
 	return a.exec();
 }
+
+int main(int argc, char *argv[])
+{
+	// The GL attribute and the kind of application have to be settled before the application object exists
+	bool serving = false, capturing = false;
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--software-gl") == 0)
+			QCoreApplication::setAttribute(Qt::AA_UseSoftwareOpenGL);
+		serving |= strcmp(argv[i], "--serve") == 0 || strncmp(argv[i], "--serve=", 8) == 0;
+		capturing |= strcmp(argv[i], "--capture") == 0 || strncmp(argv[i], "--capture=", 10) == 0;
+	}
+
+	// The server has no window, so it runs without a GUI application and starts headless
+	std::unique_ptr<QCoreApplication> a(serving && !capturing ? new QCoreApplication(argc, argv) : new QApplication(argc, argv));
+	QCommandLineParser parser;
+	int code = run(*a, parser);
+	// Every engine is gone by now, so nothing submits to the job pool anymore
+	JobSystem::instance().shutdown();
+	return code;
+}
@@ -0,0 +1,157 @@
+#include "metrics.h"
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+
+static const char* CONTACT_KIND_NAMES[CONTACT_KINDS] = { "sphere", "plane", "aabb", "capsule", "obb" };
+
+static void gauge(std::ostringstream& out, const char* name, const char* help, double value){
+	out << "# HELP " << name << " " << help << "\n";
+	out << "# TYPE " << name << " gauge\n";
+	out << name << " " << value << "\n";
+}
+
+std::string EngineMetrics::exposition() const {
+	std::ostringstream out;
+
+	out << "# HELP bouncingballs_step_seconds Wall time of one physics step.\n";
+	out << "# TYPE bouncingballs_step_seconds histogram\n";
+	unsigned long long cumulative = 0;
+	for (int i = 0; i < STEP_TIME_BUCKETS; ++i) {
+		cumulative += stepTime.counts[i].load(std::memory_order_relaxed);
+		out << "bouncingballs_step_seconds_bucket{le=\"";
+		if (i < STEP_TIME_BUCKETS - 1) out << STEP_TIME_BOUNDS[i];
+		else out << "+Inf";
+		out << "\"} " << cumulative << "\n";
+	}
+	out << "bouncingballs_step_seconds_sum " << stepTime.sumNs.load(std::memory_order_relaxed) / 1e9 << "\n";
+	out << "bouncingballs_step_seconds_count " << cumulative << "\n";
+
+	out << "# HELP bouncingballs_steps_total Physics steps taken.\n";
+	out << "# TYPE bouncingballs_steps_total counter\n";
+	out << "bouncingballs_steps_total " << steps.load(std::memory_order_relaxed) << "\n";
+
+	gauge(out, "bouncingballs_physics_fps", "Physics loop iterations in the last second.", physicsFps.load(std::memory_order_relaxed));
+	gauge(out, "bouncingballs_render_fps", "Frames rendered in the last second.", renderFps.load(std::memory_order_relaxed));
+	gauge(out, "bouncingballs_spheres", "Spheres in the scene.", spheres.load(std::memory_order_relaxed));
+	gauge(out, "bouncingballs_contacts", "Contacts resolved in the last step.", contacts.load(std::memory_order_relaxed));
+	gauge(out, "bouncingballs_edit_queue_depth", "Scene edits waiting for the physics thread.", editQueueDepth.load(std::memory_order_relaxed));
+	gauge(out, "bouncingballs_quality_level", "Quality level of budgeted stepping, 0 is full quality.", qualityLevel.load(std::memory_order_relaxed));
+
+	out << "# HELP bouncingballs_budget_overruns_total Steps that took longer than the step budget.\n";
+	out << "# TYPE bouncingballs_budget_overruns_total counter\n";
+	out << "bouncingballs_budget_overruns_total " << budgetOverruns.load(std::memory_order_relaxed) << "\n";
+
+	out << "# HELP bouncingballs_contact_events_total Contact events published to subscribers.\n";
+	out << "# TYPE bouncingballs_contact_events_total counter\n";
+	out << "bouncingballs_contact_events_total " << contactEvents.load(std::memory_order_relaxed) << "\n";
+
+	out << "# HELP bouncingballs_contact_events_dropped_total Contact events dropped because a subscriber fell behind.\n";
+	out << "# TYPE bouncingballs_contact_events_dropped_total counter\n";
+	out << "bouncingballs_contact_events_dropped_total " << contactEventsDropped.load(std::memory_order_relaxed) << "\n";
+
+	out << "# HELP bouncingballs_impacts_total Contacts above the impact impulse seen by the contact meter, by what was hit.\n";
+	out << "# TYPE bouncingballs_impacts_total counter\n";
+	for (int k = 0; k < CONTACT_KINDS; ++k)
+		out << "bouncingballs_impacts_total{kind=\"" << CONTACT_KIND_NAMES[k] << "\"} " << impacts[k].load(std::memory_order_relaxed) << "\n";
+
+	out << "# HELP bouncingballs_impact_impulse_total Summed impulse of those impacts.\n";
+	out << "# TYPE bouncingballs_impact_impulse_total counter\n";
+	out << "bouncingballs_impact_impulse_total " << impactImpulse.load(std::memory_order_relaxed) << "\n";
+
+	gauge(out, "bouncingballs_rewind_bytes", "Memory held by the rewind buffer.", (double)rewindBytes.load(std::memory_order_relaxed));
+
+	int nphases = phaseCount.load(std::memory_order_acquire);
+	if (nphases > 0) {
+		out << "# HELP bouncingballs_phase_seconds_total Wall time spent in each phase of the step.\n";
+		out << "# TYPE bouncingballs_phase_seconds_total counter\n";
+		for (int i = 0; i < nphases; ++i)
+			out << "bouncingballs_phase_seconds_total{phase=\"" << phases[i].name << "\"} " << phases[i].ns.load(std::memory_order_relaxed) / 1e9 << "\n";
+	}
+	if (nphases > 0 && perfCounters.load(std::memory_order_relaxed)) {
+		for (int e = 0; e < PERF_EVENTS; ++e) {
+			std::string name = std::string("bouncingballs_phase_") + PERF_EVENT_NAMES[e] + "_total";
+			out << "# HELP " << name << " Hardware " << PERF_EVENT_NAMES[e] << " counted in user space in each phase of the step.\n";
+			out << "# TYPE " << name << " counter\n";
+			for (int i = 0; i < nphases; ++i)
+				out << name << "{phase=\"" << phases[i].name << "\"} " << phases[i].counts[e].load(std::memory_order_relaxed) << "\n";
+		}
+	}
+	return out.str();
+}
+
+std::string EngineMetrics::phaseSummary() const {
+	std::ostringstream out;
+	int nphases = phaseCount.load(std::memory_order_acquire);
+	double n = std::max((double)steps.load(std::memory_order_relaxed), 1.0);
+	bool perf = perfCounters.load(std::memory_order_relaxed);
+	out << std::fixed << std::left << std::setw(14) << "phase" << std::right << std::setw(10) << "ms/step";
+	if (perf) out << std::setw(14) << "Mcycles/step" << std::setw(8) << "IPC" << std::setw(16) << "cache miss/step" << std::setw(17) << "branch miss/step";
+	out << "\n";
+	for (int i = 0; i < nphases; ++i) {
+		const PhaseMetrics& p = phases[i];
+		out << std::left << std::setw(14) << p.name << std::right << std::setprecision(3) << std::setw(10) << p.ns.load(std::memory_order_relaxed) / 1e6 / n;
+		if (perf) {
+			double cycles = (double)p.counts[PERF_CYCLES].load(std::memory_order_relaxed);
+			double instructions = (double)p.counts[PERF_INSTRUCTIONS].load(std::memory_order_relaxed);
+			out << std::setw(14) << cycles / 1e6 / n << std::setprecision(2) << std::setw(8) << (cycles > 0 ? instructions / cycles : 0.0)
+				<< std::setprecision(0) << std::setw(16) << p.counts[PERF_CACHE_MISSES].load(std::memory_order_relaxed) / n
+				<< std::setw(17) << p.counts[PERF_BRANCH_MISSES].load(std::memory_order_relaxed) / n;
+		}
+		out << "\n";
+	}
+	return out.str();
+}
+
+ContactMeter::ContactMeter(ContactEventStream& events, EngineMetrics& metrics, float minImpulse)
+	: events(events), metrics(metrics), stopping(false)
+{
+	subscription = events.subscribe(minImpulse);
+	thread = std::thread(&ContactMeter::run, this);
+}
+
+ContactMeter::~ContactMeter(){
+	stopping.store(true, std::memory_order_release);
+	thread.join();
+	events.unsubscribe(subscription);
+}
+
+void ContactMeter::run(){
+	unsigned long long counts[CONTACT_KINDS] = {};
+	double impulse = 0;
+	for (;;) {
+		// Checked before draining, so the last pass still takes everything published until now
+		bool last = stopping.load(std::memory_order_acquire);
+		subscription->drain([&](const ContactEvent& e) {
+			counts[e.kind]++;
+			impulse += e.impulse;
+		});
+		for (int k = 0; k < CONTACT_KINDS; ++k)
+			metrics.impacts[k].store(counts[k], std::memory_order_relaxed);
+		metrics.impactImpulse.store(impulse, std::memory_order_relaxed);
+		if (last) return;
+		std::this_thread::sleep_for(std::chrono::milliseconds(CONTACT_METER_INTERVAL_MS));
+	}
+}
+
+MetricsExporter::MetricsExporter(const EngineMetrics& metrics, const QString& path, int intervalMs)
+	: metrics(metrics), path(path)
+{
+	connect(&timer, &QTimer::timeout, this, &MetricsExporter::write);
+	timer.start(intervalMs);
+}
+
+void MetricsExporter::write(){
+	std::string text = metrics.exposition();
+	// QSaveFile writes to a temporary and renames on commit, so scrapers never see a partial file
+	QSaveFile file(path);
+	if (!file.open(QIODevice::WriteOnly)) {
+		#ifdef DEBUG
+		qDebug() << "Cannot write metrics file";
+		#endif
+		return;
+	}
+	file.write(text.data(), text.size());
+	file.commit();
+}
@@ -0,0 +1,128 @@
+#pragma once
+#include <atomic>
+#include <string>
+#include <memory>
+#include <thread>
+#include <qtimer.h>
+#include <qsavefile.h>
+#include <qdebug.h>
+#include "perfcounters.h"
+#include "events.h"
+
+const int STEP_TIME_BUCKETS = 10;
+// Upper bounds in seconds, the last bucket is +Inf
+const double STEP_TIME_BOUNDS[STEP_TIME_BUCKETS - 1] = {
+	0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05
+};
+
+// Fixed-bucket histogram updated with relaxed atomics only
+class StepTimeHistogram {
+public:
+	StepTimeHistogram() : sumNs(0) {
+		for (int i = 0; i < STEP_TIME_BUCKETS; ++i) counts[i] = 0;
+	}
+
+	void observe(long long ns) {
+		double sec = ns / 1e9;
+		int b = 0;
+		while (b < STEP_TIME_BUCKETS - 1 && sec > STEP_TIME_BOUNDS[b]) ++b;
+		counts[b].fetch_add(1, std::memory_order_relaxed);
+		sumNs.fetch_add(ns, std::memory_order_relaxed);
+	}
+
+	std::atomic<unsigned long long> counts[STEP_TIME_BUCKETS];
+	std::atomic<long long> sumNs;
+};
+
+const int MAX_PHASES = 16;
+
+// Totals of one phase of the step graph, hardware counters only while PerfScope is enabled
+struct PhaseMetrics {
+	PhaseMetrics() : name(nullptr), ns(0) {
+		for (int i = 0; i < PERF_EVENTS; ++i) counts[i] = 0;
+	}
+
+	const char* name;
+	std::atomic<long long> ns;
+	std::atomic<unsigned long long> counts[PERF_EVENTS];
+};
+
+/*
+   Engine telemetry. Writers (physics and GUI threads) only do relaxed atomic stores,
+   so nothing here ever takes a lock on the physics hot path.
+*/
+class EngineMetrics {
+public:
+	EngineMetrics() : steps(0), physicsFps(0), renderFps(0), spheres(0), contacts(0), editQueueDepth(0), qualityLevel(0), budgetOverruns(0), contactEvents(0), contactEventsDropped(0), impactImpulse(0), rewindBytes(0), phaseCount(0), perfCounters(false) {
+		for (int i = 0; i < CONTACT_KINDS; ++i) impacts[i] = 0;
+	}
+
+	// Prometheus text exposition format
+	std::string exposition() const;
+	// Per-step averages of every phase, as a table for logs
+	std::string phaseSummary() const;
+
+	StepTimeHistogram stepTime;
+	std::atomic<unsigned long long> steps;
+	std::atomic<int> physicsFps, renderFps;
+	std::atomic<int> spheres, contacts;
+	std::atomic<int> editQueueDepth;
+	// Budgeted stepping, see PhysicsEngine::stepBudgetMs
+	std::atomic<int> qualityLevel;
+	std::atomic<unsigned long long> budgetOverruns;
+	// Contact events published, and lost to subscribers that fell behind
+	std::atomic<unsigned long long> contactEvents, contactEventsDropped;
+	// Impacts counted by a ContactMeter by what the sphere hit, and their summed impulse
+	std::atomic<unsigned long long> impacts[CONTACT_KINDS];
+	std::atomic<double> impactImpulse;
+	// Memory held by the rewind buffer
+	std::atomic<unsigned long long> rewindBytes;
+	// Names are set before phaseCount first covers them
+	PhaseMetrics phases[MAX_PHASES];
+	std::atomic<int> phaseCount;
+	std::atomic<bool> perfCounters;
+};
+
+// Impulse of a contact that counts as an impact, a few times what a resting sphere of unit
+// mass gets every step
+const float IMPACT_MIN_IMPULSE = 3.0f;
+const int CONTACT_METER_INTERVAL_MS = 5;
+
+/*
+   Consumer of contact events on a thread of its own, the place where sound or effects would
+   hook in. Every few milliseconds it drains its subscription and counts the impacts into the
+   metrics. The physics thread never waits for it; if it falls behind, events are dropped
+   and counted as such.
+*/
+class ContactMeter {
+public:
+	ContactMeter(ContactEventStream& events, EngineMetrics& metrics, float minImpulse = IMPACT_MIN_IMPULSE);
+	// Drains what is left and unsubscribes
+	~ContactMeter();
+
+private:
+	void run();
+
+	ContactEventStream& events;
+	EngineMetrics& metrics;
+	std::shared_ptr<ContactSubscription> subscription;
+	std::atomic<bool> stopping;
+	std::thread thread;
+};
+
+/*
+   Periodically rewrites a textfile with the current metrics, for node_exporter's textfile
+   collector or anything else that scrapes files. The file is replaced atomically.
+*/
+class MetricsExporter : public QObject {
+	Q_OBJECT
+public:
+	MetricsExporter(const EngineMetrics& metrics, const QString& path, int intervalMs = 1000);
+
+	void write();
+
+private:
+	const EngineMetrics& metrics;
+	QString path;
+	QTimer timer;
+};
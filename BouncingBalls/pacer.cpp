@@ -0,0 +1,91 @@
+#include "pacer.h"
+#include <thread>
+#include <chrono>
+#include <qdebug.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+StepPacer::~StepPacer(){
+#ifdef _WIN32
+	if (timer != nullptr) CloseHandle(timer);
+#endif
+}
+
+long long StepPacer::now(){
+#ifdef _WIN32
+	static LARGE_INTEGER frequency = []() { LARGE_INTEGER f; QueryPerformanceFrequency(&f); return f; }();
+	LARGE_INTEGER t;
+	QueryPerformanceCounter(&t);
+	// Split to keep the multiplication from overflowing
+	return t.QuadPart / frequency.QuadPart * 1000000000LL + t.QuadPart % frequency.QuadPart * 1000000000LL / frequency.QuadPart;
+#else
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000LL + t.tv_nsec;
+#endif
+}
+
+bool StepPacer::setupThread(){
+	bool ok = true;
+#ifdef _WIN32
+	if (realtimePriority > 0 && !SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL)) ok = false;
+	if (core >= 0 && SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << core) == 0) ok = false;
+#else
+	if (realtimePriority > 0) {
+		sched_param param;
+		param.sched_priority = realtimePriority;
+		// Needs CAP_SYS_NICE or an rtprio limit
+		if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0) ok = false;
+	}
+	if (core >= 0) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(core, &set);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) ok = false;
+	}
+#endif
+#ifdef DEBUG
+	if (!ok) qDebug() << "Physics thread: real-time priority or pinning refused";
+#endif
+	return ok;
+}
+
+void StepPacer::sleepUntil(long long deadlineNs){
+#ifdef _WIN32
+	// Waitable timers take absolute times only on the wall clock, so wait for the
+	// remaining interval instead
+	if (timer == nullptr) timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+	long long remaining = deadlineNs - now();
+	if (remaining <= 0) return;
+	if (timer == NULL) {
+		std::this_thread::sleep_for(std::chrono::nanoseconds(remaining));
+		return;
+	}
+	LARGE_INTEGER due;
+	due.QuadPart = -(remaining / 100);
+	if (SetWaitableTimer(timer, &due, 0, NULL, NULL, FALSE)) WaitForSingleObject(timer, INFINITE);
+#else
+	timespec t;
+	t.tv_sec = deadlineNs / 1000000000LL;
+	t.tv_nsec = deadlineNs % 1000000000LL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, nullptr) == EINTR) {}
+#endif
+}
+
+void StepPacer::waitUntil(long long deadlineNs){
+	if (deadlineNs - spinNs > now()) sleepUntil(deadlineNs - spinNs);
+	while (now() < deadlineNs) {
+		// Runnable threads on this core still get to run meanwhile
+		std::this_thread::yield();
+	}
+}
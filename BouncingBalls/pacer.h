@@ -0,0 +1,36 @@
+#pragma once
+
+/*
+   Paces a loop against absolute deadlines on the monotonic clock, so wake-up error never
+   accumulates from one period to the next. The thread sleeps until spinNs before the
+   deadline (clock_nanosleep on Linux, a high-resolution waitable timer on Windows) and
+   spins the rest of the way, trading some CPU for microsecond jitter.
+*/
+class StepPacer {
+public:
+	StepPacer() : spinNs(0), realtimePriority(0), core(-1), timer(nullptr) {}
+	~StepPacer();
+
+	// Nanoseconds on the monotonic clock
+	static long long now();
+
+	// Applies the priority and pinning below to the calling thread. Returns false if the
+	// system refused any of it; the thread then runs as before.
+	bool setupThread();
+	// Returns at the deadline, or right away if it passed
+	void waitUntil(long long deadlineNs);
+
+	// Spin-wait before each deadline, 0 to only sleep
+	long long spinNs;
+	// SCHED_FIFO priority (1-99) on Linux, time-critical priority on Windows; 0 leaves the
+	// thread's scheduling alone
+	int realtimePriority;
+	// Core to bind the thread to, -1 for any
+	int core;
+
+private:
+	void sleepUntil(long long deadlineNs);
+
+	// Waitable timer of the paced thread on Windows
+	void* timer;
+};
@@ -0,0 +1,112 @@
+#include "perfcounters.h"
+#ifdef __linux__
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+std::atomic<bool> PerfScope::on(false);
+
+// Counters of one thread and the scope charging them
+struct ThreadCounters {
+	ThreadCounters() : tried(false), nopen(0), phase(nullptr) {
+		for (int i = 0; i < PERF_EVENTS; ++i) fds[i] = -1, slot[i] = -1;
+	}
+	~ThreadCounters() {
+#ifdef __linux__
+		for (int i = 0; i < PERF_EVENTS; ++i)
+			if (fds[i] >= 0) close(fds[i]);
+#endif
+	}
+
+	bool open();
+	// Leaves out as it was if the counters cannot be read
+	void sample(PerfCounts& out);
+
+	int fds[PERF_EVENTS];
+	// Position of each event in a group read, -1 if it could not be opened
+	int slot[PERF_EVENTS];
+	bool tried;
+	int nopen;
+	PerfPhase* phase;
+	PerfCounts mark;
+};
+
+static thread_local ThreadCounters local;
+
+bool ThreadCounters::open(){
+	if (tried) return nopen > 0;
+	tried = true;
+#ifdef __linux__
+	static const unsigned long long configs[PERF_EVENTS] = {
+		PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+	};
+	// One group led by cycles, so a single read returns all of them at the same instant.
+	// User space only, which perf_event_paranoid 2 still allows for one's own threads.
+	for (int i = 0; i < PERF_EVENTS; ++i) {
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = configs[i];
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP;
+		int fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, fds[PERF_CYCLES], PERF_FLAG_FD_CLOEXEC);
+		if (fd < 0) {
+			// Without the leader there is no group
+			if (i == PERF_CYCLES) return false;
+			continue;
+		}
+		fds[i] = fd;
+		slot[i] = nopen++;
+	}
+#endif
+	return nopen > 0;
+}
+
+void ThreadCounters::sample(PerfCounts& out){
+#ifdef __linux__
+	if (!open()) return;
+	unsigned long long buf[1 + PERF_EVENTS];
+	if (read(fds[PERF_CYCLES], buf, sizeof(buf)) < (ssize_t)((1 + nopen) * sizeof(buf[0]))) return;
+	for (int i = 0; i < PERF_EVENTS; ++i)
+		if (slot[i] >= 0) out.v[i] = buf[1 + slot[i]];
+#else
+	(void)out;
+#endif
+}
+
+PerfScope::PerfScope(PerfPhase* phase) : active(enabled()), prev(nullptr) {
+	if (!active) return;
+	PerfCounts now = local.mark;
+	local.sample(now);
+	if (local.phase != nullptr) local.phase->add(local.mark, now);
+	prev = local.phase;
+	local.phase = phase;
+	local.mark = now;
+}
+
+PerfScope::~PerfScope(){
+	if (!active) return;
+	PerfCounts now = local.mark;
+	local.sample(now);
+	if (local.phase != nullptr) local.phase->add(local.mark, now);
+	local.phase = prev;
+	local.mark = now;
+}
+
+PerfPhase* PerfScope::current(){
+	return enabled() ? local.phase : nullptr;
+}
+
+bool PerfScope::enable(){
+	if (!local.open()) return false;
+	on.store(true, std::memory_order_relaxed);
+	return true;
+}
+
+void PerfScope::disable(){
+	on.store(false, std::memory_order_relaxed);
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <atomic>
+
+enum PerfEvent { PERF_CYCLES, PERF_INSTRUCTIONS, PERF_CACHE_MISSES, PERF_BRANCH_MISSES, PERF_EVENTS };
+const char* const PERF_EVENT_NAMES[PERF_EVENTS] = { "cycles", "instructions", "cache_misses", "branch_misses" };
+
+// Hardware event counts, user space only
+struct PerfCounts {
+	PerfCounts() { clear(); }
+
+	void clear() { for (int i = 0; i < PERF_EVENTS; ++i) v[i] = 0; }
+
+	unsigned long long v[PERF_EVENTS];
+};
+
+// Counts gathered for one phase; threads running its jobs add to it concurrently
+struct PerfPhase {
+	PerfPhase() { clear(); }
+
+	void clear() { for (int i = 0; i < PERF_EVENTS; ++i) counts[i].store(0, std::memory_order_relaxed); }
+	void add(const PerfCounts& from, const PerfCounts& to) {
+		for (int i = 0; i < PERF_EVENTS; ++i)
+			counts[i].fetch_add(to.v[i] - from.v[i], std::memory_order_relaxed);
+	}
+	PerfCounts load() const {
+		PerfCounts c;
+		for (int i = 0; i < PERF_EVENTS; ++i) c.v[i] = counts[i].load(std::memory_order_relaxed);
+		return c;
+	}
+
+	std::atomic<unsigned long long> counts[PERF_EVENTS];
+};
+
+/*
+   Attributes hardware counters (perf_event_open on Linux, nothing elsewhere) to the phase
+   running on each thread. A scope charges the events of its thread to its phase until it
+   ends, pausing the enclosing scope meanwhile, so a thread that runs another phase's job
+   while it waits does not mix the two. Every thread opens its own counters the first time
+   it enters a scope. While disabled, a scope costs one relaxed load.
+*/
+class PerfScope {
+public:
+	explicit PerfScope(PerfPhase* phase);
+	~PerfScope();
+
+	// Phase of the innermost scope on this thread, nullptr outside or while disabled
+	static PerfPhase* current();
+
+	// Returns false if the calling thread cannot open the counters; they stay off then
+	static bool enable();
+	static void disable();
+	static bool enabled() { return on.load(std::memory_order_relaxed); }
+
+private:
+	static std::atomic<bool> on;
+
+	bool active;
+	PerfPhase* prev;
+};
@@ -1,18 +1,34 @@
 #include "physics.h"
+#include "collision.h"
+#include "statestream.h"
+#include <algorithm>
 
 PhysicsEngine::PhysicsEngine(Scene& scene, int fps)
-	: scene(scene), running(false), stepping(false), terminate(false), dt(0), frames(0), fps(fps)
+	: scene(scene), running(false), stepping(false), terminate(false), frames(0), fps(fps),
+	steps(0), simTime(0), deterministic(false), lastStateHash(0), multiRate(false), coarseDivisor(4), slowSpeed(0.5f), farDistance(10.0f),
+	diagnostics(false), diagnosticsInterval(1), nbody(false), solverIterations(1), stepBudgetMs(0), qualityLevel(QUALITY_FULL),
+	stream(nullptr), autotune(false), stepDt(0), stepIterations(1), stepDivisor(1), stepMultiRate(false), stepDeferFar(false),
+	budgetAvgNs(0), budgetCooldown(0), budgetCalm(0), accelFresh(false), stepHash(0), currentGrid(0), indexDirty(true),
+	sinceReorder(0), tuned(false), currentRender(0), hasRoi(false)
 {
+	tuning.cellScale = 1;
+	tuning.workers = -1;
+	tuning.integrateGrain = INTEGRATE_GRAIN;
+	tuning.narrowphaseGrain = NARROWPHASE_GRAIN;
+	tuning.reorderInterval = 0;
+	scene.contactEvents = &contactEvents;
+
 	fpsTimer.setTimerType(Qt::PreciseTimer);
 	connect(&fpsTimer, &QTimer::timeout, this, &PhysicsEngine::frame_tick);
 	fpsTimer.start(1000);
-	deltaTimer.start();
+	buildStepGraph();
 }
 
 bool PhysicsEngine::stop(){
 	// Enable step mode so we know when physics loop exits
 	running = false;
 	stepping = true;
+	wake();
 	for (int i = 0; i < 10; ++i) {
 		thread()->msleep(10);
 		if (!stepping) { return true; }
@@ -21,26 +37,529 @@ bool PhysicsEngine::stop(){
 }
 
 void PhysicsEngine::run(){
+	Tracer::instance().setThreadName("physics");
+	pacer.setupThread();
+	long long last = StepPacer::now(), deadline = last;
 	while (!terminate) {
-		if (running || stepping) {
-			double elapsedSec;
-			if (stepping) elapsedSec = 1.0f / fps;
-			else elapsedSec = dt / 1000.0f;
-
-			int nspheres = scene.spheres.size();
-			for (int i = 0; i < nspheres; i++) {
-				if (scene.spheres[i] != nullptr) {
-					scene.spheres[i]->update(elapsedSec);
-					scene.spheres[i]->collide(scene, i);
-				}
+		applyEdits();
+		if (!running && !stepping) {
+			if (indexDirty) {
+				nextGrid();
+				publishGrid();
+				publishRenderState();
 			}
-			if (stepping) stepping ^= 1;
+			waitForWork();
+			// Paused time is not simulated, pacing starts over from here
+			last = deadline = StepPacer::now();
+			continue;
 		}
-		dt = deltaTimer.restart();
-		int mpf = 1000.0f / fps;
-		if (dt > 500) dt = mpf;
-		int rem = dt % mpf;
-		thread()->msleep(mpf - rem);
+
+		long long period = 1000000000LL / std::max(fps, 1);
+		long long now = StepPacer::now();
+		double elapsedSec;
+		if (stepping || deterministic) elapsedSec = 1.0 / fps;
+		else elapsedSec = (now - last) / 1e9;
+		// After a stall, e.g. in a debugger, take one regular step instead of a huge one
+		if (elapsedSec > 0.5) elapsedSec = 1.0 / fps;
+		// A budgeted session lets simulated time fall behind rather than take huge steps
+		if (stepBudgetMs > 0) elapsedSec = std::min(elapsedSec, 2.0 / fps);
+		last = now;
+
+		stepScene(elapsedSec);
+		if (stepping) stepping ^= 1;
 		frames++;
+
+		// Missed deadlines are skipped, bursts of late steps would only stutter more
+		deadline += period;
+		now = StepPacer::now();
+		if (deadline < now) deadline = now - (now - deadline) % period + period;
+		pacer.waitUntil(deadline);
+	}
+}
+
+void PhysicsEngine::wake(){
+	QMutexLocker lock(&wakeLock);
+	wakeCondition.wakeAll();
+}
+
+void PhysicsEngine::waitForWork(){
+	QMutexLocker lock(&wakeLock);
+	while (!terminate && !running && !stepping && pendingEdits() == 0)
+		wakeCondition.wait(&wakeLock);
+}
+
+void PhysicsEngine::advance(double dt){
+	applyEdits();
+	stepScene(dt);
+}
+
+void PhysicsEngine::buildStepGraph(){
+	int gravityTask = stepGraph.add("gravity", [this]() {
+		if (nbody) applyGravity(stepDt);
+	});
+	integrateTask = stepGraph.add("integrate", [this]() { integrate(stepDt); }, { gravityTask });
+	broadphaseTask = stepGraph.add("broadphase", [this]() {
+		scene.broadphase = nextGrid();
+		applyImpulses();
+	}, { integrateTask });
+	narrowphaseTask = stepGraph.add("narrowphase", [this]() { narrowphase(); }, { broadphaseTask });
+	solveTask = stepGraph.add("solve", [this]() {
+		solve();
+		scene.broadphase = nullptr;
+		steps++;
+		simTime += stepDt;
+	}, { narrowphaseTask });
+
+	// Everything below only reads the solved state and runs concurrently
+	stepGraph.add("publish", [this]() { publishGrid(); }, { solveTask });
+	stepGraph.add("snapshot", [this]() { publishRenderState(); }, { solveTask });
+	int hashTask = stepGraph.add("hash", [this]() {
+		stepHash = deterministic ? hashState(scene.spheres) : 0;
+		if (deterministic) lastStateHash.store(stepHash, std::memory_order_relaxed);
+	}, { solveTask });
+	stepGraph.add("diagnostics", [this]() {
+		if (!diagnostics || steps % std::max(diagnosticsInterval, 1) != 0) return;
+		StepDiagnostics d = reduceDiagnostics(scene.spheres, scene.contacts, stepDt);
+		d.step = steps;
+		d.time = simTime;
+		d.stateHash = stepHash;
+		diagnosticsSeries.push(d);
+	}, { hashTask });
+}
+
+void PhysicsEngine::stepScene(double dt){
+	TRACE_SCOPE("step");
+	QElapsedTimer stepTimer;
+	stepTimer.start();
+	long long reorderNs = 0;
+	if (tuning.reorderInterval > 0 && ++sinceReorder >= tuning.reorderInterval) {
+		sinceReorder = 0;
+		reorderSpheres();
+		reorderNs = stepTimer.nsecsElapsed();
+	}
+	if (!scene.emitters.empty() || !scene.killVolumes.empty()) {
+		TRACE_SCOPE("emit");
+		QMutexLocker lock(&scene.structureLock);
+		cycleSpheres(scene, dt);
+		indexDirty = true;
+		accelFresh = false;
+	}
+	scene.contacts.clear();
+	scene.orderedContacts = deterministic;
+	contactEvents.beginStep(simTime, steps);
+	stepDt = dt;
+
+	int level = stepBudgetMs > 0 && !deterministic ? qualityLevel.load(std::memory_order_relaxed) : QUALITY_FULL;
+	stepIterations = level >= QUALITY_SINGLE_PASS ? 1 : std::max(solverIterations, 1);
+	int divisor = level >= QUALITY_COARSE_4 ? 4 : level >= QUALITY_COARSE_2 ? 2 : 1;
+	stepMultiRate = multiRate || divisor > 1;
+	stepDivisor = std::max(multiRate ? coarseDivisor : 1, divisor);
+	stepDeferFar = level >= QUALITY_DEFER_FAR;
+	stepGraph.run(JobSystem::instance());
+
+	if (rewind.enabled() && steps % std::max(rewind.interval, 1) == 0) {
+		TRACE_SCOPE("rewind");
+		rewind.record(scene, steps, simTime, sinceReorder);
+		metrics.rewindBytes.store(rewind.bytes(), std::memory_order_relaxed);
+	}
+
+	long long stepNs = stepTimer.nsecsElapsed();
+	recordPhases();
+	runTuner(stepNs, reorderNs);
+	adjustQuality(stepNs);
+	metrics.stepTime.observe(stepNs);
+	metrics.steps.store(steps, std::memory_order_relaxed);
+	metrics.spheres.store(scene.spheres.size(), std::memory_order_relaxed);
+	metrics.contacts.store(scene.contacts.count, std::memory_order_relaxed);
+	metrics.contactEvents.store(contactEvents.published.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	metrics.contactEventsDropped.store(contactEvents.dropped.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+void PhysicsEngine::recordPhases(){
+	int n = std::min(stepGraph.size(), MAX_PHASES);
+	bool perf = PerfScope::enabled();
+	if (metrics.phaseCount.load(std::memory_order_relaxed) < n) {
+		for (int i = 0; i < n; ++i)
+			metrics.phases[i].name = stepGraph.name(i);
+		metrics.phaseCount.store(n, std::memory_order_release);
+	}
+	for (int i = 0; i < n; ++i) {
+		PhaseMetrics& p = metrics.phases[i];
+		p.ns.fetch_add(stepGraph.elapsedNs(i), std::memory_order_relaxed);
+		if (!perf) continue;
+		PerfCounts c = stepGraph.perfCounts(i);
+		for (int e = 0; e < PERF_EVENTS; ++e)
+			p.counts[e].fetch_add(c.v[e], std::memory_order_relaxed);
+	}
+	metrics.perfCounters.store(perf, std::memory_order_relaxed);
+}
+
+void PhysicsEngine::narrowphase(){
+	int nspheres = scene.spheres.size();
+	int grain = std::max(tuning.narrowphaseGrain, 1);
+	int nchunks = JobSystem::chunks(nspheres, grain);
+	if ((int)contactChunks.size() < nchunks) contactChunks.resize(nchunks);
+	JobSystem::instance().parallelFor(nspheres, grain, [this, grain](int begin, int end) {
+		std::vector<SphereContact>& out = contactChunks[begin / grain];
+		out.clear();
+		for (int i = begin; i < end; i++) {
+			Sphere* s = scene.spheres[i].get();
+			if (s == nullptr || !s->active) continue;
+			s->findContacts(scene, i, out);
+		}
+	});
+}
+
+void PhysicsEngine::solve(){
+	// Responses touch both spheres of a pair, so they are applied in index order on one
+	// thread. This is the same order a sequential collide pass would use. That thread is
+	// also the only producer of contact events.
+	int nspheres = scene.spheres.size();
+	int grain = std::max(tuning.narrowphaseGrain, 1);
+	int nchunks = JobSystem::chunks(nspheres, grain);
+	for (int c = 0; c < nchunks; ++c) {
+		const std::vector<SphereContact>& pairs = contactChunks[c];
+		for (const SphereContact& pair : pairs) {
+			Sphere* s = scene.spheres[pair.idx].get();
+			if (s == nullptr || !s->active) continue;
+			Sphere* other = pair.other;
+			float j = s->collideSphere(other, scene, scene.contacts);
+			if (j < 0 || !contactEvents.wants(j)) continue;
+			ContactEvent e;
+			e.sphere = scene.spheres.handleAt(pair.idx), e.kind = CONTACT_SPHERE, e.other = scene.spheres.handleAt(pair.otherIdx), e.collider = -1;
+			e.impulse = j;
+			e.normal = s->pos - other->pos;
+			e.normal.normalize();
+			e.pos = s->pos - s->rad * e.normal;
+			contactEvents.publish(e);
+		}
+	}
+	// Once a sphere's own pairs are resolved, no later pair touches it while it is active,
+	// so its static contacts can wait until after all pairs without changing the result
+	staticBatch.prepare(scene);
+	collideStaticBatch(true);
+
+	// Further passes push apart what the previous one pushed into each other. Contacts
+	// are only counted once.
+	ContactStats again;
+	for (int pass = 1; pass < stepIterations; ++pass) {
+		for (int c = 0; c < nchunks; ++c) {
+			for (const SphereContact& pair : contactChunks[c]) {
+				Sphere* s = scene.spheres[pair.idx].get();
+				if (s != nullptr && s->active) s->collideSphere(pair.other, scene, again);
+			}
+		}
+		collideStaticBatch(false);
+	}
+
+	// Every other registered pair, after the spheres settled
+	collideShapes(scene);
+}
+
+void PhysicsEngine::collideStaticBatch(bool publish){
+	if (staticBatch.empty()) return;
+	int nspheres = scene.spheres.size();
+	int nchunks = JobSystem::chunks(nspheres, STATIC_GRAIN);
+	if ((int)staticContacts.size() < nchunks) staticContacts.resize(nchunks), staticEvents.resize(nchunks);
+	bool events = publish && contactEvents.listening();
+	JobSystem::instance().parallelFor(nspheres, STATIC_GRAIN, [this, events](int begin, int end) {
+		int c = begin / STATIC_GRAIN;
+		staticContacts[c].clear();
+		staticEvents[c].clear();
+		staticBatch.collide(scene, begin, end, staticContacts[c], events ? &staticEvents[c] : nullptr);
+	});
+	if (!publish) return;
+	for (int c = 0; c < nchunks; ++c) {
+		scene.contacts.merge(staticContacts[c]);
+		for (ContactEvent& e : staticEvents[c])
+			contactEvents.publish(e);
+	}
+}
+
+void PhysicsEngine::integrate(double dt){
+	bool roi;
+	Vec3f min, max;
+	{
+		QMutexLocker lock(&roiLock);
+		roi = hasRoi, min = roiMin, max = roiMax;
+	}
+
+	int divisor = stepDivisor > 1 ? stepDivisor : 1;
+	int nspheres = scene.spheres.size();
+	int nfields = scene.fields.size();
+	// Every sphere only touches itself here
+	JobSystem::instance().parallelFor(nspheres, tuning.integrateGrain, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			Sphere* s = scene.spheres[i].get();
+			if (s == nullptr) continue;
+
+			for (int f = 0; f < nfields; ++f) {
+				const ForceField& field = scene.fields[f];
+				if (field.contains(s->pos))
+					s->velocity += field.dv(s->pos, s->velocity, dt);
+			}
+
+			bool fullRate = !stepMultiRate || divisor == 1 || s->wake > 0;
+			if (!fullRate) {
+				// Squared distance from the sphere to the region, zero when inside
+				float dsq = 0;
+				if (roi) {
+					float dx = std::fmax(min.x - s->pos.x, std::fmax(0.0f, s->pos.x - max.x));
+					float dy = std::fmax(min.y - s->pos.y, std::fmax(0.0f, s->pos.y - max.y));
+					float dz = std::fmax(min.z - s->pos.z, std::fmax(0.0f, s->pos.z - max.z));
+					dsq = dx * dx + dy * dy + dz * dz;
+				}
+				bool inside = roi && dsq == 0;
+				bool near = dsq <= farDistance * farDistance;
+				bool fast = s->velocity.normsq() >= slowSpeed * slowSpeed;
+				fullRate = inside || (near && fast);
+			}
+
+			if (fullRate) {
+				s->catchUp(scene);
+				s->update(dt);
+				s->active = true;
+				if (s->wake > 0) s->wake--;
+			} else {
+				s->pendingSteps++;
+				s->pendingDt += dt;
+				// Stagger coarse spheres so each step does a similar amount of work
+				s->active = (steps + i) % divisor == 0;
+				if (s->active) s->catchUp(scene);
+			}
+		}
+	});
+	integrateShapes(scene, dt);
+}
+
+void PhysicsEngine::applyGravity(double dt){
+	// With deferred far-field work, accelerations are reused between refreshes
+	bool refresh = !stepDeferFar || !accelFresh || (int)accel.size() != scene.spheres.size() || steps % GRAVITY_DEFER_STEPS == 0;
+	if (refresh) {
+		float theta = gravity.theta;
+		if (stepDeferFar) gravity.theta = std::max(theta, GRAVITY_DEFER_THETA);
+		gravity.accelerations(scene.spheres, accel);
+		gravity.theta = theta;
+		accelFresh = true;
+	}
+	// Coarse-rate spheres pick the change up when they catch up
+	JobSystem::instance().parallelFor(scene.spheres.size(), tuning.integrateGrain, [this, dt](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			Sphere* s = scene.spheres[i].get();
+			if (s != nullptr) s->velocity += (float)dt * accel[i];
+		}
+	});
+}
+
+void PhysicsEngine::setRegionOfInterest(const Vec3f& min, const Vec3f& max){
+	QMutexLocker lock(&roiLock);
+	hasRoi = true, roiMin = min, roiMax = max;
+}
+
+void PhysicsEngine::clearRegionOfInterest(){
+	QMutexLocker lock(&roiLock);
+	hasRoi = false;
+}
+
+void PhysicsEngine::post(std::function<void(Scene&)> edit){
+	QMutexLocker lock(&editLock);
+	edits.push_back(std::move(edit));
+	metrics.editQueueDepth.store(edits.size(), std::memory_order_relaxed);
+	lock.unlock();
+	wake();
+}
+
+void PhysicsEngine::rewindBy(double seconds){
+	post([this, seconds](Scene& scene) {
+		unsigned long long step;
+		double time;
+		// The reorder phase goes back too, so storage is permuted on the same steps as before
+		if (!rewind.restore(scene, simTime - seconds, step, time, sinceReorder)) return;
+		steps = step;
+		simTime = time;
+		metrics.rewindBytes.store(rewind.bytes(), std::memory_order_relaxed);
+	});
+}
+
+void PhysicsEngine::addSpheres(std::vector<std::unique_ptr<Sphere>> batch, bool replace){
+	if (batch.empty() && !replace) return;
+	// std::function needs a copyable target
+	auto shared = std::make_shared<std::vector<std::unique_ptr<Sphere>>>(std::move(batch));
+	post([this, shared, replace](Scene& scene) {
+		if (replace) {
+			scene.spheres.clear();
+			// History of the spheres replaced is no use anymore
+			rewind.clear();
+		}
+		scene.spheres.reserve(scene.spheres.size() + shared->size());
+		for (auto& s : *shared)
+			scene.spheres.push_back(std::move(s));
+	});
+}
+
+void PhysicsEngine::blast(const AreaImpulse& impulse){
+	QMutexLocker lock(&editLock);
+	impulses.push_back(impulse);
+}
+
+void PhysicsEngine::applyImpulses(){
+	std::vector<AreaImpulse> pending;
+	{
+		QMutexLocker lock(&editLock);
+		if (impulses.empty()) return;
+		pending.swap(impulses);
+	}
+	TRACE_SCOPE("impulses");
+	for (const AreaImpulse& impulse : pending) {
+		impulseHits.clear();
+		scene.broadphase->overlapSphere(impulse.center, impulse.radius, impulseHits);
+		for (const SphereProxy& hit : impulseHits) {
+			Sphere* s = hit.sphere;
+			s->catchUp(scene);
+			Vec3f dir = s->pos - impulse.center;
+			float d = dir.norm();
+			if (d > 0) dir = dir / d;
+			else dir = Vec3f(0, 1, 0);
+			float falloff = std::fmax(1 - d / impulse.radius, 0.0f);
+			s->velocity += (impulse.strength * falloff / s->m) * dir;
+			// Blasted spheres move fast, keep them at full rate
+			s->wake = MULTIRATE_WAKE_STEPS;
+		}
+	}
+}
+
+int PhysicsEngine::pendingEdits(){
+	QMutexLocker lock(&editLock);
+	return edits.size();
+}
+
+void PhysicsEngine::applyEdits(){
+	{
+		// Only hold the lock for the swap, so posting never waits on a running edit
+		QMutexLocker lock(&editLock);
+		if (edits.empty()) return;
+		applying.swap(edits);
+		metrics.editQueueDepth.store(0, std::memory_order_relaxed);
+	}
+	TRACE_SCOPE("edits");
+	{
+		QMutexLocker lock(&scene.structureLock);
+		for (auto& edit : applying)
+			edit(scene);
+	}
+	applying.clear();
+	indexDirty = true;
+	accelFresh = false;
+}
+
+SpatialGrid* PhysicsEngine::nextGrid(){
+	indexDirty = false;
+	currentGrid ^= 1;
+	// Readers may still hold the grid from two steps ago
+	if (grids[currentGrid] == nullptr || grids[currentGrid].use_count() > 1)
+		grids[currentGrid] = std::make_shared<SpatialGrid>();
+	grids[currentGrid]->build(scene.spheres, tuning.cellScale);
+	return grids[currentGrid].get();
+}
+
+void PhysicsEngine::reorderSpheres(){
+	// Only while the last grid still matches storage, it is rebuilt from the new order anyway
+	const SpatialGrid* grid = grids[currentGrid].get();
+	if (grid == nullptr || indexDirty || grid->size() != scene.spheres.size()) return;
+	TRACE_SCOPE("reorder");
+	grid->localityOrder(reorder);
+	QMutexLocker lock(&scene.structureLock);
+	scene.spheres.permute(reorder);
+	indexDirty = true;
+	accelFresh = false;
+}
+
+void PhysicsEngine::adjustQuality(long long stepNs){
+	int level = qualityLevel.load(std::memory_order_relaxed);
+	// Quality follows wall time, which a deterministic run must not depend on
+	if (stepBudgetMs <= 0 || deterministic) {
+		if (level != QUALITY_FULL) qualityLevel = QUALITY_FULL;
+		metrics.qualityLevel.store(QUALITY_FULL, std::memory_order_relaxed);
+		budgetAvgNs = 0, budgetCooldown = 0, budgetCalm = 0;
+		return;
+	}
+
+	double budgetNs = stepBudgetMs * 1e6;
+	budgetAvgNs = budgetAvgNs > 0 ? 0.8 * budgetAvgNs + 0.2 * stepNs : stepNs;
+	if (stepNs > budgetNs) metrics.budgetOverruns.fetch_add(1, std::memory_order_relaxed);
+	if (budgetCooldown > 0) budgetCooldown--;
+
+	int next = level;
+	if (level < QUALITY_LEVELS - 1 && (stepNs > 2 * budgetNs || (budgetCooldown == 0 && budgetAvgNs > budgetNs))) {
+		// A spike drops a level right away so the next frames are on time
+		next = level + 1;
+	} else if (level > QUALITY_FULL && budgetAvgNs < BUDGET_RAISE_FRACTION * budgetNs) {
+		if (++budgetCalm >= BUDGET_RAISE_STEPS) next = level - 1;
+	} else {
+		budgetCalm = 0;
 	}
+
+	if (next != level) {
+		qualityLevel = next;
+		budgetCooldown = BUDGET_SETTLE_STEPS, budgetCalm = 0;
+#ifdef DEBUG
+		qDebug() << "Step budget" << stepBudgetMs << "ms, quality:" << QUALITY_NAMES[next];
+#endif
+	}
+	metrics.qualityLevel.store(next, std::memory_order_relaxed);
+}
+
+void PhysicsEngine::runTuner(long long stepNs, long long reorderNs){
+	// Tuned values depend on wall time, so a deterministic run keeps the settings it has
+	if (!autotune || deterministic) {
+		if (tuned) {
+			// A probe may have left the pool at another worker count than the one restored
+			int workers = tuning.workers;
+			tuner.abort(tuning);
+			if (tuning.workers != workers && tuning.workers >= 0)
+				JobSystem::instance().setActiveWorkers(tuning.workers);
+		}
+		tuned = false;
+		return;
+	}
+	if (!tuned) {
+		tuner.reset();
+		if (tuning.workers < 0) tuning.workers = JobSystem::instance().activeWorkers();
+		tuned = true;
+	}
+
+	StepTimings t;
+	t.total = stepNs;
+	t.reorder = reorderNs;
+	t.integrate = stepGraph.elapsedNs(integrateTask);
+	t.broadphase = stepGraph.elapsedNs(broadphaseTask);
+	t.narrowphase = stepGraph.elapsedNs(narrowphaseTask);
+	t.solve = stepGraph.elapsedNs(solveTask);
+	t.spheres = scene.spheres.size();
+	const SpatialGrid* grid = grids[currentGrid].get();
+	Vec3f extent = grid->boundsMax - grid->boundsMin;
+	float volume = (extent.x + grid->cellSize) * (extent.y + grid->cellSize) * (extent.z + grid->cellSize);
+	t.density = grid->size() > 0 ? grid->size() / volume : 0;
+
+	int workers = tuning.workers;
+	if (tuner.observe(t, tuning) && tuning.workers != workers && tuning.workers >= 0)
+		JobSystem::instance().setActiveWorkers(tuning.workers);
+}
+
+void PhysicsEngine::publishGrid(){
+	// Positions in the index are as of the broadphase pass of the last step
+	scene.publishIndex(grids[currentGrid]);
+}
+
+void PhysicsEngine::publishRenderState(){
+	currentRender = (currentRender + 1) % 3;
+	std::shared_ptr<RenderState>& state = renderStates[currentRender];
+	if (state == nullptr || state.use_count() > 1)
+		state = std::make_shared<RenderState>();
+	state->capture(scene);
+	state->step = steps;
+	state->simTime = simTime;
+	scene.publishRenderState(state);
+	// Other processes are sent the same copy the renderer gets
+	if (stream != nullptr) stream->publish(*state, scene);
 }
@@ -5,8 +5,49 @@
 #include <qdebug.h>
 #include <qelapsedtimer.h>
 #include <memory>
+#include <atomic>
+#include <functional>
+#include <qmutex.h>
+#include <qwaitcondition.h>
 #include "geometry.h"
+#include "spatial.h"
+#include "diagnostics.h"
+#include "metrics.h"
+#include "trace.h"
+#include "renderstate.h"
+#include "gravity.h"
+#include "jobs.h"
+#include "autotune.h"
+#include "pacer.h"
+#include "staticbatch.h"
+#include "rewind.h"
+#ifdef _WIN32
 #include "windows.h"
+#endif
+
+class StateStreamWriter;
+
+// Default spheres per parallel-for chunk in the integrate and narrowphase stages
+const int INTEGRATE_GRAIN = 2048;
+const int NARROWPHASE_GRAIN = 512;
+// Spheres per parallel chunk of the batched sphere-vs-static stage
+const int STATIC_GRAIN = 1024;
+
+/*
+   Quality levels of budgeted stepping, each giving up more than the one before:
+   one solver pass, slow and far spheres stepped every 2 then every 4 steps, and far-field
+   work deferred (n-body gravity refreshed every few steps with a wider opening angle).
+*/
+enum QualityLevel { QUALITY_FULL, QUALITY_SINGLE_PASS, QUALITY_COARSE_2, QUALITY_COARSE_4, QUALITY_DEFER_FAR, QUALITY_LEVELS };
+const char* const QUALITY_NAMES[QUALITY_LEVELS] = { "full", "single solver pass", "coarse steps x2", "coarse steps x4", "deferred far field" };
+// Steps to wait after a level change before judging the average again
+const int BUDGET_SETTLE_STEPS = 30;
+// Steps the average has to stay below this fraction of the budget to raise quality
+const float BUDGET_RAISE_FRACTION = 0.6f;
+const int BUDGET_RAISE_STEPS = 120;
+// Steps between n-body refreshes when far-field work is deferred
+const int GRAVITY_DEFER_STEPS = 4;
+const float GRAVITY_DEFER_THETA = 1.0f;
 
 class PhysicsEngine : public QThread {
 	Q_OBJECT
@@ -16,13 +57,36 @@ public:
 	PhysicsEngine(Scene& scene, int fps = 300);
 	~PhysicsEngine() { 
 		terminate = true;
-		// Ensure loop exits by waiting for a bit
-		thread()->msleep(100); 
+		wake();
+		wait();
+		scene.contactEvents = nullptr;
 	}
 
-	void flip() { running ^= 1; }
+	void flip() { running ^= 1; wake(); }
+
+	void step() { stepping = true; wake(); }
+
+	// Applies queued edits and steps once on the calling thread. Only for engines whose
+	// thread is not running, such as offscreen capture.
+	void advance(double dt);
 
-	void step() { stepping = true; }
+	// Queues an edit of the scene, applied on the physics thread between steps
+	void post(std::function<void(Scene&)> edit);
+	// Appends spheres to the scene without pausing the simulation. With replace, the
+	// spheres already there are removed in the same edit, and the rewind history with them.
+	void addSpheres(std::vector<std::unique_ptr<Sphere>> batch, bool replace = false);
+	int pendingEdits();
+	// Queues a one-shot impulse, applied to the spheres the broadphase finds in range
+	void blast(const AreaImpulse& impulse);
+
+	/*
+	   Multi-rate stepping. Spheres inside the region of interest always step at full rate.
+	   Outside it, spheres that are slow or further than farDistance from the region are
+	   integrated and collided only every coarseDivisor steps. Without a region, only the
+	   speed criterion applies.
+	*/
+	void setRegionOfInterest(const Vec3f& min, const Vec3f& max);
+	void clearRegionOfInterest();
 
 	/* 
 	   Waits for physics engine to finish current round before returning.
@@ -34,12 +98,157 @@ public:
 		#ifdef DEBUG
 		qDebug() << "Physics FPS: " << frames;
 		#endif
+		metrics.physicsFps.store(frames, std::memory_order_relaxed);
 		frames = 0;
 	}
 
 	QTimer fpsTimer;
-	QElapsedTimer deltaTimer;
 	Scene& scene;
-	int dt, fps, frames;
+	int fps, frames;
 	bool running, stepping, terminate;
+	unsigned long long steps;
+
+	double simTime;
+
+	/*
+	   Deterministic mode: fixed dt of 1 / fps instead of wall-clock time, sphere pairs
+	   resolved in index order, and a state hash after every step. Given the same scene
+	   and the same edits at the same steps, runs are bitwise identical.
+	*/
+	bool deterministic;
+	std::atomic<unsigned long long> lastStateHash;
+
+	bool multiRate;
+	int coarseDivisor;
+	float slowSpeed, farDistance;
+
+	// Optional per-step reductions, pushed every diagnosticsInterval steps
+	bool diagnostics;
+	int diagnosticsInterval;
+	DiagnosticsSeries diagnosticsSeries;
+
+	EngineMetrics metrics;
+
+	/*
+	   Sphere contacts resolved by the solver, for consumers such as audio, analytics or
+	   recording on their own threads. Subscribe with an impulse threshold and drain the
+	   subscription; the step never waits for a consumer that lags behind.
+	*/
+	ContactEventStream contactEvents;
+
+	// Mutual gravitation between spheres, on top of the global downward gravity
+	bool nbody;
+	NBodyGravity gravity;
+
+	// Passes over the sphere contacts of a step; more settle piles better
+	int solverIterations;
+
+	/*
+	   Budgeted stepping: with a wall-time budget per step, quality drops one level at a
+	   time while the average step runs over it, at once when a single step takes twice
+	   as long, and comes back once steps fit comfortably again. 0 disables it, and
+	   deterministic runs ignore it and always step at full quality.
+	*/
+	float stepBudgetMs;
+	// Level in use, see QualityLevel
+	std::atomic<int> qualityLevel;
+
+	/*
+	   Paces the physics thread at fps against absolute deadlines, see StepPacer. Missed
+	   deadlines are dropped rather than caught up in a burst. While paused the thread
+	   blocks until it is resumed, stepped, sent an edit or destroyed. Set before start.
+	*/
+	StepPacer pacer;
+
+	/*
+	   History of the session for scrubbing back, recorded every rewind.interval steps once
+	   it has a budget. rewindBy is queued like an edit: the scene goes back to the last
+	   frame at least that much simulated time ago, and the simulation goes on from there.
+	*/
+	RewindBuffer rewind;
+	void rewindBy(double seconds);
+
+	// Optional shared-memory publisher of every step's state, set before the engine starts
+	StateStreamWriter* stream;
+
+	// Speed-only settings, read between steps. With autotune, tuner owns them unless deterministic is set.
+	TuneSettings tuning;
+	bool autotune;
+	Autotuner tuner;
+
+private:
+	// Wakes the thread if it is blocked while paused
+	void wake();
+	void waitForWork();
+	void applyEdits();
+	/*
+	   One step is a task graph run on the shared job pool:
+	   gravity -> integrate -> broadphase -> narrowphase -> solve -> {publish, snapshot, hash -> diagnostics}
+	   Integrate and narrowphase are parallel loops over fixed chunks; solve is sequential
+	   in index order, so results do not depend on the worker count.
+	*/
+	void buildStepGraph();
+	void stepScene(double dt);
+	void narrowphase();
+	void solve();
+	// Every active sphere against the static colliders, in parallel chunks
+	void collideStaticBatch(bool publish);
+	void integrate(double dt);
+	void applyGravity(double dt);
+	void applyImpulses();
+	// Sorts sphere storage by the last grid, so neighbors in space are neighbors in memory
+	void reorderSpheres();
+	// Adds the phase times and hardware counters of the step to the metrics
+	void recordPhases();
+	void runTuner(long long stepNs, long long reorderNs);
+	void adjustQuality(long long stepNs);
+
+	// Builds the broadphase grid, alternating between two so that readers of
+	// the published one are never disturbed
+	SpatialGrid* nextGrid();
+	void publishGrid();
+	// Copies sphere state for the renderer. The scene holds the two latest, the renderer
+	// may still hold a pair, so three states rotate.
+	void publishRenderState();
+
+	std::shared_ptr<SpatialGrid> grids[2];
+	int currentGrid;
+	std::atomic<bool> indexDirty;
+	std::vector<Vec3f> accel;
+	std::vector<int> reorder;
+	int sinceReorder;
+	// Whether the tuner ran last step, to restart it when autotune is switched on
+	bool tuned;
+
+	TaskGraph stepGraph;
+	int integrateTask, broadphaseTask, narrowphaseTask, solveTask;
+	double stepDt;
+	// Effective settings of the step in progress, after the quality level
+	int stepIterations, stepDivisor;
+	bool stepMultiRate, stepDeferFar;
+	double budgetAvgNs;
+	int budgetCooldown, budgetCalm;
+	// Whether accel still matches the storage order
+	bool accelFresh;
+	unsigned long long stepHash;
+	// Narrowphase output, one list per chunk in index order
+	std::vector<std::vector<SphereContact>> contactChunks;
+	StaticBatch staticBatch;
+	// Static stage output per chunk, merged in chunk order
+	std::vector<ContactStats> staticContacts;
+	std::vector<std::vector<ContactEvent>> staticEvents;
+	std::shared_ptr<RenderState> renderStates[3];
+	int currentRender;
+
+	QMutex roiLock;
+	bool hasRoi;
+	Vec3f roiMin, roiMax;
+
+	QMutex wakeLock;
+	QWaitCondition wakeCondition;
+
+	QMutex editLock;
+	std::vector<std::function<void(Scene&)>> edits, applying;
+	std::vector<AreaImpulse> impulses;
+	std::vector<SphereProxy> impulseHits;
 };
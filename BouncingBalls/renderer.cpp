@@ -0,0 +1,148 @@
+#include "renderer.h"
+#include <math.h>
+#include "constants.h"
+#include "collision.h"
+
+void SceneRenderer::initialize(){
+	glClearColor(0, 0, 0, 1);
+
+	glEnable(GL_DEPTH_TEST);
+	glDepthRange(0.0f, 1.0f);
+
+	glEnable(GL_LIGHT0);
+	glEnable(GL_LIGHTING);
+	glColorMaterial(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE);
+	glEnable(GL_COLOR_MATERIAL);
+	glShadeModel(GL_SMOOTH);
+	// Sphere meshes are unit spheres scaled by radius
+	glEnable(GL_RESCALE_NORMAL);
+
+	buildSphereMeshes();
+}
+
+void SceneRenderer::resize(int w, int h){
+	glViewport(0, 0, w, h);
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glMatrixMode(GL_PROJECTION);
+	glLoadIdentity();
+	gluPerspective(fov, (float)w / h, 0.1, 100.0);
+	glGetFloatv(GL_PROJECTION_MATRIX, projection);
+	glMatrixMode(GL_MODELVIEW);
+	glLoadIdentity();
+}
+
+void SceneRenderer::render(Scene& world, Camera3D& camera, SphereHandle selected, long long wallNs){
+	this->selected = selected;
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	// Set background color
+	glClearColor(117.0f / 255.0f, 1.0f, 250.0f / 255.0f, 1.0f);
+
+	glLoadIdentity();
+
+	// Scale with zoom factor
+	glScalef(zoom, zoom, 1.0f);
+
+	// Move scene relative to camera position
+	glRotatef(camera.rotX, 1.0, 0.0, 0.0);
+	glRotatef(camera.rotY, 0.0, 1.0, 0.0);
+	glTranslated(-camera.x, -camera.y, -camera.z);
+
+	// Set light to static position
+	GLfloat ambient[] = { 0.1f, 0.1f, 0.1f, 1.0f };
+	glLightfv(GL_LIGHT0, GL_AMBIENT, ambient);
+	GLfloat pos[] = { 0.0, 50.0f, 0.0f, 1.0f };
+	glLightfv(GL_LIGHT0, GL_POSITION, pos);
+
+	// Cull everything outside the view frustum
+	glGetFloatv(GL_MODELVIEW_MATRIX, modelview);
+	camera.updateFrustum(modelview, projection);
+
+	{
+		QMutexLocker lock(&world.structureLock);
+		int nplanes = world.planes.size();
+		for (int i = 0; i < nplanes; ++i) {
+			Plane* p = world.planes[i].get();
+			if (camera.frustum.containsSphere(p->center, p->boundRad))
+				p->draw();
+		}
+		int naabbs = world.aabbs.size();
+		for (int i = 0; i < naabbs; ++i) {
+			AABB* aabb = world.aabbs[i].get();
+			if (camera.frustum.containsBox(Vec3f(aabb->minX, aabb->minY, aabb->minZ), Vec3f(aabb->maxX, aabb->maxY, aabb->maxZ)))
+				aabb->draw();
+		}
+	}
+
+	// Spheres are drawn from the published render states, blended to the present
+	std::shared_ptr<const RenderState> prevState, currState;
+	world.renderStates(prevState, currState);
+	const std::vector<RenderSphere>& spheres = interpolator.blend(prevState, currState, wallNs);
+	if (currState) {
+		for (const Capsule& c : currState->capsules)
+			if (camera.frustum.containsSphere(c.pos, boundRad(c))) c.draw();
+		for (const OBB& b : currState->obbs)
+			if (camera.frustum.containsSphere(b.pos, boundRad(b))) b.draw();
+	}
+
+	// Pick sphere tessellation by projected radius in pixels
+	Vec3f eye = camera.eye();
+	float pixelsPerUnit = viewport[3] / (2.0f * tanf(fov * 0.5f * RAD_PER_DEG)) * zoom;
+	pointSprites.clear();
+	int nspheres = spheres.size();
+	for (int i = 0; i < nspheres; ++i) {
+		const RenderSphere& s = spheres[i];
+		if (!camera.frustum.containsSphere(s.pos, s.rad))
+			continue;
+		float dist = (s.pos - eye).norm();
+		float px = dist > s.rad ? s.rad * pixelsPerUnit / dist : SPHERE_LOD_PIXELS[0];
+		int lod = 0;
+		while (lod < SPHERE_LOD_LEVELS && px < SPHERE_LOD_PIXELS[lod]) ++lod;
+		if (lod == SPHERE_LOD_LEVELS) pointSprites.push_back(&s);
+		else drawSphere(s, sphereMeshes[lod]);
+	}
+	drawPointSprites();
+}
+
+void SceneRenderer::buildSphereMeshes(){
+	GLUquadricObj* qobj = gluNewQuadric();
+	gluQuadricNormals(qobj, GLU_SMOOTH);
+	GLuint base = glGenLists(SPHERE_LOD_LEVELS);
+	for (int i = 0; i < SPHERE_LOD_LEVELS; ++i) {
+		sphereMeshes[i] = base + i;
+		glNewList(sphereMeshes[i], GL_COMPILE);
+		gluSphere(qobj, 1.0, SPHERE_LOD_SLICES[i], SPHERE_LOD_SLICES[i]);
+		glEndList();
+	}
+	gluDeleteQuadric(qobj);
+}
+
+void SceneRenderer::drawSphere(const RenderSphere& s, GLuint mesh){
+	glPushMatrix();
+
+	const Vec3f& c = s.handle == selected ? s.selectRgb : s.rgb;
+	glColor3f(c.x, c.y, c.z);
+	glTranslatef(s.pos.x, s.pos.y, s.pos.z);
+	glScalef(s.rad, s.rad, s.rad);
+	glCallList(mesh);
+
+	glPopMatrix();
+}
+
+void SceneRenderer::drawPointSprites(){
+	// Spheres only a pixel or two wide are not worth any tessellation
+	int npoints = pointSprites.size();
+	if (npoints == 0) return;
+
+	glDisable(GL_LIGHTING);
+	glPointSize(2.0f);
+	glBegin(GL_POINTS);
+	for (int i = 0; i < npoints; ++i) {
+		const RenderSphere* s = pointSprites[i];
+		const Vec3f& c = s->handle == selected ? s->selectRgb : s->rgb;
+		glColor3f(c.x, c.y, c.z);
+		glVertex3f(s->pos.x, s->pos.y, s->pos.z);
+	}
+	glEnd();
+	glEnable(GL_LIGHTING);
+}
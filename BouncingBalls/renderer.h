@@ -0,0 +1,41 @@
+#pragma once
+#include <vector>
+#include "geometry.h"
+#include "camera.h"
+#include "renderstate.h"
+
+// Sphere tessellation levels, from nearest to furthest
+const int SPHERE_LOD_LEVELS = 3;
+const int SPHERE_LOD_SLICES[SPHERE_LOD_LEVELS] = { 16, 10, 6 };
+// Minimum projected radius (in pixels) for each level. Smaller spheres are drawn as points.
+const float SPHERE_LOD_PIXELS[SPHERE_LOD_LEVELS] = { 24.0f, 8.0f, 1.5f };
+
+/*
+   Draws a scene with the fixed-function pipeline into whichever GL context is current.
+   Shared by the interactive view and offscreen capture.
+*/
+class SceneRenderer {
+public:
+	SceneRenderer() : fov(45.0f), zoom(1.0f) {}
+
+	// Sets up GL state and sphere meshes, the target context must be current
+	void initialize();
+	void resize(int w, int h);
+	// Planes and boxes are drawn from the live scene, spheres from its render states blended to wallNs
+	void render(Scene& world, Camera3D& camera, SphereHandle selected, long long wallNs);
+
+	float fov, zoom;
+	RenderInterpolator interpolator;
+	// Matrices of the last render, for unprojecting without reading back from the GPU
+	GLfloat modelview[16], projection[16];
+	GLint viewport[4];
+
+private:
+	void buildSphereMeshes();
+	void drawSphere(const RenderSphere& s, GLuint mesh);
+	void drawPointSprites();
+
+	GLuint sphereMeshes[SPHERE_LOD_LEVELS];
+	std::vector<const RenderSphere*> pointSprites;
+	SphereHandle selected;
+};
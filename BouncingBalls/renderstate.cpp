@@ -0,0 +1,83 @@
+#include "renderstate.h"
+#include <algorithm>
+
+void RenderState::capture(const Scene& scene){
+	const SlotMap<std::unique_ptr<Sphere>>& source = scene.spheres;
+	spheres.clear();
+	spheres.reserve(source.size());
+	int n = source.size();
+	for (int i = 0; i < n; ++i) {
+		const Sphere* s = source[i].get();
+		if (s == nullptr) continue;
+		RenderSphere r;
+		r.handle = source.handleAt(i);
+		r.pos = s->pos, r.velocity = s->velocity;
+		r.rgb = s->rgb, r.selectRgb = s->selectRgb;
+		r.rad = s->rad;
+		spheres.push_back(r);
+	}
+	capsules.clear();
+	for (const std::unique_ptr<Capsule>& c : scene.capsules)
+		capsules.push_back(*c);
+	obbs.clear();
+	for (const std::unique_ptr<OBB>& b : scene.obbs)
+		obbs.push_back(*b);
+	wallNs = renderClockNs();
+}
+
+void RenderInterpolator::mapPrevious(const RenderState& prev){
+	if (mapped == &prev && mappedWallNs == prev.wallNs) return;
+	mapped = &prev, mappedWallNs = prev.wallNs;
+
+	std::fill(prevBySlot.begin(), prevBySlot.end(), -1);
+	int n = prev.spheres.size();
+	for (int i = 0; i < n; ++i) {
+		unsigned slot = prev.spheres[i].handle.index;
+		if (slot >= prevBySlot.size()) prevBySlot.resize(slot + 1, -1);
+		prevBySlot[slot] = i;
+	}
+}
+
+const std::vector<RenderSphere>& RenderInterpolator::blend(const std::shared_ptr<const RenderState>& prev,
+	const std::shared_ptr<const RenderState>& curr, long long wallNs){
+	out.clear();
+	if (curr == nullptr) return out;
+	out = curr->spheres;
+
+	// Nothing to blend across edits made while paused, or after a stall
+	long long stepNs = prev != nullptr ? curr->wallNs - prev->wallNs : 0;
+	if (mode == BLEND_LATEST || prev == nullptr || curr->simTime <= prev->simTime || stepNs <= 0 || stepNs > RENDER_MAX_BLEND_NS)
+		return out;
+
+	float alpha = std::min(std::max((wallNs - curr->wallNs) / (float)stepNs, 0.0f), 1.0f);
+	int n = out.size();
+	if (mode == BLEND_EXTRAPOLATE) {
+		// At most one step ahead of the latest state
+		float ahead = alpha * (float)(curr->simTime - prev->simTime);
+		for (int i = 0; i < n; ++i)
+			out[i].pos += ahead * out[i].velocity;
+		return out;
+	}
+
+	const std::vector<RenderSphere>& from = prev->spheres;
+	int nfrom = from.size();
+	for (int i = 0; i < n; ++i) {
+		RenderSphere& r = out[i];
+		// Storage order changes on removals and when the reorder phase sorts spheres, which is
+		// rare, so the same position usually matches and the slot lookup covers the rest
+		const RenderSphere* p = nullptr;
+		if (i < nfrom && from[i].handle == r.handle) {
+			p = &from[i];
+		} else {
+			mapPrevious(*prev);
+			unsigned slot = r.handle.index;
+			int j = slot < prevBySlot.size() ? prevBySlot[slot] : -1;
+			if (j >= 0 && from[j].handle == r.handle) p = &from[j];
+		}
+		// Spheres that are new or were moved by an edit appear at their latest position
+		if (p == nullptr || (r.pos - p->pos).normsq() > RENDER_SNAP_DISTANCE * RENDER_SNAP_DISTANCE)
+			continue;
+		r.pos = p->pos + alpha * (r.pos - p->pos);
+	}
+	return out;
+}
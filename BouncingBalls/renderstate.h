@@ -0,0 +1,65 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <chrono>
+#include "geometry.h"
+
+// How the renderer places spheres between two physics steps
+enum RenderBlend { BLEND_LATEST, BLEND_INTERPOLATE, BLEND_EXTRAPOLATE, BLEND_MODES };
+
+// States further apart than this (pauses, stalls) are not blended
+const long long RENDER_MAX_BLEND_NS = 100000000;
+// Spheres that moved further than this in one step were teleported, not moving
+const float RENDER_SNAP_DISTANCE = 2.0f;
+
+// Clock shared by the physics and GUI threads for render timestamps
+inline long long renderClockNs(){
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct RenderSphere {
+	SphereHandle handle;
+	Vec3f pos, velocity;
+	Vec3f rgb, selectRgb;
+	float rad;
+};
+
+// Everything the renderer needs of one physics step, copied so drawing never touches live spheres
+struct RenderState {
+	RenderState() : step(0), simTime(0), wallNs(0) {}
+
+	void capture(const Scene& scene);
+
+	unsigned long long step;
+	double simTime;
+	long long wallNs;
+	std::vector<RenderSphere> spheres;
+	// Shapes other than spheres are few, they are copied whole and drawn unblended
+	std::vector<Capsule> capsules;
+	std::vector<OBB> obbs;
+};
+
+/*
+   Blends the two latest render states to the presentation time, so motion stays smooth
+   when the physics and display rates differ. Interpolation shows the scene one step late;
+   extrapolation is on time but overshoots on collisions. Spheres are matched by handle.
+*/
+class RenderInterpolator {
+public:
+	RenderInterpolator() : mode(BLEND_INTERPOLATE), mapped(nullptr), mappedWallNs(0) {}
+
+	// The result stays valid until the next call
+	const std::vector<RenderSphere>& blend(const std::shared_ptr<const RenderState>& prev,
+		const std::shared_ptr<const RenderState>& curr, long long wallNs);
+
+	RenderBlend mode;
+
+private:
+	void mapPrevious(const RenderState& prev);
+
+	std::vector<RenderSphere> out;
+	// Slot index of a handle to its position in the previous state, -1 if absent
+	std::vector<int> prevBySlot;
+	const RenderState* mapped;
+	long long mappedWallNs;
+};
@@ -0,0 +1,369 @@
+#include "rewind.h"
+#include <cstring>
+#include <algorithm>
+
+// Words of a sphere without forces, and of each force
+const int SPHERE_WORDS = 26;
+const int FORCE_WORDS = 7;
+
+static void putWord(std::vector<unsigned char>& out, uint32_t v) {
+	for (int i = 0; i < 4; ++i)
+		out.push_back((unsigned char)(v >> 8 * i));
+}
+
+static uint32_t getWord(const unsigned char*& p) {
+	uint32_t v = p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+	p += 4;
+	return v;
+}
+
+static void putVarint(std::vector<unsigned char>& out, uint32_t v) {
+	while (v >= 0x80) {
+		out.push_back((unsigned char)(v | 0x80));
+		v >>= 7;
+	}
+	out.push_back((unsigned char)v);
+}
+
+static uint32_t getVarint(const unsigned char*& p) {
+	uint32_t v = 0;
+	for (int shift = 0;; shift += 7) {
+		unsigned char b = *p++;
+		v |= (uint32_t)(b & 0x7f) << shift;
+		if (b < 0x80) return v;
+	}
+}
+
+static void putFloat(std::vector<uint32_t>& w, float f) {
+	uint32_t u;
+	std::memcpy(&u, &f, 4);
+	w.push_back(u);
+}
+
+static void putDouble(std::vector<uint32_t>& w, double d) {
+	uint64_t u;
+	std::memcpy(&u, &d, 8);
+	w.push_back((uint32_t)u), w.push_back((uint32_t)(u >> 32));
+}
+
+static void putVec(std::vector<uint32_t>& w, const Vec3f& v) { putFloat(w, v.x), putFloat(w, v.y), putFloat(w, v.z); }
+
+static float getFloat(const uint32_t*& w) {
+	float f;
+	std::memcpy(&f, w++, 4);
+	return f;
+}
+
+static double getDouble(const uint32_t*& w) {
+	uint64_t u = w[0] | (uint64_t)w[1] << 32;
+	w += 2;
+	double d;
+	std::memcpy(&d, &u, 8);
+	return d;
+}
+
+static Vec3f getVec(const uint32_t*& w) {
+	float x = getFloat(w), y = getFloat(w);
+	return Vec3f(x, y, getFloat(w));
+}
+
+// Every field of the sphere, bit for bit, so a restored run goes on exactly as the original
+static void pack(const Sphere& s, std::vector<uint32_t>& w) {
+	putVec(w, s.pos);
+	putFloat(w, s.rad), putFloat(w, s.m), putFloat(w, s.r);
+	putVec(w, s.origPos);
+	putVec(w, s.rgb), putVec(w, s.selectRgb);
+	putVec(w, s.velocity), putVec(w, s.origVelocity);
+	w.push_back((s.selected ? 1 : 0) | (s.active ? 2 : 0));
+	w.push_back((uint32_t)s.pendingSteps), w.push_back((uint32_t)s.wake);
+	putDouble(w, s.pendingDt);
+	for (const Force& f : s.forces) {
+		putDouble(w, f.f), putDouble(w, f.decayFactor);
+		putVec(w, f.dpc);
+	}
+}
+
+static void unpack(const uint32_t* w, int length, Sphere& s) {
+	s.pos = getVec(w);
+	s.rad = getFloat(w), s.m = getFloat(w), s.r = getFloat(w);
+	s.origPos = getVec(w);
+	s.rgb = getVec(w), s.selectRgb = getVec(w);
+	s.velocity = getVec(w), s.origVelocity = getVec(w);
+	s.selected = (*w & 1) != 0, s.active = (*w & 2) != 0;
+	w++;
+	s.pendingSteps = (int)*w++, s.wake = (int)*w++;
+	s.pendingDt = getDouble(w);
+	s.forces.clear();
+	for (int i = SPHERE_WORDS; i < length; i += FORCE_WORDS) {
+		Force f(Vec3f(0, -1, 0), 0, 0);
+		f.f = getDouble(w), f.decayFactor = getDouble(w);
+		f.dpc = getVec(w);
+		s.forces.push_back(f);
+	}
+}
+
+size_t RewindTable::bytes() const {
+	return handles.capacity() * sizeof(Handle) + offsets.capacity() * sizeof(int) + words.capacity() * sizeof(uint32_t)
+		+ generations.capacity() * sizeof(unsigned) + freeList.capacity() * sizeof(int) + slotPos.capacity() * sizeof(int);
+}
+
+void RewindTable::index(){
+	unsigned extent = 0;
+	for (const Handle& h : handles)
+		extent = std::max(extent, h.index + 1);
+	slotPos.assign(extent, -1);
+	for (int i = 0; i < (int)handles.size(); ++i)
+		slotPos[handles[i].index] = i;
+}
+
+// Words of the sphere under h in the reference frame, if it has as many
+static const uint32_t* reference(const RewindTable* ref, bool sameHandles, int i, Handle h, int length) {
+	if (ref == nullptr) return nullptr;
+	int j = sameHandles ? i : ref->find(h);
+	if (j < 0 || ref->length(j) != length) return nullptr;
+	return ref->words.data() + ref->offsets[j];
+}
+
+size_t RewindBuffer::Frame::bytes() const {
+	return sizeof(Frame) + data.capacity() + capsules.capacity() * sizeof(Capsule)
+		+ obbs.capacity() * sizeof(OBB) + emitters.capacity() * sizeof(Emitter);
+}
+
+/*
+   A frame is a handle list and the storage's allocation state, each of them unless they
+   are those of the reference, then per sphere its word count and its words. Words of a
+   sphere the reference has go per 32 as a mask of those that differ followed by each of
+   them XORed with the reference as a varint: resting spheres cost a few bytes, moving
+   ones mostly the low mantissa bits that changed. The others, and all of a keyframe,
+   are stored raw, 4 bytes a word.
+*/
+void RewindBuffer::encode(const RewindTable& from, const RewindTable* ref, std::vector<unsigned char>& out) const {
+	out.clear();
+	bool same = ref != nullptr && ref->handles == from.handles;
+	bool sameSlots = ref != nullptr && ref->generations == from.generations && ref->freeList == from.freeList;
+	putVarint(out, (same ? 0 : 1) | (sameSlots ? 0 : 2));
+	if (!same) {
+		putVarint(out, from.handles.size());
+		for (const Handle& h : from.handles)
+			putVarint(out, h.index), putVarint(out, h.generation);
+	}
+	if (!sameSlots) {
+		putVarint(out, from.generations.size());
+		for (unsigned g : from.generations)
+			putVarint(out, g);
+		putVarint(out, from.freeList.size());
+		for (int slot : from.freeList)
+			putVarint(out, slot);
+	}
+	for (int i = 0; i < (int)from.handles.size(); ++i) {
+		int length = from.length(i);
+		putVarint(out, length);
+		const uint32_t* w = from.words.data() + from.offsets[i];
+		const uint32_t* r = reference(ref, same, i, from.handles[i], length);
+		if (r == nullptr) {
+			for (int k = 0; k < length; ++k)
+				putWord(out, w[k]);
+			continue;
+		}
+		for (int b = 0; b < length; b += 32) {
+			int end = std::min(b + 32, length);
+			uint32_t mask = 0;
+			for (int k = b; k < end; ++k)
+				if (w[k] != r[k]) mask |= 1u << (k - b);
+			putVarint(out, mask);
+			for (int k = b; k < end; ++k)
+				if (mask >> (k - b) & 1) putVarint(out, w[k] ^ r[k]);
+		}
+	}
+}
+
+void RewindBuffer::decode(const std::vector<unsigned char>& in, const RewindTable* ref, RewindTable& to) const {
+	to.clear();
+	const unsigned char* p = in.data();
+	uint32_t flags = getVarint(p);
+	bool same = (flags & 1) == 0;
+	if (same) {
+		to.handles = ref->handles;
+	} else {
+		int n = getVarint(p);
+		to.handles.resize(n);
+		for (Handle& h : to.handles) {
+			h.index = getVarint(p);
+			h.generation = getVarint(p);
+		}
+	}
+	if ((flags & 2) == 0) {
+		to.generations = ref->generations;
+		to.freeList = ref->freeList;
+	} else {
+		to.generations.resize(getVarint(p));
+		for (unsigned& g : to.generations)
+			g = getVarint(p);
+		to.freeList.resize(getVarint(p));
+		for (int& slot : to.freeList)
+			slot = getVarint(p);
+	}
+	for (int i = 0; i < (int)to.handles.size(); ++i) {
+		int length = getVarint(p);
+		to.offsets.push_back(to.words.size());
+		int at = to.words.size();
+		to.words.resize(at + length);
+		const uint32_t* r = reference(ref, same, i, to.handles[i], length);
+		if (r == nullptr) {
+			for (int k = 0; k < length; ++k)
+				to.words[at + k] = getWord(p);
+			continue;
+		}
+		for (int b = 0; b < length; b += 32) {
+			int end = std::min(b + 32, length);
+			uint32_t mask = getVarint(p);
+			for (int k = b; k < end; ++k) {
+				uint32_t v = r[k];
+				if (mask >> (k - b) & 1) v ^= getVarint(p);
+				to.words[at + k] = v;
+			}
+		}
+	}
+	to.offsets.push_back(to.words.size());
+	to.index();
+}
+
+void RewindBuffer::record(const Scene& scene, unsigned long long step, double time, int reorderPhase){
+	if (!enabled()) return;
+	current.clear();
+	for (int i = 0; i < scene.spheres.size(); ++i) {
+		current.handles.push_back(scene.spheres.handleAt(i));
+		current.offsets.push_back(current.words.size());
+		// Empty for a hole in storage
+		if (scene.spheres[i] != nullptr) pack(*scene.spheres[i], current.words);
+	}
+	current.offsets.push_back(current.words.size());
+	scene.spheres.slotState(current.generations, current.freeList);
+	current.index();
+
+	Frame f;
+	f.step = step;
+	f.time = time;
+	f.reorderPhase = reorderPhase;
+	// Past half the budget with the tables the segment is closed, so that eviction can bring the rest under it
+	f.key = forceKeyframe || frames.empty() || sinceKeyframe >= keyframeFrames || segment + tables.load(std::memory_order_relaxed) > budget / 2;
+	encode(current, f.key ? nullptr : &last, f.data);
+	f.data.shrink_to_fit();
+	for (const auto& c : scene.capsules)
+		if (c != nullptr) f.capsules.push_back(*c);
+	for (const auto& o : scene.obbs)
+		if (o != nullptr) f.obbs.push_back(*o);
+	f.emitters = scene.emitters;
+	sinceKeyframe = f.key ? 1 : sinceKeyframe + 1;
+	forceKeyframe = false;
+	size_t bytes = f.bytes();
+	segment = f.key ? bytes : segment + bytes;
+	used.fetch_add(bytes, std::memory_order_relaxed);
+	frames.push_back(std::move(f));
+	std::swap(last, current);
+	countTables();
+
+	evict();
+	publishRange();
+}
+
+void RewindBuffer::evict(){
+	while (bytes() > budget && frames.size() > 1) {
+		// Deltas are useless without their keyframe, so the oldest segment goes as a whole
+		size_t next = 1;
+		while (next < frames.size() && !frames[next].key) ++next;
+		if (next == frames.size()) {
+			// Only one segment left, start the next one so that this one can go
+			forceKeyframe = true;
+			return;
+		}
+		for (size_t i = 0; i < next; ++i) {
+			used.fetch_sub(frames.front().bytes(), std::memory_order_relaxed);
+			frames.pop_front();
+		}
+	}
+}
+
+bool RewindBuffer::restore(Scene& scene, double time, unsigned long long& step, double& restoredTime, int& reorderPhase){
+	if (frames.empty()) return false;
+	int target = 0;
+	for (int i = (int)frames.size() - 1; i > 0; --i) {
+		if (frames[i].time <= time) {
+			target = i;
+			break;
+		}
+	}
+	int key = target;
+	while (!frames[key].key) --key;
+	decode(frames[key].data, nullptr, last);
+	for (int i = key + 1; i <= target; ++i) {
+		decode(frames[i].data, &last, current);
+		std::swap(last, current);
+	}
+
+	// The spheres of the present are recycled into the restored ones
+	std::vector<std::unique_ptr<Sphere>>& pool = scene.spherePool;
+	for (auto& s : scene.spheres)
+		if (s != nullptr) pool.push_back(std::move(s));
+	std::vector<std::unique_ptr<Sphere>> spheres(last.handles.size());
+	for (int i = 0; i < (int)spheres.size(); ++i) {
+		int length = last.length(i);
+		if (length == 0) continue;
+		if (pool.empty()) {
+			Vec3f origin(0, 0, 0);
+			spheres[i] = std::make_unique<Sphere>(origin, 1.0f, 1.0f);
+		} else {
+			spheres[i] = std::move(pool.back());
+			pool.pop_back();
+		}
+		unpack(last.words.data() + last.offsets[i], length, *spheres[i]);
+	}
+	scene.spheres.assign(last.handles, spheres, last.generations, last.freeList);
+
+	const Frame& f = frames[target];
+	scene.capsules.clear();
+	for (const Capsule& c : f.capsules)
+		scene.capsules.push_back(std::make_unique<Capsule>(c));
+	scene.obbs.clear();
+	for (const OBB& o : f.obbs)
+		scene.obbs.push_back(std::make_unique<OBB>(o));
+	scene.emitters = f.emitters;
+	step = f.step;
+	restoredTime = f.time;
+	reorderPhase = f.reorderPhase;
+
+	// What came after is history no more; recording goes on from here
+	while ((int)frames.size() > target + 1) {
+		used.fetch_sub(frames.back().bytes(), std::memory_order_relaxed);
+		frames.pop_back();
+	}
+	sinceKeyframe = target - key + 1;
+	segment = 0;
+	for (int i = key; i <= target; ++i)
+		segment += frames[i].bytes();
+	countTables();
+	publishRange();
+	return true;
+}
+
+void RewindBuffer::clear(){
+	frames.clear();
+	used.store(0, std::memory_order_relaxed);
+	// Gives the memory of the tables back as well
+	last = RewindTable();
+	current = RewindTable();
+	segment = 0;
+	sinceKeyframe = 0;
+	forceKeyframe = true;
+	countTables();
+	publishRange();
+}
+
+void RewindBuffer::countTables(){
+	tables.store(last.bytes() + current.bytes(), std::memory_order_relaxed);
+}
+
+void RewindBuffer::publishRange(){
+	oldest.store(frames.empty() ? 0 : frames.front().time, std::memory_order_relaxed);
+	newest.store(frames.empty() ? 0 : frames.back().time, std::memory_order_relaxed);
+}
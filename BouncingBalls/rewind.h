@@ -0,0 +1,119 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+#include "geometry.h"
+#include "emitter.h"
+
+// Memory budget the GUI records with, and default steps between recorded frames
+const size_t REWIND_BUDGET_BYTES = 256u << 20;
+const int REWIND_INTERVAL = 5;
+// Frames per keyframe; the frames in between are deltas against their predecessor
+const int REWIND_KEYFRAME_FRAMES = 60;
+// Simulated time the GUI goes back per press
+const double REWIND_SCRUB_SECONDS = 0.5;
+
+/*
+   Sphere state of one frame as flat words, in storage order, with the handles they were
+   stored under. Deltas are taken against the same handle in the previous frame.
+*/
+struct RewindTable {
+	void clear() { handles.clear(), offsets.clear(), words.clear(), generations.clear(), freeList.clear(); }
+	// Builds slotPos for find, after handles changed
+	void index();
+	// Position of the sphere under h, -1 if it was not there
+	int find(Handle h) const {
+		if (h.index >= slotPos.size()) return -1;
+		int i = slotPos[h.index];
+		return i >= 0 && handles[i] == h ? i : -1;
+	}
+	int length(int i) const { return offsets[i + 1] - offsets[i]; }
+	// Memory held, counted against the buffer's budget
+	size_t bytes() const;
+
+	std::vector<Handle> handles;
+	// Words of sphere i are [offsets[i], offsets[i + 1]); offsets has one entry more than handles
+	std::vector<int> offsets;
+	std::vector<uint32_t> words;
+	// Allocation state of the sphere storage, see SlotMap::slotState
+	std::vector<unsigned> generations;
+	std::vector<int> freeList;
+	std::vector<int> slotPos;
+};
+
+/*
+   In-memory history of the running session, for scrubbing back and resuming from an
+   earlier point. Every interval steps the sphere state is recorded: a keyframe every
+   keyframeFrames frames, and in between deltas that only store the words that changed,
+   XORed with their previous value as varints. Moving bodies and emitters are small and
+   copied as is. When the frames grow past the budget, the oldest keyframe goes with its
+   deltas. The two decoded tables count against the budget too, and a keyframe comes early
+   once they and the newest segment hold half of it, so there always is an older one to drop.
+   Static colliders, fields and kill volumes are not recorded; edits to them stay.
+   Recording and restoring happen on the physics thread; range and bytes may be read by
+   anyone.
+*/
+class RewindBuffer {
+public:
+	RewindBuffer() : budget(0), interval(REWIND_INTERVAL), keyframeFrames(REWIND_KEYFRAME_FRAMES),
+		used(0), tables(0), segment(0), sinceKeyframe(0), forceKeyframe(true), oldest(0), newest(0) {}
+
+	// Whether recording is on, which it is with a budget
+	bool enabled() const { return budget > 0; }
+	// reorderPhase is the engine's step count towards its next reorder, given back on restore
+	void record(const Scene& scene, unsigned long long step, double time, int reorderPhase);
+	/*
+	   Puts the scene back to the latest frame at or before time, or the oldest frame if
+	   none is, and forgets every frame after it. Spheres get their recorded handles back,
+	   and the spheres spawned from there get the same handles as they did the first time.
+	   Changes storage, so it needs structureLock. Returns false if nothing is recorded.
+	*/
+	bool restore(Scene& scene, double time, unsigned long long& step, double& restoredTime, int& reorderPhase);
+	// Forgets everything, for when the scene is replaced
+	void clear();
+
+	// Simulated time covered, oldest and newest frame
+	void range(double& from, double& to) const {
+		from = oldest.load(std::memory_order_relaxed), to = newest.load(std::memory_order_relaxed);
+	}
+	size_t bytes() const { return used.load(std::memory_order_relaxed) + tables.load(std::memory_order_relaxed); }
+	int frameCount() const { return (int)frames.size(); }
+
+	// Set before the engine starts; recording is off while the budget is 0
+	size_t budget;
+	int interval;
+	int keyframeFrames;
+
+private:
+	struct Frame {
+		unsigned long long step;
+		double time;
+		int reorderPhase;
+		bool key;
+		std::vector<unsigned char> data;
+		std::vector<Capsule> capsules;
+		std::vector<OBB> obbs;
+		std::vector<Emitter> emitters;
+
+		size_t bytes() const;
+	};
+
+	void encode(const RewindTable& from, const RewindTable* ref, std::vector<unsigned char>& out) const;
+	void decode(const std::vector<unsigned char>& in, const RewindTable* ref, RewindTable& to) const;
+	void evict();
+	void publishRange();
+	void countTables();
+
+	std::deque<Frame> frames;
+	// Bytes of the frames, and of last and current
+	std::atomic<size_t> used, tables;
+	// Bytes of the frames since the newest keyframe, that one included
+	size_t segment;
+	int sinceKeyframe;
+	bool forceKeyframe;
+	// Last recorded frame, reference of the next delta
+	RewindTable last, current;
+	std::atomic<double> oldest, newest;
+};
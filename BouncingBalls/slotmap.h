@@ -0,0 +1,154 @@
+#pragma once
+#include <vector>
+#include <utility>
+
+/*
+   Reference to an element of a SlotMap. The generation is bumped whenever a slot is freed,
+   so a handle to a removed element never resolves, even after the slot is reused.
+*/
+struct Handle {
+	Handle() : index(~0u), generation(0) {}
+	Handle(unsigned index, unsigned generation) : index(index), generation(generation) {}
+
+	bool valid() const { return index != ~0u; }
+
+	friend bool operator==(const Handle& a, const Handle& b) { return a.index == b.index && a.generation == b.generation; }
+	friend bool operator!=(const Handle& a, const Handle& b) { return !(a == b); }
+
+	unsigned index, generation;
+};
+
+/*
+   Dense array with stable handles. Insert and erase are O(1); erase moves the last element
+   into the hole, so iteration by position stays contiguous but order is not preserved.
+*/
+template<class T> class SlotMap {
+public:
+	SlotMap() : freeHead(-1) {}
+
+	Handle insert(T value) {
+		int slot;
+		if (freeHead >= 0) {
+			slot = freeHead;
+			freeHead = table[slot].nextFree;
+		} else {
+			slot = table.size();
+			table.push_back(Slot());
+		}
+		table[slot].dense = dense.size();
+		dense.push_back(std::move(value));
+		denseToSlot.push_back(slot);
+		return Handle(slot, table[slot].generation);
+	}
+
+	void push_back(T value) { insert(std::move(value)); }
+
+	bool erase(Handle h) {
+		if (!contains(h)) return false;
+		int hole = table[h.index].dense;
+		int last = dense.size() - 1;
+		if (hole != last) {
+			dense[hole] = std::move(dense[last]);
+			denseToSlot[hole] = denseToSlot[last];
+			table[denseToSlot[hole]].dense = hole;
+		}
+		dense.pop_back();
+		denseToSlot.pop_back();
+		release(h.index);
+		return true;
+	}
+
+	bool contains(Handle h) const {
+		return h.index < table.size() && table[h.index].generation == h.generation && table[h.index].dense >= 0;
+	}
+
+	T* get(Handle h) { return contains(h) ? &dense[table[h.index].dense] : nullptr; }
+	const T* get(Handle h) const { return contains(h) ? &dense[table[h.index].dense] : nullptr; }
+
+	// Position in dense storage, -1 for stale handles
+	int indexOf(Handle h) const { return contains(h) ? table[h.index].dense : -1; }
+	Handle handleAt(int i) const { return Handle(denseToSlot[i], table[denseToSlot[i]].generation); }
+
+	void clear() {
+		for (int i = 0; i < (int)denseToSlot.size(); ++i)
+			release(denseToSlot[i]);
+		dense.clear();
+		denseToSlot.clear();
+	}
+
+	// Rearranges dense storage so that position i holds what was at order[i]. order must be
+	// a permutation of [0, size()). Handles keep resolving to the same elements.
+	void permute(const std::vector<int>& order) {
+		std::vector<T> moved;
+		std::vector<int> owners;
+		moved.reserve(dense.size()), owners.reserve(dense.size());
+		for (int from : order) {
+			moved.push_back(std::move(dense[from]));
+			owners.push_back(denseToSlot[from]);
+		}
+		dense.swap(moved);
+		denseToSlot.swap(owners);
+		for (int i = 0; i < (int)denseToSlot.size(); ++i)
+			table[denseToSlot[i]].dense = i;
+	}
+
+	// Allocation state: the generation of every slot and the free list in order
+	void slotState(std::vector<unsigned>& generations, std::vector<int>& freeList) const {
+		generations.clear(), freeList.clear();
+		for (const Slot& slot : table)
+			generations.push_back(slot.generation);
+		for (int i = freeHead; i >= 0; i = table[i].nextFree)
+			freeList.push_back(i);
+	}
+
+	// Goes back to an earlier state: values under the handles they had, and the allocation
+	// state of slotState at the time, so the same handles are issued again from there.
+	// Handles issued since then may come back for other elements.
+	void assign(const std::vector<Handle>& handles, std::vector<T>& values, const std::vector<unsigned>& generations, const std::vector<int>& freeList) {
+		dense.clear();
+		denseToSlot.clear();
+		table.assign(generations.size(), Slot());
+		for (int i = 0; i < (int)generations.size(); ++i)
+			table[i].generation = generations[i];
+		for (int i = 0; i < (int)handles.size(); ++i) {
+			table[handles[i].index].dense = i;
+			dense.push_back(std::move(values[i]));
+			denseToSlot.push_back(handles[i].index);
+		}
+		freeHead = -1;
+		for (int i = (int)freeList.size() - 1; i >= 0; --i) {
+			table[freeList[i]].nextFree = freeHead;
+			freeHead = freeList[i];
+		}
+	}
+
+	void reserve(int n) { dense.reserve(n), denseToSlot.reserve(n); }
+	int size() const { return dense.size(); }
+	bool empty() const { return dense.empty(); }
+
+	T& operator[](int i) { return dense[i]; }
+	const T& operator[](int i) const { return dense[i]; }
+	typename std::vector<T>::iterator begin() { return dense.begin(); }
+	typename std::vector<T>::iterator end() { return dense.end(); }
+	typename std::vector<T>::const_iterator begin() const { return dense.begin(); }
+	typename std::vector<T>::const_iterator end() const { return dense.end(); }
+
+private:
+	struct Slot {
+		Slot() : generation(1), dense(-1), nextFree(-1) {}
+		unsigned generation;
+		int dense, nextFree;
+	};
+
+	void release(int slot) {
+		table[slot].generation++;
+		table[slot].dense = -1;
+		table[slot].nextFree = freeHead;
+		freeHead = slot;
+	}
+
+	std::vector<T> dense;
+	std::vector<int> denseToSlot;
+	std::vector<Slot> table;
+	int freeHead;
+};
@@ -0,0 +1,190 @@
+#include "spatial.h"
+#include <algorithm>
+#include <cfloat>
+#include "geometry.h"
+
+void SpatialGrid::build(const SlotMap<std::unique_ptr<Sphere>>& spheres, float cellScale){
+	int n = spheres.size();
+	maxRad = 0;
+	double sumRad = 0;
+	int count = 0;
+	boundsMin = Vec3f(FLT_MAX, FLT_MAX, FLT_MAX);
+	boundsMax = Vec3f(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (int i = 0; i < n; ++i) {
+		Sphere* s = spheres[i].get();
+		if (s == nullptr) continue;
+		maxRad = std::max(maxRad, s->rad);
+		sumRad += s->rad, count++;
+		boundsMin = Vec3f(std::min(boundsMin.x, s->pos.x), std::min(boundsMin.y, s->pos.y), std::min(boundsMin.z, s->pos.z));
+		boundsMax = Vec3f(std::max(boundsMax.x, s->pos.x), std::max(boundsMax.y, s->pos.y), std::max(boundsMax.z, s->pos.z));
+	}
+	float meanRad = count > 0 ? (float)(sumRad / count) : 0;
+	cellSize = maxRad > 0 ? std::max(2 * maxRad, 2 * cellScale * meanRad) : 1.0f;
+
+	// Power of two bucket count with a load factor of at most 0.5
+	unsigned nbuckets = 64;
+	while (nbuckets < 2u * n) nbuckets <<= 1;
+	cellStart.assign(nbuckets + 1, 0);
+
+	// Counting sort of the spheres by bucket
+	scratch.resize(n);
+	for (int i = 0; i < n; ++i) {
+		Sphere* s = spheres[i].get();
+		if (s == nullptr) continue;
+		scratch[i] = bucket(cell(s->pos.x), cell(s->pos.y), cell(s->pos.z));
+		cellStart[scratch[i] + 1]++;
+	}
+	for (unsigned b = 0; b < nbuckets; ++b)
+		cellStart[b + 1] += cellStart[b];
+
+	proxies.resize(cellStart[nbuckets]);
+	std::vector<int> fill(cellStart.begin(), cellStart.end() - 1);
+	for (int i = 0; i < n; ++i) {
+		Sphere* s = spheres[i].get();
+		if (s == nullptr) continue;
+		SphereProxy& p = proxies[fill[scratch[i]]++];
+		p.pos = s->pos, p.rad = s->rad, p.idx = i, p.sphere = s, p.handle = spheres.handleAt(i);
+		p.cx = cell(s->pos.x), p.cy = cell(s->pos.y), p.cz = cell(s->pos.z);
+	}
+}
+
+void SpatialGrid::localityOrder(std::vector<int>& order) const {
+	int n = proxies.size();
+	if (n == 0) { order.clear(); return; }
+	int x0 = proxies[0].cx, y0 = proxies[0].cy, z0 = proxies[0].cz;
+	for (const SphereProxy& p : proxies)
+		x0 = std::min(x0, p.cx), y0 = std::min(y0, p.cy), z0 = std::min(z0, p.cz);
+
+	std::vector<std::pair<unsigned long long, int>> keys(n);
+	for (int i = 0; i < n; ++i) {
+		const SphereProxy& p = proxies[i];
+		keys[i].first = expandBits(p.cx - x0) << 2 | expandBits(p.cy - y0) << 1 | expandBits(p.cz - z0);
+		keys[i].second = p.idx;
+	}
+	std::sort(keys.begin(), keys.end());
+	order.resize(n);
+	for (int i = 0; i < n; ++i)
+		order[i] = keys[i].second;
+}
+
+bool SpatialGrid::raycast(Vec3f origin, Vec3f dir, float maxDist, RayHit& hit) const {
+	if (proxies.empty()) return false;
+	dir.normalize();
+	if (dir.normsq() == 0) return false;
+
+	// Clip the ray against the grid bounds so we only walk populated cells
+	float o[3] = { origin.x, origin.y, origin.z };
+	float d[3] = { dir.x, dir.y, dir.z };
+	float lo[3] = { boundsMin.x - maxRad, boundsMin.y - maxRad, boundsMin.z - maxRad };
+	float hi[3] = { boundsMax.x + maxRad, boundsMax.y + maxRad, boundsMax.z + maxRad };
+	float tEnter = 0, tExit = maxDist;
+	for (int a = 0; a < 3; ++a) {
+		if (d[a] == 0) {
+			if (o[a] < lo[a] || o[a] > hi[a]) return false;
+			continue;
+		}
+		float t0 = (lo[a] - o[a]) / d[a], t1 = (hi[a] - o[a]) / d[a];
+		if (t0 > t1) std::swap(t0, t1);
+		tEnter = std::max(tEnter, t0);
+		tExit = std::min(tExit, t1);
+	}
+	if (tEnter > tExit) return false;
+
+	// 3D DDA from the entry point
+	Vec3f start = origin + tEnter * dir;
+	int c[3] = { cell(start.x), cell(start.y), cell(start.z) };
+	int step[3];
+	float tMax[3], tDelta[3];
+	float s[3] = { start.x, start.y, start.z };
+	for (int a = 0; a < 3; ++a) {
+		if (d[a] > 0) {
+			step[a] = 1;
+			tMax[a] = tEnter + ((c[a] + 1) * cellSize - s[a]) / d[a];
+			tDelta[a] = cellSize / d[a];
+		} else if (d[a] < 0) {
+			step[a] = -1;
+			tMax[a] = tEnter + (c[a] * cellSize - s[a]) / d[a];
+			tDelta[a] = -cellSize / d[a];
+		} else {
+			step[a] = 0;
+			tMax[a] = tDelta[a] = FLT_MAX;
+		}
+	}
+
+	hit.sphere = nullptr;
+	hit.t = FLT_MAX;
+	float tCell = tEnter;
+	while (tCell <= tExit) {
+		// A hit inside this cell belongs to a sphere centered in one of its neighbors
+		forEachInCells(c[0] - 1, c[1] - 1, c[2] - 1, c[0] + 1, c[1] + 1, c[2] + 1, [&](const SphereProxy& p) {
+			Vec3f oc = origin - p.pos;
+			float b = oc.dot(dir);
+			float disc = b * b - (oc.normsq() - p.rad * p.rad);
+			if (disc < 0) return;
+			float sq = sqrtf(disc);
+			float t = -b - sq;
+			if (t < 0) t = -b + sq;
+			if (t >= 0 && t <= maxDist && t < hit.t) {
+				hit.t = t, hit.sphere = p.sphere, hit.handle = p.handle, hit.idx = p.idx;
+			}
+		});
+
+		// Nothing further along the ray can be closer than a hit before this cell's exit
+		int a = (tMax[0] < tMax[1]) ? (tMax[0] < tMax[2] ? 0 : 2) : (tMax[1] < tMax[2] ? 1 : 2);
+		if (hit.sphere != nullptr && hit.t <= tMax[a]) break;
+		tCell = tMax[a];
+		tMax[a] += tDelta[a];
+		c[a] += step[a];
+	}
+
+	if (hit.sphere == nullptr) return false;
+	hit.point = origin + hit.t * dir;
+	return true;
+}
+
+void SpatialGrid::overlapSphere(const Vec3f& c, float r, std::vector<SphereProxy>& out) const {
+	if (proxies.empty()) return;
+	float reach = r + maxRad;
+	forEachInCells(cell(c.x - reach), cell(c.y - reach), cell(c.z - reach),
+		cell(c.x + reach), cell(c.y + reach), cell(c.z + reach), [&](const SphereProxy& p) {
+		if ((p.pos - c).normsq() <= (r + p.rad) * (r + p.rad))
+			out.push_back(p);
+	});
+}
+
+void SpatialGrid::overlapBox(const Vec3f& min, const Vec3f& max, std::vector<SphereProxy>& out) const {
+	if (proxies.empty()) return;
+	forEachInCells(cell(min.x - maxRad), cell(min.y - maxRad), cell(min.z - maxRad),
+		cell(max.x + maxRad), cell(max.y + maxRad), cell(max.z + maxRad), [&](const SphereProxy& p) {
+		// Distance from sphere center to the closest point of the box
+		float dx = std::max(min.x - p.pos.x, std::max(0.0f, p.pos.x - max.x));
+		float dy = std::max(min.y - p.pos.y, std::max(0.0f, p.pos.y - max.y));
+		float dz = std::max(min.z - p.pos.z, std::max(0.0f, p.pos.z - max.z));
+		if (dx * dx + dy * dy + dz * dz <= p.rad * p.rad)
+			out.push_back(p);
+	});
+}
+
+void SpatialGrid::nearest(const Vec3f& p, int k, std::vector<SphereProxy>& out) const {
+	if (proxies.empty() || k <= 0) return;
+	k = std::min(k, (int)proxies.size());
+	float extent = (boundsMax - boundsMin).norm() + (p - boundsMin).norm();
+
+	// Grow the search radius until it holds k centers, all of them closer than the radius
+	std::vector<std::pair<float, const SphereProxy*>> found;
+	for (float r = cellSize;; r *= 2) {
+		found.clear();
+		forEachInCells(cell(p.x - r), cell(p.y - r), cell(p.z - r),
+			cell(p.x + r), cell(p.y + r), cell(p.z + r), [&](const SphereProxy& q) {
+			float dsq = (q.pos - p).normsq();
+			if (dsq <= r * r) found.push_back(std::make_pair(dsq, &q));
+		});
+		if ((int)found.size() >= k || r >= extent) break;
+	}
+
+	int n = std::min(k, (int)found.size());
+	std::partial_sort(found.begin(), found.begin() + n, found.end(),
+		[](const std::pair<float, const SphereProxy*>& a, const std::pair<float, const SphereProxy*>& b) { return a.first < b.first; });
+	for (int i = 0; i < n; ++i)
+		out.push_back(*found[i].second);
+}
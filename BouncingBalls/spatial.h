@@ -0,0 +1,109 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <cmath>
+#include "vector.h"
+#include "slotmap.h"
+
+class Sphere;
+typedef Handle SphereHandle;
+
+// Spreads the low 21 bits of v so there are two zero bits between each, for Morton codes
+inline unsigned long long expandBits(unsigned long long v){
+	v &= 0x1fffff;
+	v = (v | v << 32) & 0x1f00000000ffffull;
+	v = (v | v << 16) & 0x1f0000ff0000ffull;
+	v = (v | v << 8) & 0x100f00f00f00f00full;
+	v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+	v = (v | v << 2) & 0x1249249249249249ull;
+	return v;
+}
+
+// Copy of a sphere's bounds taken when the grid was built. Outside the physics
+// thread, resolve the sphere through its handle rather than the raw pointer.
+struct SphereProxy {
+	Vec3f pos;
+	float rad;
+	int idx;
+	Sphere* sphere;
+	SphereHandle handle;
+	int cx, cy, cz;
+};
+
+struct RayHit {
+	Sphere* sphere;
+	SphereHandle handle;
+	int idx;
+	float t;
+	Vec3f point;
+};
+
+/*
+   Uniform hash grid over sphere centers. The cell size is cellScale times the mean sphere
+   diameter but never below the largest one, so two touching spheres always sit in the same
+   or in neighboring cells.
+   Proxies are stored sorted by hash bucket, and each proxy remembers its own cell so that
+   bucket collisions never produce duplicate or foreign candidates.
+*/
+class SpatialGrid {
+public:
+	SpatialGrid() : cellSize(1), maxRad(0) {}
+
+	void build(const SlotMap<std::unique_ptr<Sphere>>& spheres, float cellScale = 1);
+
+	int size() const { return proxies.size(); }
+
+	// Calls f for every proxy in the cell of p and the 26 cells around it
+	template<class F> void forEachNear(const Vec3f& p, F f) const {
+		if (proxies.empty()) return;
+		int x = cell(p.x), y = cell(p.y), z = cell(p.z);
+		forEachInCells(x - 1, y - 1, z - 1, x + 1, y + 1, z + 1, f);
+	}
+
+	// Closest sphere hit along the ray, dir need not be normalized
+	bool raycast(Vec3f origin, Vec3f dir, float maxDist, RayHit& hit) const;
+	// Spheres that intersect the given sphere / box
+	void overlapSphere(const Vec3f& c, float r, std::vector<SphereProxy>& out) const;
+	void overlapBox(const Vec3f& min, const Vec3f& max, std::vector<SphereProxy>& out) const;
+	// The k spheres with centers closest to p, nearest first
+	void nearest(const Vec3f& p, int k, std::vector<SphereProxy>& out) const;
+
+	// Sphere indices as of the build, sorted along a Morton curve over the cells, so that
+	// neighbors in space end up close in the order
+	void localityOrder(std::vector<int>& order) const;
+
+	std::vector<SphereProxy> proxies;
+	float cellSize, maxRad;
+	Vec3f boundsMin, boundsMax;
+
+private:
+	int cell(float v) const { return (int)std::floor(v / cellSize); }
+
+	unsigned bucket(int x, int y, int z) const {
+		return ((unsigned)x * 73856093u ^ (unsigned)y * 19349663u ^ (unsigned)z * 83492791u) & (cellStart.size() - 2);
+	}
+
+	template<class F> void forEachInCells(int x0, int y0, int z0, int x1, int y1, int z1, F f) const {
+		// Ranges covering more cells than there are buckets are cheaper to scan linearly
+		long long ncells = (long long)(x1 - x0 + 1) * (y1 - y0 + 1) * (z1 - z0 + 1);
+		if (ncells >= (long long)cellStart.size()) {
+			for (const SphereProxy& p : proxies)
+				if (p.cx >= x0 && p.cx <= x1 && p.cy >= y0 && p.cy <= y1 && p.cz >= z0 && p.cz <= z1)
+					f(p);
+			return;
+		}
+		for (int x = x0; x <= x1; ++x)
+			for (int y = y0; y <= y1; ++y)
+				for (int z = z0; z <= z1; ++z) {
+					unsigned b = bucket(x, y, z);
+					for (int i = cellStart[b]; i < cellStart[b + 1]; ++i) {
+						const SphereProxy& p = proxies[i];
+						if (p.cx == x && p.cy == y && p.cz == z)
+							f(p);
+					}
+				}
+	}
+
+	std::vector<int> cellStart;
+	std::vector<unsigned> scratch;
+};
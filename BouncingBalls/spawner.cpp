@@ -0,0 +1,110 @@
+#include "spawner.h"
+#include <algorithm>
+
+// Largest background grid we are willing to allocate for one call
+const long long MAX_SPAWN_CELLS = 1 << 24;
+
+bool BulkSpawner::blocked(const Vec3f& p, float minDist, const SpatialGrid* existing){
+	int cx = (int)((p.x - origin.x) / cellSize);
+	int cy = (int)((p.y - origin.y) / cellSize);
+	int cz = (int)((p.z - origin.z) / cellSize);
+	if (cells[(cx * ny + cy) * nz + cz] >= 0) return true;
+
+	// minDist spans at most two cells in each direction
+	for (int x = std::max(cx - 2, 0); x <= std::min(cx + 2, nx - 1); ++x)
+		for (int y = std::max(cy - 2, 0); y <= std::min(cy + 2, ny - 1); ++y)
+			for (int z = std::max(cz - 2, 0); z <= std::min(cz + 2, nz - 1); ++z) {
+				int s = cells[(x * ny + y) * nz + z];
+				if (s >= 0 && (samples[s] - p).normsq() < minDist * minDist)
+					return true;
+			}
+
+	if (existing != nullptr) {
+		hits.clear();
+		existing->overlapSphere(p, minDist / 2, hits);
+		if (!hits.empty()) return true;
+	}
+	return false;
+}
+
+std::vector<Vec3f> BulkSpawner::sample(const Vec3f& min, const Vec3f& max, int count, float minDist, const SpatialGrid* existing){
+	samples.clear();
+	Vec3f extent = max - min;
+	if (count <= 0 || minDist <= 0 || extent.x < 0 || extent.y < 0 || extent.z < 0)
+		return samples;
+
+	cellSize = minDist / sqrtf(3.0f);
+	origin = min;
+	nx = (int)(extent.x / cellSize) + 1;
+	ny = (int)(extent.y / cellSize) + 1;
+	nz = (int)(extent.z / cellSize) + 1;
+	if ((long long)nx * ny * nz > MAX_SPAWN_CELLS) {
+		#ifdef DEBUG
+		qDebug() << "Spawn region too large for sphere size";
+		#endif
+		return samples;
+	}
+	cells.assign(nx * ny * nz, -1);
+
+	std::vector<int> active;
+	auto accept = [&](const Vec3f& p) {
+		int cx = (int)((p.x - origin.x) / cellSize);
+		int cy = (int)((p.y - origin.y) / cellSize);
+		int cz = (int)((p.z - origin.z) / cellSize);
+		cells[(cx * ny + cy) * nz + cz] = samples.size();
+		active.push_back(samples.size());
+		samples.push_back(p);
+	};
+
+	// Existing spheres can split the region, so reseed whenever the active front dies out
+	int seedFailures = 0;
+	while ((int)samples.size() < count && seedFailures < attempts) {
+		if (active.empty()) {
+			Vec3f p(uniform(min.x, max.x), uniform(min.y, max.y), uniform(min.z, max.z));
+			if (blocked(p, minDist, existing)) { ++seedFailures; continue; }
+			accept(p);
+			continue;
+		}
+
+		int a = std::uniform_int_distribution<int>(0, active.size() - 1)(rng);
+		Vec3f center = samples[active[a]];
+		bool found = false;
+		for (int k = 0; k < attempts && !found; ++k) {
+			// Uniform direction, distance in [minDist, 2 * minDist]
+			Vec3f dir(uniform(-1, 1), uniform(-1, 1), uniform(-1, 1));
+			float l = dir.norm();
+			if (l == 0 || l > 1) continue;
+			Vec3f p = center + (uniform(minDist, 2 * minDist) / l) * dir;
+			if (p.x < min.x || p.y < min.y || p.z < min.z || p.x > max.x || p.y > max.y || p.z > max.z)
+				continue;
+			if (blocked(p, minDist, existing)) continue;
+			accept(p);
+			found = true;
+		}
+		if (!found) {
+			active[a] = active.back();
+			active.pop_back();
+		}
+	}
+	return samples;
+}
+
+std::vector<std::unique_ptr<Sphere>> BulkSpawner::spawn(const Vec3f& min, const Vec3f& max, int count,
+	const SpawnParams& params, const SpatialGrid* existing)
+{
+	// Keep sphere surfaces inside the region
+	Vec3f inset(params.radius, params.radius, params.radius);
+	std::vector<Vec3f> positions = sample(min + inset, max - inset, count, 2 * params.radius + params.gap, existing);
+
+	std::vector<std::unique_ptr<Sphere>> batch;
+	batch.reserve(positions.size());
+	for (int i = 0; i < (int)positions.size(); ++i) {
+		float mass = uniform(params.minMass, params.maxMass);
+		float restitution = uniform(params.minRestitution, params.maxRestitution);
+		Vec3f v(uniform(params.minVelocity.x, params.maxVelocity.x),
+			uniform(params.minVelocity.y, params.maxVelocity.y),
+			uniform(params.minVelocity.z, params.maxVelocity.z));
+		batch.push_back(std::make_unique<Sphere>(Sphere(positions[i], params.radius, mass, restitution, v)));
+	}
+	return batch;
+}
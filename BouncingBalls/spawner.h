@@ -0,0 +1,51 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <random>
+#include "geometry.h"
+#include "spatial.h"
+
+// Property ranges for spawned spheres, defaults match GLSimulation::generateBalls
+struct SpawnParams {
+	SpawnParams()
+		: radius(0.2f), gap(0.02f), minMass(0.4f), maxMass(1.0f),
+		minRestitution(0.55f), maxRestitution(0.95f),
+		minVelocity(-10, -10, -10), maxVelocity(10, 0, 10) {}
+
+	float radius, gap;
+	float minMass, maxMass;
+	float minRestitution, maxRestitution;
+	Vec3f minVelocity, maxVelocity;
+};
+
+/*
+   Fills a box of the live scene with non-overlapping spheres using Poisson-disk sampling
+   (Bridson's algorithm). Candidates are rejected against each other through a local
+   background grid and against existing spheres through the published spatial index.
+*/
+class BulkSpawner {
+public:
+	BulkSpawner(unsigned seed = std::random_device()()) : rng(seed), attempts(30) {}
+
+	// Up to `count` positions inside [min, max], fewer if the region fills up
+	std::vector<Vec3f> sample(const Vec3f& min, const Vec3f& max, int count, float minDist, const SpatialGrid* existing);
+
+	// Spheres with randomized properties at sampled positions, ready to hand to the engine
+	std::vector<std::unique_ptr<Sphere>> spawn(const Vec3f& min, const Vec3f& max, int count,
+		const SpawnParams& params, const SpatialGrid* existing);
+
+	std::mt19937 rng;
+	int attempts;
+
+private:
+	float uniform(float a, float b) { return std::uniform_real_distribution<float>(a, b)(rng); }
+	bool blocked(const Vec3f& p, float minDist, const SpatialGrid* existing);
+
+	// Background grid of accepted samples, cell size minDist / sqrt(3) holds at most one sample
+	std::vector<int> cells;
+	int nx, ny, nz;
+	float cellSize;
+	Vec3f origin;
+	std::vector<Vec3f> samples;
+	std::vector<SphereProxy> hits;
+};
@@ -0,0 +1,318 @@
+#include "statestream.h"
+#include <algorithm>
+#include <string.h>
+#include "trace.h"
+
+// Byte offsets of the sections of a slot
+static size_t recordsOffset(){ return sizeof(StreamFrame); }
+static size_t removedOffset(quint32 maxSpheres){ return recordsOffset() + maxSpheres * sizeof(StreamSphere); }
+static size_t quadsOffset(quint32 maxSpheres){ return removedOffset(maxSpheres) + maxSpheres * sizeof(quint32); }
+
+static quint32 slotSize(quint32 maxSpheres){
+	size_t bytes = quadsOffset(maxSpheres) + STREAM_MAX_QUADS * sizeof(StreamQuad);
+	// Keep slots on separate cache lines
+	return (quint32)((bytes + 63) & ~size_t(63));
+}
+
+static size_t headerSize(){
+	return (sizeof(StreamHeader) + 63) & ~size_t(63);
+}
+
+static bool sameSphere(const StreamSphere& a, const StreamSphere& b){
+	if (a.generation != b.generation || a.rad != b.rad) return false;
+	for (int k = 0; k < 3; ++k) {
+		if (fabsf(a.pos[k] - b.pos[k]) > STREAM_DELTA_EPSILON) return false;
+		if (fabsf(a.velocity[k] - b.velocity[k]) > STREAM_DELTA_EPSILON) return false;
+		if (a.rgb[k] != b.rgb[k]) return false;
+	}
+	return true;
+}
+
+static void store(float* out, const Vec3f& v){
+	out[0] = v.x, out[1] = v.y, out[2] = v.z;
+}
+
+StateStreamWriter::StateStreamWriter(const QString& name, int maxSpheres, bool delta)
+	: delta(delta), lastFrameBytes(0), memory(name), header(nullptr), maxSpheres(std::max(maxSpheres, 1)), frame(0), lastQuads(0)
+{
+}
+
+bool StateStreamWriter::open(){
+	size_t bytes = headerSize() + (size_t)STREAM_SLOTS * slotSize(maxSpheres);
+	if (!memory.create((int)bytes)) {
+		// A segment outlives its writer while viewers hold it, take it over
+		if (memory.error() != QSharedMemory::AlreadyExists || !memory.attach()) {
+			error = memory.errorString();
+			return false;
+		}
+		if ((size_t)memory.size() < bytes) {
+			error = "An existing segment of that name is too small";
+			memory.detach();
+			return false;
+		}
+	}
+
+	header = (StreamHeader*)memory.data();
+	// Readers ignore the segment until the magic is back
+	header->magic.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	header->version = STREAM_VERSION;
+	header->slotCount = STREAM_SLOTS;
+	header->maxSpheres = maxSpheres;
+	header->maxQuads = STREAM_MAX_QUADS;
+	header->slotBytes = slotSize(maxSpheres);
+	// New segments start zeroed
+	header->session++;
+	header->latest.store(0, std::memory_order_relaxed);
+	// Sequence numbers keep counting, so a reader inside a slot still sees it change
+	for (int i = 0; i < STREAM_SLOTS; ++i)
+		slot(i)->frame = 0;
+	header->magic.store(STREAM_MAGIC, std::memory_order_release);
+
+	frame = 0;
+	sent.clear(), sentValid.clear();
+	return true;
+}
+
+void StateStreamWriter::close(){
+	if (header == nullptr) return;
+	header = nullptr;
+	memory.detach();
+}
+
+StreamFrame* StateStreamWriter::slot(quint64 f) const {
+	return (StreamFrame*)((char*)header + headerSize() + (f % STREAM_SLOTS) * header->slotBytes);
+}
+
+double StateStreamWriter::quadSignature(const Scene& scene) const {
+	double sum = scene.planes.size() * 1000003.0 + scene.aabbs.size();
+	for (const std::unique_ptr<Plane>& p : scene.planes)
+		sum += p->center.x + 3 * p->center.y + 7 * p->center.z + p->boundRad;
+	for (const std::unique_ptr<AABB>& p : scene.aabbs)
+		sum += 11 * p->center.x + 13 * p->center.y + 17 * p->center.z + p->boundRad;
+	return sum;
+}
+
+void StateStreamWriter::publish(const RenderState& state, const Scene& scene){
+	if (header == nullptr) return;
+	TRACE_SCOPE("streamPublish");
+	quint64 f = ++frame;
+	double quads = quadSignature(scene);
+	bool key = !delta || (f - 1) % STREAM_KEYFRAME_INTERVAL == 0 || quads != lastQuads;
+	lastQuads = quads;
+
+	StreamFrame* out = slot(f);
+	char* base = (char*)out;
+	StreamSphere* records = (StreamSphere*)(base + recordsOffset());
+	quint32* removed = (quint32*)(base + removedOffset(maxSpheres));
+	StreamQuad* quadOut = (StreamQuad*)(base + quadsOffset(maxSpheres));
+
+	quint32 seq = out->seq.load(std::memory_order_relaxed);
+	out->seq.store(seq + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	int n = std::min((int)state.spheres.size(), maxSpheres);
+	seen.assign(sent.size(), 0);
+	int count = 0;
+	for (int i = 0; i < n; ++i) {
+		const RenderSphere& s = state.spheres[i];
+		StreamSphere rec;
+		rec.index = s.handle.index, rec.generation = s.handle.generation;
+		store(rec.pos, s.pos), store(rec.velocity, s.velocity), store(rec.rgb, s.rgb);
+		rec.rad = s.rad;
+
+		unsigned idx = rec.index;
+		if (idx >= sent.size()) {
+			sent.resize(idx + 1);
+			sentValid.resize(idx + 1, 0);
+			seen.resize(idx + 1, 0);
+		}
+		seen[idx] = 1;
+		// Readers keep what they were sent last, so drift is measured against that
+		if (!key && sentValid[idx] && sameSphere(sent[idx], rec)) continue;
+		records[count++] = rec;
+		sent[idx] = rec, sentValid[idx] = 1;
+	}
+
+	int nremoved = 0;
+	int nslots = sent.size();
+	for (int idx = 0; idx < nslots; ++idx) {
+		if (!sentValid[idx] || seen[idx]) continue;
+		sentValid[idx] = 0;
+		// Keyframes replace everything, so removals are implied
+		if (!key) removed[nremoved++] = idx;
+	}
+
+	int nquads = 0;
+	if (key) {
+		auto addQuad = [&](const Plane& p, bool aabb) {
+			if (nquads == STREAM_MAX_QUADS) return;
+			StreamQuad& q = quadOut[nquads++];
+			store(q.a, p.a), store(q.b, p.b), store(q.c, p.c), store(q.d, p.d), store(q.rgb, p.rgb);
+			q.aabb = aabb;
+		};
+		for (const std::unique_ptr<Plane>& p : scene.planes) addQuad(*p, false);
+		for (const std::unique_ptr<AABB>& p : scene.aabbs) addQuad(*p, true);
+	}
+
+	out->flags = (key ? STREAM_KEYFRAME : 0) | ((int)state.spheres.size() > maxSpheres ? STREAM_TRUNCATED : 0);
+	out->frame = f;
+	out->step = state.step;
+	out->simTime = state.simTime;
+	out->wallNs = state.wallNs;
+	out->spheres = count, out->removed = nremoved, out->quads = nquads;
+
+	out->seq.store(seq + 2, std::memory_order_release);
+	header->latest.store(f, std::memory_order_release);
+	lastFrameBytes = sizeof(StreamFrame) + count * sizeof(StreamSphere) + nremoved * sizeof(quint32) + nquads * sizeof(StreamQuad);
+}
+
+StateStreamReader::StateStreamReader(const QString& name)
+	: quadsVersion(0), skipped(0), memory(name), header(nullptr), session(0), next(1), synced(false), step(0), simTime(0), wallNs(0)
+{
+}
+
+bool StateStreamReader::attach(){
+	if (header != nullptr) return true;
+	if (!memory.attach()) return false;
+	const StreamHeader* h = (const StreamHeader*)memory.constData();
+	if ((size_t)memory.size() < headerSize() || h->magic.load(std::memory_order_acquire) != STREAM_MAGIC || h->version != STREAM_VERSION
+		|| (size_t)memory.size() < headerSize() + (size_t)h->slotCount * h->slotBytes) {
+		memory.detach();
+		return false;
+	}
+	header = h;
+	session = h->session;
+	next = 1, synced = false;
+	return true;
+}
+
+void StateStreamReader::detach(){
+	if (header == nullptr) return;
+	header = nullptr;
+	memory.detach();
+}
+
+const StreamFrame* StateStreamReader::slot(quint64 f) const {
+	return (const StreamFrame*)((const char*)header + headerSize() + (f % header->slotCount) * header->slotBytes);
+}
+
+bool StateStreamReader::readFlags(quint64 f, quint32& flags) const {
+	const StreamFrame* in = slot(f);
+	quint32 seq = in->seq.load(std::memory_order_acquire);
+	if (seq & 1) return false;
+	flags = in->flags;
+	quint64 frame = in->frame;
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return in->seq.load(std::memory_order_relaxed) == seq && frame == f;
+}
+
+bool StateStreamReader::readFrame(quint64 f, FrameCopy& out) const {
+	const StreamFrame* in = slot(f);
+	quint32 seq = in->seq.load(std::memory_order_acquire);
+	if (seq & 1) return false;
+
+	// Counts can be torn while the writer is in the slot, clamp them before copying
+	quint32 maxSpheres = header->maxSpheres;
+	quint64 frame = in->frame;
+	out.flags = in->flags;
+	out.step = in->step, out.simTime = in->simTime, out.wallNs = in->wallNs;
+	const char* base = (const char*)in;
+	out.spheres.resize(std::min(in->spheres, maxSpheres));
+	out.removed.resize(std::min(in->removed, maxSpheres));
+	out.quads.resize(std::min(in->quads, header->maxQuads));
+	if (!out.spheres.empty()) memcpy(&out.spheres[0], base + recordsOffset(), out.spheres.size() * sizeof(StreamSphere));
+	if (!out.removed.empty()) memcpy(&out.removed[0], base + removedOffset(maxSpheres), out.removed.size() * sizeof(quint32));
+	if (!out.quads.empty()) memcpy(&out.quads[0], base + quadsOffset(maxSpheres), out.quads.size() * sizeof(StreamQuad));
+
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return in->seq.load(std::memory_order_relaxed) == seq && frame == f;
+}
+
+bool StateStreamReader::poll(){
+	if (header == nullptr || header->magic.load(std::memory_order_acquire) != STREAM_MAGIC) return false;
+	quint64 latest = header->latest.load(std::memory_order_acquire);
+	if (latest == 0) return false;
+	if (header->session != session) {
+		// The writer restarted and its frames start over
+		session = header->session;
+		next = 1, synced = false;
+	}
+	if (synced && latest < next) return false;
+
+	// The slot after latest may be in the writer's hands, the rest are older frames
+	quint64 oldest = latest > header->slotCount - 2 ? latest - (header->slotCount - 2) : 1;
+	// Start at the newest keyframe when there is one, there is no point replaying deltas before it
+	quint64 start = 0;
+	quint64 lowest = synced ? std::max(oldest, next) : oldest;
+	for (quint64 f = latest; f >= lowest; --f) {
+		quint32 flags;
+		if (readFlags(f, flags) && (flags & STREAM_KEYFRAME)) {
+			start = f;
+			break;
+		}
+	}
+	if (start == 0) {
+		if (!synced || next < oldest) {
+			// Fell behind the ring, wait for the next keyframe
+			synced = false;
+			return false;
+		}
+		start = next;
+	}
+	if (synced) skipped += start - next;
+
+	bool changed = false;
+	for (quint64 f = start; f <= latest; ++f) {
+		if (!readFrame(f, copy)) {
+			// Overwritten under us, the state stays at the last applied frame
+			synced = false;
+			break;
+		}
+		apply(copy);
+		changed = true;
+		next = f + 1, synced = true;
+	}
+	return changed;
+}
+
+void StateStreamReader::apply(const FrameCopy& frame){
+	if (frame.flags & STREAM_KEYFRAME) {
+		std::fill(present.begin(), present.end(), 0);
+		bool quadsChanged = frame.quads.size() != staticQuads.size()
+			|| (!frame.quads.empty() && memcmp(&frame.quads[0], &staticQuads[0], frame.quads.size() * sizeof(StreamQuad)) != 0);
+		if (quadsChanged) {
+			staticQuads = frame.quads;
+			quadsVersion++;
+		}
+	}
+	for (const StreamSphere& s : frame.spheres) {
+		if (s.index >= table.size()) {
+			table.resize(s.index + 1);
+			present.resize(s.index + 1, 0);
+		}
+		table[s.index] = s;
+		present[s.index] = 1;
+	}
+	for (quint32 idx : frame.removed)
+		if (idx < present.size()) present[idx] = 0;
+	step = frame.step, simTime = frame.simTime, wallNs = frame.wallNs;
+}
+
+std::shared_ptr<RenderState> StateStreamReader::state() const {
+	std::shared_ptr<RenderState> out = std::make_shared<RenderState>();
+	out->step = step, out->simTime = simTime, out->wallNs = wallNs;
+	int n = table.size();
+	for (int i = 0; i < n; ++i) {
+		if (!present[i]) continue;
+		const StreamSphere& s = table[i];
+		RenderSphere r;
+		r.handle = SphereHandle(s.index, s.generation);
+		r.pos = Vec3f(s.pos[0], s.pos[1], s.pos[2]);
+		r.velocity = Vec3f(s.velocity[0], s.velocity[1], s.velocity[2]);
+		r.rgb = r.selectRgb = Vec3f(s.rgb[0], s.rgb[1], s.rgb[2]);
+		r.rad = s.rad;
+		out->spheres.push_back(r);
+	}
+	return out;
+}
@@ -0,0 +1,165 @@
+#pragma once
+#include <vector>
+#include <atomic>
+#include <qsharedmemory.h>
+#include <qstring.h>
+#include "geometry.h"
+#include "renderstate.h"
+
+const quint32 STREAM_MAGIC = 0x42424c53;
+const quint32 STREAM_VERSION = 1;
+// Delta frames between keyframes. A reader that attaches or falls behind resyncs from a keyframe.
+const int STREAM_KEYFRAME_INTERVAL = 30;
+// Frames kept in the ring; a reader further behind than this resynchronizes
+const int STREAM_SLOTS = 32;
+const int STREAM_MAX_SPHERES = 100000;
+const int STREAM_MAX_QUADS = 64;
+// Deltas build on every frame since the keyframe, so the ring has to hold a keyframe and all of them
+// besides the slot being written, or a reader could only resync on the exact frame of a keyframe
+static_assert(STREAM_SLOTS >= STREAM_KEYFRAME_INTERVAL + 2, "The stream ring must be deeper than the keyframe interval");
+// Spheres that moved less than this since they were last sent are left out of delta frames
+const float STREAM_DELTA_EPSILON = 1e-4f;
+
+enum StreamFrameFlags { STREAM_KEYFRAME = 1, STREAM_TRUNCATED = 2 };
+
+// Layout of the shared segment, identical in every process built from this source
+struct StreamHeader {
+	std::atomic<quint32> magic;
+	quint32 version;
+	quint32 slotCount, maxSpheres, maxQuads;
+	quint32 slotBytes;
+	// Bumped by every writer that opens the segment, so readers notice a restart
+	quint32 session;
+	// Last complete frame, 0 before the first. Frame f lives in slot f % slotCount.
+	std::atomic<quint64> latest;
+};
+
+/*
+   Header of a ring slot, followed by its sphere records, the slot indices removed since
+   the previous frame and, on keyframes, the static quads. seq is a sequence lock: odd while
+   the writer is inside the slot, so a reader keeps a copy only if seq was even and unchanged
+   around it.
+*/
+struct StreamFrame {
+	std::atomic<quint32> seq;
+	quint32 flags;
+	quint64 frame, step;
+	double simTime;
+	qint64 wallNs;
+	quint32 spheres, removed, quads, pad;
+};
+
+struct StreamSphere {
+	quint32 index, generation;
+	float pos[3], velocity[3];
+	float rgb[3];
+	float rad;
+};
+
+// A plane or box face, the static scene around the spheres
+struct StreamQuad {
+	float a[3], b[3], c[3], d[3];
+	float rgb[3];
+	quint32 aabb;
+};
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2, "Shared-memory atomics must be lock-free");
+
+/*
+   Publishes every step's sphere state into a named shared-memory ring. The physics thread
+   is the only writer and never waits for readers: each slot is guarded by a sequence lock,
+   and readers that lose a race simply retry or skip ahead. With delta on, frames between
+   keyframes only carry the spheres that moved and the ones that were removed.
+*/
+class StateStreamWriter {
+public:
+	StateStreamWriter(const QString& name, int maxSpheres = STREAM_MAX_SPHERES, bool delta = true);
+	~StateStreamWriter() { close(); }
+
+	// Creates the segment, or takes over one left by an earlier writer; false on failure
+	bool open();
+	void close();
+	bool isOpen() const { return header != nullptr; }
+	// Why the last open failed
+	const QString& errorString() const { return error; }
+
+	// Physics thread only, after the state of a step was captured
+	void publish(const RenderState& state, const Scene& scene);
+
+	bool delta;
+	// Bytes written into the ring by the last frame, for comparing with and without delta
+	quint64 lastFrameBytes;
+
+private:
+	StreamFrame* slot(quint64 frame) const;
+	// Cheap signature of the planes and boxes, so changes to them force a keyframe
+	double quadSignature(const Scene& scene) const;
+
+	QSharedMemory memory;
+	QString error;
+	StreamHeader* header;
+	int maxSpheres;
+	quint64 frame;
+	double lastQuads;
+	// The state readers have for every slot index, as of the last frame
+	std::vector<StreamSphere> sent;
+	std::vector<char> sentValid;
+	std::vector<char> seen;
+};
+
+/*
+   Follows a stream from another process. Polling never blocks the writer; the reader
+   applies every frame since its last poll, or jumps to the newest keyframe when it fell
+   too far behind or has just attached.
+*/
+class StateStreamReader {
+public:
+	StateStreamReader(const QString& name);
+	~StateStreamReader() { detach(); }
+
+	// False while no writer has created the stream
+	bool attach();
+	void detach();
+	bool isAttached() const { return header != nullptr; }
+
+	// Applies the frames published since the last poll, true if the state changed
+	bool poll();
+
+	// Spheres as of the last applied frame, in slot order
+	std::shared_ptr<RenderState> state() const;
+	const std::vector<StreamQuad>& quads() const { return staticQuads; }
+	// Incremented whenever the static quads change
+	int quadsVersion;
+	// Frames never applied because the reader fell behind
+	unsigned long long skipped;
+
+private:
+	struct FrameCopy {
+		quint32 flags;
+		quint64 step;
+		double simTime;
+		qint64 wallNs;
+		std::vector<StreamSphere> spheres;
+		std::vector<quint32> removed;
+		std::vector<StreamQuad> quads;
+	};
+
+	const StreamFrame* slot(quint64 frame) const;
+	// Both copy out of the ring and fail if the slot is being written or no longer holds frame f
+	bool readFlags(quint64 f, quint32& flags) const;
+	bool readFrame(quint64 f, FrameCopy& out) const;
+	void apply(const FrameCopy& frame);
+
+	QSharedMemory memory;
+	const StreamHeader* header;
+	quint32 session;
+	quint64 next;
+	bool synced;
+	FrameCopy copy;
+	std::vector<StreamSphere> table;
+	std::vector<char> present;
+	std::vector<StreamQuad> staticQuads;
+	quint64 step;
+	double simTime;
+	qint64 wallNs;
+};
@@ -0,0 +1,151 @@
+#include "staticbatch.h"
+#include <cmath>
+#include "collision.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define STATIC_BATCH_SSE2
+#endif
+
+// The vector test only preselects lanes for the exact scalar kernels, so it is widened
+// by more than its rounding can differ from theirs
+const float SLACK_ABS = 1e-4f, SLACK_REL = 1e-5f;
+
+// Lanes past the block's spheres sit far in front of every collider
+const float PAD_RAD = -1e30f;
+
+// Centers and radii of a block, one array per coordinate
+struct SphereBlock {
+	float x[STATIC_BATCH], y[STATIC_BATCH], z[STATIC_BATCH], r[STATIC_BATCH];
+	Sphere* spheres[STATIC_BATCH];
+	int idx[STATIC_BATCH];
+	int n;
+
+	void set(int lane, const Sphere& s) { x[lane] = s.pos.x, y[lane] = s.pos.y, z[lane] = s.pos.z, r[lane] = s.rad; }
+};
+
+#ifdef STATIC_BATCH_SSE2
+static inline __m128 absps(__m128 v) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), v); }
+#endif
+
+// Bit i set if lane i may be behind the collider's plane, and within an AABB's bounds
+template<bool bounded> static unsigned hitMask(const SphereBlock& b, const StaticBatch::Collider& c){
+	unsigned mask = 0;
+#ifdef STATIC_BATCH_SSE2
+	__m128 nx = _mm_set1_ps(c.nx), ny = _mm_set1_ps(c.ny), nz = _mm_set1_ps(c.nz), d = _mm_set1_ps(c.d);
+	for (int i = 0; i < STATIC_BATCH; i += 4) {
+		__m128 x = _mm_loadu_ps(b.x + i), y = _mm_loadu_ps(b.y + i), z = _mm_loadu_ps(b.z + i), r = _mm_loadu_ps(b.r + i);
+		__m128 dist = _mm_sub_ps(_mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, nx), _mm_mul_ps(y, ny)), _mm_mul_ps(z, nz)), r), d);
+		__m128 size = _mm_add_ps(_mm_add_ps(_mm_add_ps(absps(x), absps(y)), _mm_add_ps(absps(z), absps(r))), absps(d));
+		__m128 slack = _mm_add_ps(_mm_set1_ps(SLACK_ABS), _mm_mul_ps(size, _mm_set1_ps(SLACK_REL)));
+		__m128 in = _mm_cmple_ps(dist, slack);
+		if (bounded && _mm_movemask_ps(in) != 0) {
+			// Center projected onto the plane
+			__m128 h = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_sub_ps(x, _mm_set1_ps(c.ax)), nx), _mm_mul_ps(_mm_sub_ps(y, _mm_set1_ps(c.ay)), ny)), _mm_mul_ps(_mm_sub_ps(z, _mm_set1_ps(c.az)), nz));
+			__m128 qx = _mm_sub_ps(x, _mm_mul_ps(h, nx)), qy = _mm_sub_ps(y, _mm_mul_ps(h, ny)), qz = _mm_sub_ps(z, _mm_mul_ps(h, nz));
+			in = _mm_and_ps(in, _mm_and_ps(_mm_cmpge_ps(_mm_add_ps(qx, slack), _mm_set1_ps(c.minX)), _mm_cmple_ps(_mm_sub_ps(qx, slack), _mm_set1_ps(c.maxX))));
+			in = _mm_and_ps(in, _mm_and_ps(_mm_cmpge_ps(_mm_add_ps(qy, slack), _mm_set1_ps(c.minY)), _mm_cmple_ps(_mm_sub_ps(qy, slack), _mm_set1_ps(c.maxY))));
+			in = _mm_and_ps(in, _mm_and_ps(_mm_cmpge_ps(_mm_add_ps(qz, slack), _mm_set1_ps(c.minZ)), _mm_cmple_ps(_mm_sub_ps(qz, slack), _mm_set1_ps(c.maxZ))));
+		}
+		mask |= (unsigned)_mm_movemask_ps(in) << i;
+	}
+#else
+	for (int i = 0; i < STATIC_BATCH; ++i) {
+		float dist = b.x[i] * c.nx + b.y[i] * c.ny + b.z[i] * c.nz - b.r[i] - c.d;
+		float slack = SLACK_ABS + SLACK_REL * (std::fabs(b.x[i]) + std::fabs(b.y[i]) + std::fabs(b.z[i]) + std::fabs(b.r[i]) + std::fabs(c.d));
+		bool in = dist <= slack;
+		if (bounded && in) {
+			float h = (b.x[i] - c.ax) * c.nx + (b.y[i] - c.ay) * c.ny + (b.z[i] - c.az) * c.nz;
+			float qx = b.x[i] - h * c.nx, qy = b.y[i] - h * c.ny, qz = b.z[i] - h * c.nz;
+			in = qx + slack >= c.minX && qx - slack <= c.maxX && qy + slack >= c.minY && qy - slack <= c.maxY && qz + slack >= c.minZ && qz - slack <= c.maxZ;
+		}
+		if (in) mask |= 1u << i;
+	}
+#endif
+	return mask;
+}
+
+// What the vector test knows of each static shape type beyond its plane. A registered static
+// shape without one fails to compile.
+template<class B> struct BatchShape;
+template<> struct BatchShape<Plane> {
+	static const bool bounded = false;
+	static void bounds(const Plane&, StaticBatch::Collider&) {}
+};
+template<> struct BatchShape<AABB> {
+	static const bool bounded = true;
+	static void bounds(const AABB& b, StaticBatch::Collider& c) {
+		c.minX = b.minX, c.minY = b.minY, c.minZ = b.minZ;
+		c.maxX = b.maxX, c.maxY = b.maxY, c.maxZ = b.maxZ;
+	}
+};
+
+template<class B> static bool runKernel(Sphere& s, const Plane* shape, Contact& contact, float& impulse){
+	const B& b = *static_cast<const B*>(shape);
+	if (!PairKernel<Sphere, B>::detect(s, b, contact)) return false;
+	impulse = PairKernel<Sphere, B>::respond(s, b, contact);
+	return true;
+}
+
+template<class B> static void addColliders(Scene& scene, std::vector<StaticBatch::Collider>& out){
+	static_assert(std::is_base_of<Plane, B>::value, "The static batch tests static shapes as planes");
+	static_assert(PairKernel<Sphere, B>::defined, "Missing PairKernel for a static shape");
+	auto& shapes = ShapeStorage<B>::get(scene);
+	for (int i = 0; i < (int)shapes.size(); ++i) {
+		const B* p = shapes[i].get();
+		if (p == nullptr) continue;
+		StaticBatch::Collider c;
+		c.kind = ShapeKind<B>::kind, c.index = i, c.shape = p;
+		c.bounded = BatchShape<B>::bounded, c.kernel = &runKernel<B>;
+		c.nx = p->normal.x, c.ny = p->normal.y, c.nz = p->normal.z;
+		c.d = p->a.dot(p->normal);
+		c.ax = p->a.x, c.ay = p->a.y, c.az = p->a.z;
+		c.minX = c.minY = c.minZ = c.maxX = c.maxY = c.maxZ = 0;
+		BatchShape<B>::bounds(*p, c);
+		out.push_back(c);
+	}
+}
+
+void StaticBatch::prepare(Scene& scene){
+	colliders.clear();
+	// Registry order, as the static passes of the other shapes run them
+	forEachType(StaticShapes(), [&](auto b) { addColliders<typename decltype(b)::type>(scene, colliders); });
+}
+
+void StaticBatch::collide(Scene& scene, int begin, int end, ContactStats& contacts, std::vector<ContactEvent>* events) const {
+	if (colliders.empty()) return;
+	SphereBlock b;
+	int i = begin;
+	while (i < end) {
+		// Gather the next active spheres, padding the tail
+		b.n = 0;
+		for (; i < end && b.n < STATIC_BATCH; ++i) {
+			Sphere* s = scene.spheres[i].get();
+			if (s == nullptr || !s->active) continue;
+			b.spheres[b.n] = s, b.idx[b.n] = i;
+			b.set(b.n++, *s);
+		}
+		for (int k = b.n; k < STATIC_BATCH; ++k)
+			b.x[k] = b.y[k] = b.z[k] = 0, b.r[k] = PAD_RAD;
+
+		for (const Collider& c : colliders) {
+			unsigned mask = c.bounded ? hitMask<true>(b, c) : hitMask<false>(b, c);
+			for (; mask != 0; mask &= mask - 1) {
+				int lane = 0;
+				while (!(mask >> lane & 1)) ++lane;
+				Sphere& s = *b.spheres[lane];
+				Contact contact;
+				float j;
+				if (!c.kernel(s, c.shape, contact, j)) continue;
+				contacts.add(contact.depth);
+				// Later colliders see where this one pushed the sphere
+				b.set(lane, s);
+				if (events == nullptr || !scene.contactEvents->wants(j)) continue;
+				ContactEvent e;
+				e.sphere = scene.spheres.handleAt(b.idx[lane]), e.kind = c.kind, e.collider = c.index;
+				e.impulse = j, e.pos = support(s, -contact.normal), e.normal = contact.normal;
+				events->push_back(e);
+			}
+		}
+	}
+}
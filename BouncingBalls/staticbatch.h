@@ -0,0 +1,48 @@
+#pragma once
+#include <vector>
+#include "geometry.h"
+#include "events.h"
+
+struct Contact;
+
+// Spheres tested together against one static collider
+const int STATIC_BATCH = 8;
+
+/*
+   Sphere-vs-static stage of the solver, inverted from one sphere against every collider
+   into one collider against a block of spheres. A block's centers and radii are gathered
+   once, each collider tests the whole block with SIMD compares, and only the hit lanes go
+   through the scalar kernels of the shape registry. Blocks away from every wall cost a few
+   vector compares per collider; with the locality order of the tuner, spheres in a block
+   are also close in space, so most blocks are.
+   Colliders are gathered from every type in StaticShapes, in registry order, and each hit
+   runs the PairKernel of its type, so per sphere the results are those of a StaticPass.
+*/
+class StaticBatch {
+public:
+	// Flattens the scene's static shapes, once per step before collide
+	void prepare(Scene& scene);
+	bool empty() const { return colliders.empty(); }
+
+	// Active spheres in [begin, end) against every collider. Only touches those spheres,
+	// so disjoint ranges may run in parallel. Events are buffered when given a list.
+	void collide(Scene& scene, int begin, int end, ContactStats& contacts, std::vector<ContactEvent>* events) const;
+
+	struct Collider {
+		ContactKind kind;
+		int index;
+		const Plane* shape;
+		// Whether the vector test also checks the bounds below
+		bool bounded;
+		// Exact kernel of the shape's type, false if it missed
+		bool (*kernel)(Sphere& s, const Plane* shape, Contact& contact, float& impulse);
+		// Normal, and its offset from the origin
+		float nx, ny, nz, d;
+		// Corner the normal passes through, and the bounds of AABBs
+		float ax, ay, az;
+		float minX, minY, minZ, maxX, maxY, maxZ;
+	};
+
+private:
+	std::vector<Collider> colliders;
+};
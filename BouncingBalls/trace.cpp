@@ -0,0 +1,102 @@
+#include "trace.h"
+#include <fstream>
+#include <algorithm>
+#include <iomanip>
+
+Tracer& Tracer::instance(){
+	static Tracer tracer;
+	return tracer;
+}
+
+// Per-thread tracing state, the buffer stays null until the thread records something
+struct TraceThread {
+	TraceThread() : buffer(nullptr) {}
+	~TraceThread() {
+		if (buffer != nullptr) Tracer::instance().retire(buffer);
+	}
+
+	std::string name;
+	TraceBuffer* buffer;
+};
+
+static thread_local TraceThread traceThread;
+
+TraceBuffer* Tracer::allocate(const std::string& threadName){
+	QMutexLocker locker(&lock);
+	buffers.push_back(std::make_unique<TraceBuffer>(nextTid++, threadName));
+	return buffers.back().get();
+}
+
+void Tracer::retire(TraceBuffer* buffer){
+	// Kept until exported, so a trace taken after a thread ends still shows its events
+	QMutexLocker locker(&lock);
+	buffer->exited = true;
+}
+
+void Tracer::record(const char* name, long long startNs, long long endNs){
+	TraceBuffer* b = traceThread.buffer;
+	if (b == nullptr) {
+		if (!enabled()) return;
+		b = traceThread.buffer = allocate(traceThread.name);
+	}
+	unsigned long long w = b->written.load(std::memory_order_relaxed);
+	TraceEvent& e = b->events[w % TRACE_BUFFER_EVENTS];
+	e.name = name, e.startNs = startNs, e.durNs = endNs - startNs;
+	b->written.store(w + 1, std::memory_order_release);
+}
+
+void Tracer::setThreadName(const char* name){
+	traceThread.name = name;
+	if (traceThread.buffer != nullptr) {
+		QMutexLocker locker(&lock);
+		traceThread.buffer->threadName = name;
+	}
+}
+
+bool Tracer::exportJson(const std::string& path, int windowMs){
+	std::ofstream out(path);
+	if (!out) return false;
+	out << std::fixed << std::setprecision(3);
+
+	long long cutoff = windowMs > 0 ? now() - windowMs * 1000000ll : 0;
+	bool first = true;
+	auto separator = [&]() {
+		if (!first) out << ",\n";
+		first = false;
+	};
+
+	QMutexLocker locker(&lock);
+	out << "{\"traceEvents\":[\n";
+	for (auto& b : buffers) {
+		if (!b->threadName.empty()) {
+			separator();
+			out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << b->tid
+				<< ",\"args\":{\"name\":\"" << b->threadName << "\"}}";
+		}
+
+		// The slot of event `end` may be being written, and once the ring has wrapped it is the
+		// oldest one, so the window leaves it out
+		unsigned long long end = b->written.load(std::memory_order_acquire);
+		unsigned long long begin = end >= TRACE_BUFFER_EVENTS ? end - TRACE_BUFFER_EVENTS + 1 : 0;
+		std::vector<TraceEvent> events;
+		for (unsigned long long i = begin; i < end; ++i)
+			events.push_back(b->events[i % TRACE_BUFFER_EVENTS]);
+
+		// Drop whatever the owning thread overwrote, or may have been overwriting, while we
+		// were copying
+		unsigned long long after = b->written.load(std::memory_order_acquire);
+		unsigned long long valid = after >= TRACE_BUFFER_EVENTS ? after - TRACE_BUFFER_EVENTS + 1 : 0;
+		for (unsigned long long i = std::max(begin, valid); i < end; ++i) {
+			const TraceEvent& e = events[i - begin];
+			if (e.startNs < cutoff) continue;
+			separator();
+			out << "{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << b->tid
+				<< ",\"ts\":" << e.startNs / 1000.0 << ",\"dur\":" << e.durNs / 1000.0 << "}";
+		}
+	}
+	// Threads that have ended will not record again, so their events are exported only once
+	buffers.erase(std::remove_if(buffers.begin(), buffers.end(),
+		[](const std::unique_ptr<TraceBuffer>& b) { return b->exited; }), buffers.end());
+	out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+	return out.good();
+}
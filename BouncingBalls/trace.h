@@ -0,0 +1,85 @@
+#pragma once
+#include <atomic>
+#include <vector>
+#include <string>
+#include <memory>
+#include <chrono>
+#include <qmutex.h>
+
+// Events kept per thread; older ones are overwritten, giving a rolling window
+const int TRACE_BUFFER_EVENTS = 1 << 16;
+
+struct TraceEvent {
+	const char* name;
+	long long startNs, durNs;
+};
+
+// Ring of events written only by its owning thread
+struct TraceBuffer {
+	TraceBuffer(int tid, const std::string& threadName)
+		: events(TRACE_BUFFER_EVENTS), written(0), tid(tid), threadName(threadName), exited(false) {}
+
+	std::vector<TraceEvent> events;
+	std::atomic<unsigned long long> written;
+	int tid;
+	std::string threadName;
+	// Set when the owning thread ends; the next export is the buffer's last
+	bool exited;
+};
+
+/*
+   Scoped event tracer shared by the physics and GUI threads. Recording is lock-free:
+   each thread appends to its own ring buffer and publishes with a single atomic store.
+   Only registering a new thread and exporting take the lock.
+
+   A thread's buffer is allocated by its first record() with tracing enabled, so naming
+   threads costs nothing while tracing is off. Buffers of threads that have ended are
+   freed by the export that follows.
+*/
+class Tracer {
+public:
+	static Tracer& instance();
+
+	bool enabled() const { return on.load(std::memory_order_relaxed); }
+	void setEnabled(bool enabled) { on.store(enabled, std::memory_order_relaxed); }
+
+	long long now() const {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+	}
+
+	void record(const char* name, long long startNs, long long endNs);
+	void setThreadName(const char* name);
+
+	// Writes Chrome trace-event JSON (chrome://tracing, Perfetto) for the last windowMs, 0 for everything buffered
+	bool exportJson(const std::string& path, int windowMs = 0);
+
+private:
+	friend struct TraceThread;
+
+	Tracer() : on(false), epoch(std::chrono::steady_clock::now()), nextTid(1) {}
+	TraceBuffer* allocate(const std::string& threadName);
+	void retire(TraceBuffer* buffer);
+
+	std::atomic<bool> on;
+	std::chrono::steady_clock::time_point epoch;
+	std::vector<std::unique_ptr<TraceBuffer>> buffers;
+	int nextTid;
+	QMutex lock;
+};
+
+class TraceScope {
+public:
+	TraceScope(const char* name) : name(name), start(Tracer::instance().enabled() ? Tracer::instance().now() : -1) {}
+	~TraceScope() {
+		if (start >= 0) Tracer::instance().record(name, start, Tracer::instance().now());
+	}
+
+private:
+	const char* name;
+	long long start;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+// Records the enclosing scope under `name`, which must be a string literal
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
@@ -7,9 +7,9 @@ public:
 	Vec3f(const Vec3f& other) : x(other.x), y(other.y), z(other.z) {}
 	Vec3f(float x, float y, float z) : x(x), y(y), z(z) {}
 
-	float normsq() { return x * x + y * y + z * z; }
-	float norm() { return sqrtf(normsq()); }
-	float dot(const Vec3f& other) { return x * other.x + y * other.y + z * other.z; }
+	float normsq() const { return x * x + y * y + z * z; }
+	float norm() const { return sqrtf(normsq()); }
+	float dot(const Vec3f& other) const { return x * other.x + y * other.y + z * other.z; }
 
 	void normalize() {
 		float l = norm();
@@ -17,7 +17,7 @@ public:
 			x /= l, y /= l, z /= l;
 	}
 
-	Vec3f cross(const Vec3f& other) {
+	Vec3f cross(const Vec3f& other) const {
 		return Vec3f(y * other.z - z * other.y, z * other.x - x * other.z, x * other.y - y * other.x);
 	}
 
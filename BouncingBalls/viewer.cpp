@@ -0,0 +1,120 @@
+#include "viewer.h"
+#include <QKeyEvent>
+#include <QMouseEvent>
+#include <QWheelEvent>
+#include "trace.h"
+
+StreamViewer::StreamViewer(const QString& name, QWidget* parent)
+	: QOpenGLWidget(parent), name(name), reader(name), camera(Camera3D(0, 10, 25)),
+	lastX(0), lastY(0), fps(60), quadsVersion(0), paused(false)
+{
+	camera.rotX = 15;
+	setFocusPolicy(Qt::StrongFocus);
+	resize(1280, 720);
+	updateTitle();
+}
+
+void StreamViewer::initializeGL(){
+	Tracer::instance().setThreadName("viewer");
+	renderer.initialize();
+	QTimer::singleShot(0, this, &StreamViewer::renderLoop);
+}
+
+void StreamViewer::resizeGL(int w, int h){
+	renderer.resize(w, h);
+}
+
+void StreamViewer::paintGL(){
+	TRACE_SCOPE("paintGL");
+	renderer.render(world, camera, SphereHandle(), renderClockNs());
+}
+
+void StreamViewer::renderLoop(){
+	TRACE_SCOPE("renderLoop");
+	bool wasAttached = reader.isAttached();
+	// Keep retrying, the engine may start after the viewer
+	if (!paused && !reader.isAttached()) reader.attach();
+	if (reader.poll()) {
+		world.publishRenderState(reader.state());
+		syncStatics();
+	}
+	if (reader.isAttached() != wasAttached) updateTitle();
+
+	camera.fly(keystates[Qt::Key_W], keystates[Qt::Key_S], keystates[Qt::Key_A], keystates[Qt::Key_D],
+		keystates[Qt::Key_Q], keystates[Qt::Key_E]);
+	update();
+	QTimer::singleShot(1000.0f / fps, this, &StreamViewer::renderLoop);
+}
+
+void StreamViewer::syncStatics(){
+	if (reader.quadsVersion == quadsVersion) return;
+	quadsVersion = reader.quadsVersion;
+
+	QMutexLocker lock(&world.structureLock);
+	world.planes.clear();
+	world.aabbs.clear();
+	for (const StreamQuad& q : reader.quads()) {
+		Vec3f a(q.a[0], q.a[1], q.a[2]), b(q.b[0], q.b[1], q.b[2]), c(q.c[0], q.c[1], q.c[2]), d(q.d[0], q.d[1], q.d[2]);
+		Vec3f rgb(q.rgb[0], q.rgb[1], q.rgb[2]);
+		if (q.aabb) world.aabbs.push_back(std::make_unique<AABB>(a, b, c, d, rgb));
+		else world.planes.push_back(std::make_unique<Plane>(a, b, c, d, rgb));
+	}
+}
+
+void StreamViewer::updateTitle(){
+	const char* status = paused ? "detached" : reader.isAttached() ? "attached" : "waiting for engine";
+	setWindowTitle(QString("Bouncing Balls viewer - %1 (%2)").arg(name, status));
+}
+
+void StreamViewer::keyPressEvent(QKeyEvent* event){
+	keystates[event->key()] = true;
+
+	if (event->key() == Qt::Key_Escape) {
+		close();
+	}
+
+	if (event->key() == Qt::Key_P) {
+		// Detach from the stream, or attach again
+		paused = !paused;
+		if (paused) reader.detach();
+		updateTitle();
+	}
+
+	if (event->key() == Qt::Key_N) {
+		// Cycle sphere placement between steps: latest state, interpolated, extrapolated
+		renderer.interpolator.mode = RenderBlend((renderer.interpolator.mode + 1) % BLEND_MODES);
+	}
+}
+
+void StreamViewer::keyReleaseEvent(QKeyEvent* event){
+	if (!event->isAutoRepeat()) {
+		keystates[event->key()] = false;
+	}
+}
+
+void StreamViewer::mousePressEvent(QMouseEvent* e){
+	keystates[e->button()] = true;
+	lastX = e->x(), lastY = e->y();
+}
+
+void StreamViewer::mouseReleaseEvent(QMouseEvent* e){
+	keystates[e->button()] = false;
+}
+
+void StreamViewer::mouseMoveEvent(QMouseEvent* e){
+	if (keystates[Qt::LeftButton]) {
+		// Turn camera
+		int diffX = (e->x() - lastX) * 0.2;
+		int diffY = (e->y() - lastY) * 0.2;
+		lastX = e->x(), lastY = e->y();
+		camera.turn(diffX, diffY);
+	}
+}
+
+void StreamViewer::wheelEvent(QWheelEvent* event){
+	if (event->delta() > 0) {
+		renderer.zoom += 0.2f;
+	} else if (event->delta() < 0) {
+		renderer.zoom -= 0.2f;
+	}
+}
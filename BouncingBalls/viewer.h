@@ -0,0 +1,48 @@
+#pragma once
+#include <QOpenGLWidget>
+#include <qmap.h>
+#include <qtimer.h>
+#include "camera.h"
+#include "renderer.h"
+#include "statestream.h"
+
+/*
+   Window that renders a simulation running in another process, read from its shared-memory
+   state stream. The viewer never talks back to the engine, so any number of them can
+   attach and detach without changing how the physics runs.
+*/
+class StreamViewer : public QOpenGLWidget {
+	Q_OBJECT
+public:
+	explicit StreamViewer(const QString& name, QWidget* parent = 0);
+
+	void initializeGL() override;
+	void resizeGL(int w, int h) override;
+	void paintGL() override;
+
+	void keyPressEvent(QKeyEvent* event) override;
+	void keyReleaseEvent(QKeyEvent* event) override;
+	void mousePressEvent(QMouseEvent* event) override;
+	void mouseReleaseEvent(QMouseEvent* event) override;
+	void mouseMoveEvent(QMouseEvent* event) override;
+	void wheelEvent(QWheelEvent* event) override;
+
+private:
+	void renderLoop();
+	// Mirrors the planes and boxes of the stream into the local scene
+	void syncStatics();
+	void updateTitle();
+
+	QString name;
+	StateStreamReader reader;
+	// Holds only what the stream sent; nothing steps it
+	Scene world;
+	Camera3D camera;
+	SceneRenderer renderer;
+	QMap<int, bool> keystates;
+	float lastX, lastY;
+	int fps;
+	int quadsVersion;
+	// Detached on request, stays so until reattached
+	bool paused;
+};